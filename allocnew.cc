@@ -0,0 +1,200 @@
+/* allocnew.cc  -- operator new and delete that count for AllocStats
+
+Copyright (C) 2017, Brian Bray
+
+This file replaces the global operator new and delete of a program, so
+it is linked into docgen but not put into libdocgen.a.
+*/
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <ostream>
+
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+#include "allocstats.h"
+
+/*	usableSize -- internal routine returns the heap bytes taken by p,
+			or 0 where the C library cannot say.
+*/
+static inline size_t usableSize( void* p )
+{
+#if defined(__GLIBC__)
+	return malloc_usable_size( p );
+#else
+	return 0;
+#endif
+}
+
+/*	allocate -- internal routine is operator new: allocates cb bytes,
+			calling the new handler until it succeeds.
+
+	Throws: std::bad_alloc if there is no new handler
+*/
+static void* allocate( size_t cb )
+{
+	void* p;
+
+	while ((p = malloc( cb ? cb : 1 ))==0) {
+		std::new_handler pfnHandler = std::get_new_handler();
+		if (pfnHandler==0)
+			throw std::bad_alloc();
+		(*pfnHandler)();
+	}
+	if (AllocStats::isEnabled())
+		AllocStats::noteAlloc( cb, usableSize( p ) );
+	return p;
+}
+
+/*	allocateAligned -- internal routine is the operator new of types
+			aligned beyond what malloc() gives: allocates cb bytes on
+			an align boundary, calling the new handler until it
+			succeeds.
+
+	Throws: std::bad_alloc if there is no new handler
+*/
+static void* allocateAligned( size_t cb, std::align_val_t align )
+{
+	size_t cbAlign = static_cast<size_t>( align );
+	void* p;
+
+	if (cbAlign<sizeof(void*))
+		cbAlign = sizeof(void*);
+	while (posix_memalign( &p, cbAlign, cb ? cb : 1 )!=0) {
+		std::new_handler pfnHandler = std::get_new_handler();
+		if (pfnHandler==0)
+			throw std::bad_alloc();
+		(*pfnHandler)();
+	}
+	if (AllocStats::isEnabled())
+		AllocStats::noteAlloc( cb, usableSize( p ) );
+	return p;
+}
+
+/*	deallocate -- internal routine is operator delete, of either form */
+static void deallocate( void* p ) noexcept
+{
+	if (p && AllocStats::isEnabled())
+		AllocStats::noteFree( usableSize( p ) );
+	free( p );
+}
+
+
+void* operator new( size_t cb )
+{
+	return allocate( cb );
+}
+
+void* operator new[]( size_t cb )
+{
+	return allocate( cb );
+}
+
+void* operator new( size_t cb, const std::nothrow_t& ) noexcept
+{
+	try {
+		return allocate( cb );
+	} catch (...) {
+		return 0;
+	}
+}
+
+void* operator new[]( size_t cb, const std::nothrow_t& ) noexcept
+{
+	try {
+		return allocate( cb );
+	} catch (...) {
+		return 0;
+	}
+}
+
+void operator delete( void* p ) noexcept
+{
+	deallocate( p );
+}
+
+void operator delete[]( void* p ) noexcept
+{
+	deallocate( p );
+}
+
+void operator delete( void* p, size_t ) noexcept
+{
+	deallocate( p );
+}
+
+void operator delete[]( void* p, size_t ) noexcept
+{
+	deallocate( p );
+}
+
+void operator delete( void* p, const std::nothrow_t& ) noexcept
+{
+	deallocate( p );
+}
+
+void operator delete[]( void* p, const std::nothrow_t& ) noexcept
+{
+	deallocate( p );
+}
+
+void* operator new( size_t cb, std::align_val_t align )
+{
+	return allocateAligned( cb, align );
+}
+
+void* operator new[]( size_t cb, std::align_val_t align )
+{
+	return allocateAligned( cb, align );
+}
+
+void* operator new( size_t cb, std::align_val_t align, const std::nothrow_t& ) noexcept
+{
+	try {
+		return allocateAligned( cb, align );
+	} catch (...) {
+		return 0;
+	}
+}
+
+void* operator new[]( size_t cb, std::align_val_t align, const std::nothrow_t& ) noexcept
+{
+	try {
+		return allocateAligned( cb, align );
+	} catch (...) {
+		return 0;
+	}
+}
+
+void operator delete( void* p, std::align_val_t ) noexcept
+{
+	deallocate( p );
+}
+
+void operator delete[]( void* p, std::align_val_t ) noexcept
+{
+	deallocate( p );
+}
+
+void operator delete( void* p, size_t, std::align_val_t ) noexcept
+{
+	deallocate( p );
+}
+
+void operator delete[]( void* p, size_t, std::align_val_t ) noexcept
+{
+	deallocate( p );
+}
+
+void operator delete( void* p, std::align_val_t, const std::nothrow_t& ) noexcept
+{
+	deallocate( p );
+}
+
+void operator delete[]( void* p, std::align_val_t, const std::nothrow_t& ) noexcept
+{
+	deallocate( p );
+}
@@ -0,0 +1,197 @@
+/* allocstats.cc  -- Counts of heap allocations by phase, owner and site
+
+Copyright (C) 2017, Brian Bray
+
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <ostream>
+#include <vector>
+
+#include "allocstats.h"
+
+/*: class AllocStats
+
+	Much of the time of a run may go to the heap: copies of Tokens,
+	strings built a character at a time, temporaries while rendering
+	and list nodes.  With "--alloc-stats", docgen counts every call of
+	operator new and reports, when done:
+	<UL>
+	<LI>For each phase (startup, input, output), the number and bytes
+	of the allocations and the peak of the bytes in use
+	<LI>For each kind of owner (Token, Attribute, DocItem, output), the
+	number and bytes of the allocations
+	<LI>The sites that allocated most often
+	</UL>
+	A site is a routine that declares a Site and a Scope; allocations
+	made while a Scope is open, by the routine or anything it calls
+	that has no Scope of its own, are charged to its Site.  Others are
+	charged to "(untagged)".
+	<P>
+	Counting is done by a replacement operator new in allocnew.cc, which
+	is linked into the docgen program but not into libdocgen.a, so that
+	programs using the library keep their own.  Until enable() is called
+	a Scope costs a test.  The counters, and the flag that enable()
+	sets, are atomic, so the threads of --serve may allocate at once.
+	The over-aligned forms of operator new are replaced too.
+*/
+
+std::atomic<bool> AllocStats::s_isEnabled( false );
+AllocStats::Site* AllocStats::s_pSites = 0;
+
+namespace {
+
+// Allocations made outside of any Scope
+AllocStats::Site s_siteUntagged( "(untagged)", AllocStats::oOther );
+
+thread_local AllocStats::Site* t_pSite = 0;
+
+std::atomic<int> s_phase( AllocStats::phStartup );
+AllocStats::Counts s_aPhases[AllocStats::cPhases];
+std::atomic<long long> s_acbPeak[AllocStats::cPhases];
+AllocStats::Counts s_aOwners[AllocStats::cOwners];
+std::atomic<long long> s_cbLive( 0 );
+
+const char* const s_asPhases[AllocStats::cPhases] = {"startup", "input", "output"};
+const char* const s_asOwners[AllocStats::cOwners] = {"other", "token", "attribute", "docitem", "output"};
+
+}
+
+/*	countsAdd -- internal routine counts one allocation of cb bytes */
+static inline void countsAdd( AllocStats::Counts& counts, size_t cb )
+{
+	counts.m_cAllocs.fetch_add( 1, std::memory_order_relaxed );
+	counts.m_cbAllocs.fetch_add( (long long)cb, std::memory_order_relaxed );
+}
+
+/*	countsOut -- internal routine writes "allocs=n bytes=n" */
+static void countsOut( std::ostream& os, const AllocStats::Counts& counts )
+{
+	os << " allocs=" << counts.m_cAllocs.load( std::memory_order_relaxed )
+	   << " bytes=" << counts.m_cbAllocs.load( std::memory_order_relaxed );
+}
+
+
+/*: routine AllocStats::Site::Site
+
+	Constructor.  Adds the site to the list that reportOut() reads, so a
+	Site should be a static that lives until the end of the program.
+*/
+AllocStats::Site::Site( const char* sName, Owner owner )
+	:	m_sName( sName ),
+	    m_owner( owner ),
+	    m_counts(),
+	    m_pNext( s_pSites )
+{
+	s_pSites = this;
+}
+
+/*: routine AllocStats::enable
+
+	Starts counting.  Call at the start of the program, before any
+	threads: memory allocated before the call and freed after it is
+	taken off the bytes in use without having been added.
+*/
+void AllocStats::enable()
+{
+	s_isEnabled.store( true, std::memory_order_relaxed );
+}
+
+/*: routine AllocStats::setPhase
+
+	Charges the allocations from now on to phase.
+*/
+void AllocStats::setPhase( Phase phase )
+{
+	s_phase.store( phase, std::memory_order_relaxed );
+}
+
+/*: routine AllocStats::noteAlloc
+
+	Counts an allocation of cb bytes, which took cbUsable bytes of the
+	heap.  Called by operator new; must not allocate.
+*/
+void AllocStats::noteAlloc( size_t cb, size_t cbUsable )
+{
+	Site* pSite = t_pSite ? t_pSite : &s_siteUntagged;
+	int phase = s_phase.load( std::memory_order_relaxed );
+
+	countsAdd( pSite->m_counts, cb );
+	countsAdd( s_aOwners[pSite->m_owner], cb );
+	countsAdd( s_aPhases[phase], cb );
+
+	long long cbLive = s_cbLive.fetch_add( (long long)cbUsable, std::memory_order_relaxed )
+	                   + (long long)cbUsable;
+	long long cbPeak = s_acbPeak[phase].load( std::memory_order_relaxed );
+	while (cbLive>cbPeak
+	       && !s_acbPeak[phase].compare_exchange_weak( cbPeak, cbLive, std::memory_order_relaxed ))
+		;
+}
+
+/*: routine AllocStats::noteFree
+
+	Counts the freeing of cbUsable bytes of the heap.  Called by
+	operator delete; must not allocate.
+*/
+void AllocStats::noteFree( size_t cbUsable )
+{
+	s_cbLive.fetch_sub( (long long)cbUsable, std::memory_order_relaxed );
+}
+
+/*: routine AllocStats::reportOut
+
+	Stops counting and writes the counts to os, one line each, as
+	"alloc: key=value ...":
+	<PRE>
+	alloc: phase=input allocs=182034 bytes=9120410 peak_kb=61022
+	alloc: owner=token allocs=90210 bytes=2301192
+	alloc: site=LexStream::getAttributeText owner=token allocs=40112 bytes=1003120
+	</PRE>
+	Only the cSites sites with the most allocations are written.
+	Bytes are those asked for; the peak is of the heap in use, which
+	includes the allocator's rounding.
+*/
+void AllocStats::reportOut( std::ostream& os, int cSites )
+{
+	s_isEnabled.store( false, std::memory_order_relaxed );
+
+	for (int i=0; i<cPhases; i++) {
+		os << "alloc: phase=" << s_asPhases[i];
+		countsOut( os, s_aPhases[i] );
+		os << " peak_kb=" << s_acbPeak[i].load( std::memory_order_relaxed )/1024 << '\n';
+	}
+	for (int i=0; i<cOwners; i++) {
+		os << "alloc: owner=" << s_asOwners[i];
+		countsOut( os, s_aOwners[i] );
+		os << '\n';
+	}
+
+	std::vector<const Site*> vSites;
+	for (const Site* pSite=s_pSites; pSite; pSite=pSite->m_pNext) {
+		if (pSite->m_counts.m_cAllocs.load( std::memory_order_relaxed )>0)
+			vSites.push_back( pSite );
+	}
+	std::stable_sort( vSites.begin(), vSites.end(), []( const Site* pA, const Site* pB ) {
+		return pA->m_counts.m_cAllocs.load( std::memory_order_relaxed )
+		       >pB->m_counts.m_cAllocs.load( std::memory_order_relaxed );
+	} );
+	for (size_t i=0; i<vSites.size() && (int)i<cSites; i++) {
+		os << "alloc: site=" << vSites[i]->m_sName
+		   << " owner=" << s_asOwners[vSites[i]->m_owner];
+		countsOut( os, vSites[i]->m_counts );
+		os << '\n';
+	}
+	os.flush();
+}
+
+/*	AllocStats::swapSite -- internal routine makes pSite the site of this
+			thread's allocations, and returns the one it replaces.
+*/
+AllocStats::Site* AllocStats::swapSite( Site* pSite )
+{
+	Site* pSaved = t_pSite;
+
+	t_pSite = pSite;
+	return pSaved;
+}
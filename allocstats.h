@@ -0,0 +1,79 @@
+/* allocstats.h -- Counts of heap allocations by phase, owner and site
+
+Copyright (C) 2017, Brian Bray
+
+*/
+
+/* Needs:
+#include <atomic>
+#include <ostream>
+*/
+
+//	Counts the allocations of a run, when enabled, by phase of the run,
+//	by the kind of object they are for and by the site that made them.
+//	The counting operator new is in allocnew.cc, which only the docgen
+//	program links; without it nothing is counted.
+class AllocStats {
+public:
+	enum Phase {phStartup, phInput, phOutput, cPhases};
+	enum Owner {oOther, oToken, oAttribute, oDocItem, oOutput, cOwners};
+
+	struct Counts {
+		std::atomic<long long>	m_cAllocs;
+		std::atomic<long long>	m_cbAllocs;
+	};
+
+	//	A place that allocates, declared once at file scope, eg:
+	//		static AllocStats::Site s_siteGetToken( "LexStream::getToken", AllocStats::oToken );
+	class Site {
+	public:
+		Site( const char* sName, Owner owner );
+
+		const char*	m_sName;
+		Owner		m_owner;
+		Counts		m_counts;
+		Site*		m_pNext;		// Every Site, in a list from s_pSites
+	};
+
+	//	Charges the allocations of this thread to a Site until the end
+	//	of the scope, eg:
+	//		AllocStats::Scope allocs( s_siteGetToken );
+	class Scope {
+	public:
+		explicit Scope( Site& site )
+			:	m_pSaved( 0 ), m_isSet( isEnabled() )
+		{
+			if (m_isSet)
+				m_pSaved = swapSite( &site );
+		}
+		~Scope() {
+			if (m_isSet)
+				swapSite( m_pSaved );
+		}
+
+	private:
+		Scope( const Scope& );					// Not copyable
+		Scope& operator=( const Scope& );
+
+	private:
+		Site*	m_pSaved;
+		bool	m_isSet;
+	};
+
+	static void enable();
+	static bool isEnabled() {
+		return s_isEnabled.load( std::memory_order_relaxed );
+	}
+	static void setPhase( Phase phase );
+	static void noteAlloc( size_t cb, size_t cbUsable );
+	static void noteFree( size_t cbUsable );
+	static void reportOut( std::ostream& os, int cSites=DefaultSites );
+
+	enum {DefaultSites=10};
+
+private:
+	static Site* swapSite( Site* pSite );
+
+	static std::atomic<bool>	s_isEnabled;	// Read by every allocation, on any thread
+	static Site*	s_pSites;
+};
@@ -0,0 +1,258 @@
+/* backend.h -- The output formats a Project is written in
+
+Copyright (C) 2017, Brian Bray
+
+*/
+
+/* Needs:
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "docitem.h"
+#include "docsink.h"
+#include "fragcache.h"
+*/
+
+//	The title of a DocItem, made the first time a backend asks for it
+//	and then shared by the others.
+class ItemTitle {
+public:
+	explicit ItemTitle( const DocItem& di )
+		:	m_di( di ), m_isMade( false ) {}
+
+	std::string_view value() {
+		if (!m_isMade) {
+			m_svTitle = m_di.getTitle( m_sBuffer );
+			m_isMade = true;
+		}
+		return m_svTitle;
+	}
+
+private:
+	ItemTitle( const ItemTitle& );					// Not copyable
+	ItemTitle& operator=( const ItemTitle& );
+
+private:
+	const DocItem&		m_di;
+	bool				m_isMade;
+	std::string			m_sBuffer;
+	std::string_view	m_svTitle;
+};
+
+//	Writes the pages of a Project in one format.  The Project walks its
+//	pages once and calls every backend of the run for each part of them
+//	(see Project::filesOut()); a backend only formats.  Each page is
+//	kept by the backend until endPage(), which writes it to its sink.
+class OutputBackend {
+public:
+	enum ListKind {lkClasses, lkScopes, lkFunctions, lkVariables};
+
+	virtual ~OutputBackend() {}
+
+	virtual const char* extension() const = 0;		// eg: ".html"
+
+	// A page: the project's, a namespace's or a class's
+	virtual void beginPage( const std::string& sPageName, const std::string& sTitle ) = 0;
+	virtual size_t endPage() = 0;
+
+	// The project or a class; attributes come in the order they are shown
+	virtual void beginItem( const DocItem& di ) {}
+	virtual void attributeOut( const Attribute& attr, std::string_view sValue ) {}
+	virtual void endItem( const DocItem& di ) {}
+
+	// An index of classes, namespaces or members
+	virtual void beginList( ListKind lk, const std::string& sHeading, size_t cEntries ) {}
+	virtual void classEntry( const DocClass& cls, ItemTitle& title ) {}
+	virtual void scopeEntry( const DocScope& scope ) {}
+	virtual bool beginMember( const DocItem& di, ItemTitle& title ) {
+		return true;
+	}
+	virtual void endMember( const DocItem& di ) {}
+	virtual void endList( ListKind lk ) {}
+
+	// The globals on the project page, then the end of a class
+	virtual void beginGlobals( const std::string& sHeading, bool hasGlobals ) {}
+	virtual void endGlobals( bool hasGlobals ) {}
+	virtual void endBody( const DocClass& cls ) {}
+
+	// Files the pages share, written once after them; returns their size
+	virtual size_t assetsOut() {
+		return 0;
+	}
+	// Bytes the pages are smaller than in the full markup of the format
+	virtual long long markupSaved() const {
+		return 0;
+	}
+};
+
+//	The backends of the formats asked for, all writing into one sink.
+class OutputBackends {
+public:
+	OutputBackends( DocSink& sink, int fFormats, FragmentCache* pCache,
+	                std::string_view sSourceLink );
+	~OutputBackends();
+
+	static int formatOf( std::string_view sExtension );
+
+	size_t size() const {
+		return m_vBackends.size();
+	}
+	OutputBackend& operator[]( size_t i ) const {
+		return *m_vBackends[i];
+	}
+
+	void addWritten( long long cb ) {
+		m_cbWritten += cb;
+	}
+	void assetsOut();
+	long long written() const {
+		return m_cbWritten;
+	}
+	long long markupSaved() const;
+
+private:
+	OutputBackends( const OutputBackends& );		// Not copyable
+	OutputBackends& operator=( const OutputBackends& );
+
+private:
+	std::vector<OutputBackend*>	m_vBackends;	// Owned
+	long long					m_cbWritten;	// Pages and assets, all formats
+};
+
+struct HtmlMarkup;
+
+//	The HTML pages, see output.cc
+class HtmlBackend : public OutputBackend {
+public:
+	HtmlBackend( DocSink& sink, FragmentCache* pCache, bool isMinified,
+	             std::string_view sSourceLink );
+
+	static const char scStyleSheet[];		// Shared by minified pages
+
+	virtual const char* extension() const {
+		return ".html";
+	}
+	virtual void beginPage( const std::string& sPageName, const std::string& sTitle );
+	virtual size_t endPage();
+	virtual void beginItem( const DocItem& di );
+	virtual void attributeOut( const Attribute& attr, std::string_view sValue );
+	virtual void endItem( const DocItem& di );
+	virtual void beginList( ListKind lk, const std::string& sHeading, size_t cEntries );
+	virtual void classEntry( const DocClass& cls, ItemTitle& title );
+	virtual void scopeEntry( const DocScope& scope );
+	virtual bool beginMember( const DocItem& di, ItemTitle& title );
+	virtual void endMember( const DocItem& di );
+	virtual void endList( ListKind lk );
+	virtual void beginGlobals( const std::string& sHeading, bool hasGlobals );
+	virtual void endBody( const DocClass& cls );
+	virtual size_t assetsOut();
+	virtual long long markupSaved() const {
+		return m_cbSaved;
+	}
+
+	// The markup between the text of a page, see HtmlMarkup in output.cc
+	enum Markup {
+		mPage, mPageTitleEnd, mPageEnd,
+		mHeading, mHeadingName, mHeadingEnd,
+		mPrototype, mPrototypeEnd, mPara,
+		mDefinitions, mTerm, mTermEnd, mDefinitionsEnd,
+		mListHeading, mListHeadingEnd, mTable, mTableEnd,
+		mRow, mRowName, mMemberRow, mMemberRowName, mRowTitle, mRowEnd,
+		mRule, mBold, mBoldEnd, mLink, mLinkName, mLinkEnd,
+		cMarkup
+	};
+
+private:
+	void markupOut( std::ostream& os, Markup m );
+	void headingOut( const DocItem& di );
+	void definitionsOut();
+	void rowOut( std::ostream& os, const DocItem& di, ItemTitle& title );
+	void sourceOut( std::ostream& os, std::string_view sLocation );
+
+private:
+	DocSink&			m_sink;
+	FragmentCache*		m_pCache;		// Not owned, may be 0
+	bool				m_isMinified;	// Compact markup and a shared stylesheet
+	const HtmlMarkup*	m_pMarkup;		// Full or compact
+	long long			m_cbSaved;		// Of the markup, by m_isMinified
+	long long			m_cbMemberSaved;	// m_cbSaved when the member began
+	std::string			m_sSourceLink;	// Template, see DocItem::getSourceLink()
+	std::string			m_sKeyVariant;	// Of the rendering, for the cache
+	const DocItem*		m_pdi;			// Whose attributes are being written
+	std::string			m_sFileName;	// Of the page
+	std::ostringstream	m_os;			// The page
+	std::stringstream	m_ssDetails;	// Member details, after the indexes
+	std::ostringstream	m_osMember;		// Detail of a member not yet cached
+	std::ostream*		m_pos;			// Where attributes go
+	bool				m_isInDefinitions;
+	bool				m_isFromCache;	// The member's row and details
+	FragmentCache::Key	m_key;			// Of the member, if caching
+	std::string			m_sRow;			// Of the member, if caching
+};
+
+//	A JSON document for each page, see formats.cc
+class JsonBackend : public OutputBackend {
+public:
+	JsonBackend( DocSink& sink );
+
+	virtual const char* extension() const {
+		return ".json";
+	}
+	virtual void beginPage( const std::string& sPageName, const std::string& sTitle );
+	virtual size_t endPage();
+	virtual void beginItem( const DocItem& di );
+	virtual void attributeOut( const Attribute& attr, std::string_view sValue );
+	virtual void endItem( const DocItem& di );
+	virtual void beginList( ListKind lk, const std::string& sHeading, size_t cEntries );
+	virtual void classEntry( const DocClass& cls, ItemTitle& title );
+	virtual void scopeEntry( const DocScope& scope );
+	virtual bool beginMember( const DocItem& di, ItemTitle& title );
+	virtual void endMember( const DocItem& di );
+	virtual void endList( ListKind lk );
+	virtual void beginGlobals( const std::string& sHeading, bool hasGlobals );
+	virtual void endGlobals( bool hasGlobals );
+
+private:
+	void keyOut( const char* sKey );
+	void separatorOut();
+
+private:
+	DocSink&			m_sink;
+	std::string			m_sFileName;	// Of the page
+	std::ostringstream	m_os;			// The page
+	bool				m_isFirst;		// Nothing yet in the object or array
+};
+
+//	A plain text page for each page, laid out like a man page, see
+//	formats.cc
+class TextBackend : public OutputBackend {
+public:
+	TextBackend( DocSink& sink );
+
+	virtual const char* extension() const {
+		return ".txt";
+	}
+	virtual void beginPage( const std::string& sPageName, const std::string& sTitle );
+	virtual size_t endPage();
+	virtual void beginItem( const DocItem& di );
+	virtual void attributeOut( const Attribute& attr, std::string_view sValue );
+	virtual void beginList( ListKind lk, const std::string& sHeading, size_t cEntries );
+	virtual void classEntry( const DocClass& cls, ItemTitle& title );
+	virtual void scopeEntry( const DocScope& scope );
+	virtual bool beginMember( const DocItem& di, ItemTitle& title );
+	virtual void beginGlobals( const std::string& sHeading, bool hasGlobals );
+	virtual void endGlobals( bool hasGlobals );
+
+private:
+	void sectionOut( std::string_view sSection );
+
+private:
+	DocSink&			m_sink;
+	std::string			m_sFileName;	// Of the page
+	std::ostringstream	m_os;			// The page
+	bool				m_isInGlobals;
+	bool				m_isInMember;	// Attributes are of a member
+	std::string			m_sSection;		// Last written, to group attributes
+};
@@ -0,0 +1,169 @@
+/* depfile.cc  -- Make style dependencies of the generated pages
+
+Copyright (C) 2017, Brian Bray
+
+*/
+
+#include <fstream>
+#include <list>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "bw/countable.h"
+#include "bw/exception.h"
+#include "lexstream.h"
+#include "schema.h"
+#include "docitem.h"
+#include "depfile.h"
+
+using bw::BFileException;
+using std::string;
+using std::string_view;
+
+/*: class DependFile
+
+	A build that runs docgen can only tell when to run it again if it
+	knows which inputs each page came from.  A DependFile is given the
+	page names and their sources as the pages are written (see
+	Project::setDependFile()), and writes them in the depfile format of
+	"cc -MD", which make can include and ninja can read:
+	<PRE>
+		out: \
+		 a.h \
+		 b.h
+		out/index.html: \
+		 a.h \
+		 b.h
+		out/Parser.html: \
+		 a.h
+	</PRE>
+	A class page depends on the files holding doc blocks for the class
+	or its members.  The index and namespace pages list every class, so
+	they depend on every file that holds a doc block.
+	<P>
+	A page whose content did not change keeps its old time (see
+	StagedDir), so it may look out of date to make after every run.
+	The output directory itself is written on every run, so it comes
+	first, depending on every source, and is the target a build should
+	use.
+	<P>
+	An input that holds no doc block is in no page's dependencies, so
+	adding the first doc block to a file does not by itself cause a
+	rebuild.
+*/
+
+/*	escaped -- internal routine quotes a file name for make */
+static string escaped( string_view sName )
+{
+	string s;
+
+	for (size_t i=0; i<sName.size(); i++) {
+		char ch = sName[i];
+		if (ch=='$')
+			s += '$';
+		else if (ch==' ' || ch=='\t' || ch=='#')
+			s += '\\';
+		s += ch;
+	}
+	return s;
+}
+
+/*	isFile -- internal routine returns false for a source that names no
+			file, such as "<stream>" or "<buffer>".
+*/
+static bool isFile( const string& sSource )
+{
+	return !sSource.empty() && sSource[0]!='<';
+}
+
+/*	ruleOut -- internal routine writes one rule */
+static void ruleOut( std::ostream& os, const string& sTarget, const DocItem::SourceSet& setSources )
+{
+	os << escaped( sTarget ) << ':';
+
+	DocItem::SourceSet::const_iterator it;
+	for (it=setSources.begin(); it!=setSources.end(); ++it) {
+		if (isFile( *it ))
+			os << " \\\n " << escaped( *it );
+	}
+	os << '\n';
+}
+
+
+/*: routine DependFile::add
+
+	Records that the page sPage was made from the files in setSources.
+*/
+void DependFile::add( const string& sPage, const DocItem::SourceSet& setSources )
+{
+	DocItem::SourceSet& setPage = m_mapPages[sPage];
+
+	setPage.insert( setSources.begin(), setSources.end() );
+	m_setAll.insert( setSources.begin(), setSources.end() );
+}
+
+/*: routine DependFile::addAll
+
+	Records that the page sPage depends on every source, including ones
+	added after the call.
+*/
+void DependFile::addAll( const string& sPage )
+{
+	m_vAllPages.push_back( sPage );
+}
+
+/*: routine DependFile::addSources
+
+	Records sources that no single page lists, such as those of the
+	project itself, for the pages that depend on every source.
+*/
+void DependFile::addSources( const DocItem::SourceSet& setSources )
+{
+	m_setAll.insert( setSources.begin(), setSources.end() );
+}
+
+/*: routine DependFile::fileOut
+
+	Writes the depfile sFileName, with sDir and each page in it as
+	targets.  If isPhony, an empty rule for each source is added,
+	as "cc -MP" does, so that make does not fail when a source is
+	removed.
+
+	Throws: if the file cannot be written
+*/
+void DependFile::fileOut( const string& sFileName, const string& sDir, bool isPhony ) const
+{
+	std::ofstream os( sFileName.c_str(), std::ios::out | std::ios::binary );
+	if (!os.is_open())
+		throw BFileException( BFileException::SystemError );
+
+	string sPrefix = sDir;
+	while (sPrefix.size()>1 && sPrefix.back()=='/')
+		sPrefix.pop_back();
+	ruleOut( os, sPrefix, m_setAll );
+	if (!sPrefix.empty() && sPrefix.back()!='/')
+		sPrefix += '/';
+
+	for (size_t i=0; i<m_vAllPages.size(); i++)
+		ruleOut( os, sPrefix + m_vAllPages[i], m_setAll );
+
+	PageMap::const_iterator it;
+	for (it=m_mapPages.begin(); it!=m_mapPages.end(); ++it)
+		ruleOut( os, sPrefix + (*it).first, (*it).second );
+
+	if (isPhony) {
+		DocItem::SourceSet::const_iterator its;
+		for (its=m_setAll.begin(); its!=m_setAll.end(); ++its) {
+			if (isFile( *its ))
+				os << '\n' << escaped( *its ) << ":\n";
+		}
+	}
+
+	os.close();
+	if (os.fail())
+		throw BFileException( BFileException::SystemError );
+}
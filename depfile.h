@@ -0,0 +1,38 @@
+/* depfile.h -- Make style dependencies of the generated pages
+
+Copyright (C) 2017, Brian Bray
+
+*/
+
+/* Needs:
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include "docitem.h"
+*/
+
+//	Collects, while the pages are written, the input files each page was
+//	made from, and writes them as a depfile for make or ninja.
+class DependFile {
+public:
+	DependFile() {}
+
+	void add( const std::string& sPage, const DocItem::SourceSet& setSources );
+	void addAll( const std::string& sPage );
+	void addSources( const DocItem::SourceSet& setSources );
+
+	void fileOut( const std::string& sFileName, const std::string& sDir,
+	              bool isPhony ) const;
+
+private:
+	DependFile( const DependFile& );				// Not copyable
+	DependFile& operator=( const DependFile& );
+
+private:
+	typedef std::map< std::string, DocItem::SourceSet >	PageMap;
+
+	PageMap			m_mapPages;
+	std::vector<std::string>	m_vAllPages;	// Depend on every source
+	DocItem::SourceSet	m_setAll;
+};
@@ -7,70 +7,95 @@ Copyright (C) 1997-2013 Brian Bray
 #define NOTRACE
 #include <bw/trace.h>
 
+#include <cctype>
+#include <chrono>
 #include <fstream>
+#include <iostream>
+#include <sstream>
 #include <list>
 #include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include <sys/stat.h>
 
 #include "bw/bwassert.h"
 #include "bw/countable.h"
-#include "bw/string.h"
+#include "bw/exception.h"
 #include "lexstream.h"
+#include "schema.h"
 #include "docitem.h"
+#include "docsink.h"
+#include "spill.h"
+#include "fragcache.h"
+#include "depfile.h"
+#include "timeline.h"
+#include "uringsink.h"
+#include "stageddir.h"
 #include "docgen.h"
+#include "pushparse.h"
 
-using bw::String;
+using bw::BFileException;
+using std::string;
+using std::string_view;
 using std::endl;
 
 // Constant strings
-sconsti(	scEndSymbol,		"*/"	);
-sconsti(	scHashSymbol,		"#"	);
-sconsti(	scColonSymbol,		":"	);
-sconsti(	scParensSymbol,		"()"	);
-sconsti(	scDblColonSymbol,	"::"	);
-sconst(		scGlobal,		""	);	// Class name used for Global Symbols
-
-static const String sDocItemTypes[] = {
-	"Project",
-	"Class",
-	"Variable",
-	"Function",
-	"Member",
-	"Routine"
-};
-static const DocGen::DocItemType typeList[] = {
-	DocGen::tProject,
-	DocGen::tClass,
-	DocGen::tVariable,
-	DocGen::tFunction,
-	DocGen::tFunction,
-	DocGen::tFunction
-};
-static const int numDITs=6;
-
-// This helper routine searched the DocItem type list and returns
-// an Index into the typeList if found or -1 if not found
-static int findType( const String& s )
-{
-	for (int i=0; i<numDITs; i++)
-		if (s.equalsIgnoreCase(sDocItemTypes[i]))
-			return i;
-
-	return -1;
-}
+static const char	scStartSymbol[]		= "/*" ":";
+static const char	scEndSymbol[]		= "*/";
+static const char	scHashSymbol[]		= "#";
+static const char	scColonSymbol[]		= ":";
+static const char	scParensSymbol[]	= "()";
+static const char	scDblColonSymbol[]	= "::";
+static const char	scGlobal[]			= "";	// Class name used for Global Symbols
+
+/*: class DocGen
 
+	Extracts documentation from a set of inputs into one Project.
 
+	Each input is parsed by its own DocParser, so a DocGen holds no parsing
+	state between calls.  Separate DocGen objects share nothing and may be
+	used from different threads.
+*/
+
+/*: routine DocGen::DocGen			Constructor		*/
 DocGen::DocGen()
-	:	m_plex( 0 ),
-	    m_diCurrent( 0 )
+	:	m_posDiag( &std::cerr ),
+	    m_cMaxErrors( DefaultMaxErrors ),
+	    m_cErrors( 0 ),
+	    m_cInputs( 0 ),
+	    m_cbInputs( 0 ),
+	    m_pSpill( 0 ),
+	    m_pCache( 0 ),
+	    m_pDepends( 0 ),
+	    m_isPhony( false ),
+	    m_pPush( 0 )
 {
 }
 
 
 DocGen::~DocGen()
 {
+	delete m_pSpill;
+	delete m_pCache;
+	delete m_pDepends;
+	delete m_pPush;
 }
 
 
+/*: routine DocGen::fileIn
+
+	Parses the special comments of a source file into the project.  A
+	file of LargeFileBytes or more, eg: a generated one, is read in
+	chunks as streamIn() reads, so only the doc block being read is held
+	in memory, rather than the whole file.
+
+	Throws: if the file cannot be opened
+*/
 void
 DocGen::fileIn
 (
@@ -78,31 +103,416 @@ DocGen::fileIn
 )
 {
 	trace << "fileIn ( \"" << fileName << "\" );" << endl;
+	Timeline::Span span( "fileIn" );
+	span.arg( "file", fileName );
+
+	struct stat st;
+	if (stat( fileName, &st )==0 && S_ISREG(st.st_mode) && st.st_size>=LargeFileBytes) {
+		std::ifstream fInput( fileName, std::ios_base::in | std::ios_base::binary );
+		if (!fInput.is_open())
+			throw BFileException( BFileException::FileNotFound );
+		streamIn( fInput, fileName );
+		return;
+	}
 
-	m_plex = new LexStream( fileName );
+	LexStream lex( fileName );
+	parse( lex );
+}
 
-	while (!m_plex->atEof()) {
-		if (foundDocItem()) {
-			trace << "Found DocItem" << endl;
-		}
+/*: routine DocGen::streamIn
+
+	Parses the special comments read from an open istream, such as
+	std::cin.  sourceName identifies the input in diagnostics.  The
+	stream is read in chunks and parsed as they come (see beginChunks()),
+	so it need not be seekable, and only the doc block being read is
+	held in memory.
+
+	Throws: if the stream cannot be read.  The doc blocks before the
+	error are kept.
+*/
+void DocGen::streamIn( std::istream& fInput, const char* sourceName )
+{
+	char buf[65536];
+
+	beginChunks( sourceName );
+	while (fInput.read( buf, sizeof(buf) ) || fInput.gcount()>0)
+		chunkIn( buf, fInput.gcount() );
+	if (fInput.bad()) {
+		delete m_pPush;
+		m_pPush = 0;
+		throw BFileException( BFileException::SystemError );
 	}
+	endChunks();
+}
+
+/*: routine DocGen::bufferIn
+
+	Parses the special comments in a buffer in memory.  The buffer is
+	scanned in place and only needs to remain valid during the call.
+*/
+void DocGen::bufferIn( const char* pData, size_t cbData, const char* sourceName )
+{
+	LexStream lex( pData, cbData, sourceName );
+	parse( lex );
+}
 
-	delete m_plex;
-	m_plex = 0;
+/*: routine DocGen::beginChunks
 
+	Starts an input that is given a chunk at a time by chunkIn(), eg: as
+	it arrives from a pipe or an editor.  The chunks may be split
+	anywhere.  endChunks() must be called at the end of the input, before
+	another input is begun.  sourceName identifies the input in
+	diagnostics.
+*/
+void DocGen::beginChunks( const char* sourceName )
+{
+	bwassert( m_pPush==0 );
+	m_pPush = new PushParser( m_project, m_schema, sourceName );
+	m_pPush->setDiagnostics( m_posDiag, m_cMaxErrors );
 }
 
+/*: routine DocGen::chunkIn
+
+	Parses the next cbData characters of the input begun by
+	beginChunks(), as far as the doc blocks they finish.  The data is
+	copied, so it only needs to remain valid during the call.
+*/
+void DocGen::chunkIn( const char* pData, size_t cbData )
+{
+	bwassert( m_pPush );
+	m_pPush->chunkIn( pData, cbData );
+	if (m_pSpill)
+		m_project.spill( *m_pSpill );
+}
+
+/*: routine DocGen::endChunks
+
+	Parses the rest of the input begun by beginChunks(), as its end.
+*/
+void DocGen::endChunks()
+{
+	bwassert( m_pPush );
+	m_pPush->end();
+	m_cErrors += m_pPush->errorCount();
+	m_cInputs++;
+	m_cbInputs += m_pPush->size();
+	delete m_pPush;
+	m_pPush = 0;
+
+	if (m_pSpill)
+		m_project.spill( *m_pSpill );
+}
+
+/*	DocGen::parse -- internal routine runs a DocParser over one input */
+void DocGen::parse( LexStream& lex )
+{
+	Timeline::Span span( "parse" );
+	DocParser parser( lex, m_project, m_schema );
+
+	parser.setDiagnostics( m_posDiag, m_cMaxErrors );
+	parser.parse();
+	m_cErrors += parser.errorCount();
+	m_cInputs++;
+	m_cbInputs += lex.size();
+
+	span.arg( "file", lex.name() );
+	span.arg( "bytes", (long long)lex.size() );
+	span.arg( "blocks", parser.blockCount() );
+	lex.endParse();
+
+	if (m_pSpill)
+		m_project.spill( *m_pSpill );
+}
+
+/*: routine DocGen::setDiagnostics
+
+	Sets where syntax errors are reported (std::cerr by default, 0 for
+	nowhere) and how many errors are reported for one input before the
+	rest of that input is skipped.  A cMaxErrors below 1 is taken as 1,
+	so that an input is only skipped after an error.
+*/
+void DocGen::setDiagnostics( std::ostream* posDiag, int cMaxErrors )
+{
+	m_posDiag = posDiag;
+	m_cMaxErrors = cMaxErrors<1 ? 1 : cMaxErrors;
+}
+
+/*: routine DocGen::filesOut
+
+	Writes the documentation files into a directory or a caller
+	supplied DocSink.  A directory is created if it is missing.  The
+	files are written, in batches through a UringSink, into a staging
+	directory beside it, which then replaces it at once, so that the
+	directory never holds a half written set of pages (see StagedDir).
+	Files that have not changed are hard linked from the previous tree.
+	The depfile, if one was asked for, is written after the directory.
+
+	Prototype: void filesOut( const char* dirName )
+	Prototype: void filesOut( DocSink& sink )
+*/
 void
 DocGen::filesOut( const char* dirName )
 {
 	trace << "filesOut ( \"" << dirName << "\" );" << endl;
-	m_project.filesOut( dirName );
+
+	StagedDir dir( dirName );
+	m_project.setDependFile( m_pDepends );
+	{
+		UringSink sink( dir.path() );
+		if (dir.isStaged())
+			sink.setLinkFrom( dirName );
+		projectOut( sink );
+	}
+	m_project.setDependFile( 0 );
+	dir.publish();
+	if (m_pCache)
+		m_pCache->save( m_sCacheFile );
+	if (m_pDepends)
+		m_pDepends->fileOut( m_sDependFile, dirName, m_isPhony );
+}
+
+void DocGen::filesOut( DocSink& sink )
+{
+	projectOut( sink );
+	if (m_pCache)
+		m_pCache->save( m_sCacheFile );
+}
+
+/*	DocGen::projectOut -- internal routine writes the Project into sink */
+void DocGen::projectOut( DocSink& sink )
+{
+	m_project.setFragmentCache( m_pCache );
+	if (m_pSpill)
+		m_project.filesOut( sink, *m_pSpill );
+	else
+		m_project.filesOut( sink );
+}
+
+/*: routine DocGen::setFragmentCache
+
+	Keeps the rendered HTML of each member in fileName between runs, so
+	that members which have not changed since the last run are not
+	rendered again.  See FragmentCache.  The file is read now and
+	rewritten by filesOut().
+
+	Throws: from filesOut(), if the file cannot be written
+*/
+void DocGen::setFragmentCache( const char* fileName )
+{
+	delete m_pCache;
+	m_pCache = new FragmentCache;
+	m_sCacheFile = fileName;
+	m_pCache->load( m_sCacheFile );
+}
+
+/*: routine DocGen::setDependFile
+
+	Has filesOut( dirName ) write fileName, a depfile for make or ninja
+	listing the input files each page was made from (see DependFile).
+	If isPhony, each input also gets an empty rule, as with "cc -MP".
+	No depfile is written for output to a DocSink.
+*/
+void DocGen::setDependFile( const char* fileName, bool isPhony )
+{
+	delete m_pDepends;
+	m_pDepends = new DependFile;
+	m_sDependFile = fileName;
+	m_isPhony = isPhony;
+}
+
+/*: routine DocGen::setSpillDir
+
+	Keeps parsed classes in files in dirName rather than in memory, so
+	that memory use is bounded by the largest class instead of the whole
+	project.  See SpillStore.  Call before any input; the files are
+	removed when the DocGen is destroyed.
+*/
+void DocGen::setSpillDir( const char* dirName )
+{
+	delete m_pSpill;
+	m_pSpill = new SpillStore( dirName );
 }
 
-bool DocGen::foundDocItem()
+/*: routine DocGen::partialOut
+
+	Writes the Project built so far to a partial file instead of
+	generating HTML.  See Project::partialOut().
+
+	Throws: if the file cannot be written
+*/
+void DocGen::partialOut( const char* fileName )
+{
+	std::ofstream os( fileName, std::ios::out | std::ios::binary );
+	if (!os.is_open())
+		throw BFileException( BFileException::SystemError );
+
+	if (m_pSpill)
+		m_project.partialOut( os, *m_pSpill );
+	else
+		m_project.partialOut( os );
+	os.close();
+	if (os.fail())
+		throw BFileException( BFileException::SystemError );
+}
+
+/*: routine DocGen::mergeIn
+
+	Merges a partial file written by partialOut() into the project.
+	Merging the partials of a sharded run in shard order gives the same
+	output as one run over all of the files.
+
+	Throws: if the file cannot be opened or is not a partial
+*/
+void DocGen::mergeIn( const char* fileName )
+{
+	std::ifstream is( fileName, std::ios::in | std::ios::binary );
+	if (!is.is_open())
+		throw BFileException( BFileException::FileNotFound );
+
+	Project proj;
+	proj.partialIn( is );
+	m_project.merge( proj );
+
+	if (m_pSpill)
+		m_project.spill( *m_pSpill );
+}
+
+/*: routine DocGen::schemaIn
+
+	Adds the item type keywords in a schema config file (see
+	DocSchema::readConfig()).  Bad lines are reported like syntax errors
+	and counted in errorCount().
+
+	Throws: if the file cannot be opened
+*/
+void DocGen::schemaIn( const char* fileName )
+{
+	std::ifstream is( fileName );
+	if (!is.is_open())
+		throw BFileException( BFileException::FileNotFound );
+
+	m_cErrors += m_schema.readConfig( is, fileName, m_posDiag );
+}
+
+/*: routine DocGen::setSourceLinkTemplate
+
+	Sets the link used for the source location of each item, with
+	"{file}" and "{line}" replaced.  An empty template shows the location
+	without a link.  The link is made as the pages are written, so it
+	applies to every item, including those merged from partials.
+*/
+void DocGen::setSourceLinkTemplate( const char* sTemplate )
+{
+	m_project.setSourceLinkTemplate( sTemplate );
+}
+
+/*: routine DocGen::setFormats
+
+	Sets the formats filesOut() writes each page in, any of
+	Project::fmtHtml (the default), fmtJson and fmtText.  The project is
+	walked once for all of them (see OutputBackend).  With
+	Project::fmtMinified as well, the HTML is minified (see
+	HtmlBackend).
+*/
+void DocGen::setFormats( int fFormats )
+{
+	m_project.setFormats( fFormats );
+}
+
+/*: routine DocGen::project		Returns the Project built so far	*/
+Project& DocGen::project()
+{
+	return m_project;
+}
+
+
+/*: class DocParser
+
+	Recursive descent parser for the special comments of one input.
+
+	Holds the LexStream and the current DocItem for the duration of a
+	single parse.  See the grammar document for the rules.
+
+	The tokens of a block header are read into an array of BlockTokens,
+	which only say where each token is in the input, and parsed with an
+	index into it.  Looking ahead is a look at the next entry, so no
+	token is copied or buffered.  Once the header is parsed the stream
+	is moved past the last token looked at, and the attribute text
+	starts from the one after the last token used, if it was looked at.
+*/
+
+/*: routine DocParser::DocParser	Constructor		*/
+DocParser::DocParser( LexStream& lex, Project& proj, const DocSchema& schema )
+	:	m_lex( lex ),
+	    m_project( proj ),
+	    m_schema( schema ),
+	    m_diCurrent( 0 ),
+	    m_pclsCurrent( 0 ),
+	    m_nStartLine( 0 ),
+	    m_iToken( 0 ),
+	    m_cTokensSeen( 0 ),
+	    m_btEnd(),
+	    m_posDiag( 0 ),
+	    m_cMaxErrors( DocGen::DefaultMaxErrors ),
+	    m_cErrors( 0 ),
+	    m_cBlocks( 0 )
+{
+	m_vTokens.reserve( 16 );		// More than most headers need
+}
+
+/*: routine DocParser::setDiagnostics
+
+	Sets the stream for syntax errors (0 for none) and the number of
+	errors after which the rest of the input is skipped.
+*/
+void DocParser::setDiagnostics( std::ostream* posDiag, int cMaxErrors )
+{
+	m_posDiag = posDiag;
+	m_cMaxErrors = cMaxErrors;
+}
+
+/*: routine DocParser::parse
+
+	Adds every DocItem found in the input to the project.
+
+	Every pass through the loop consumes input, so a parse is linear
+	in the size of the input even when it is full of errors.
+*/
+void DocParser::parse()
+{
+	while (parseNext())
+		;
+}
+
+/*: routine DocParser::parseNext
+
+	Finds the next doc block and adds its DocItem to the project.
+	Returns false, having read nothing, at the end of the input or once
+	there have been too many errors, which is then reported.
+
+	Each call reads a block and the prototype after it, or the rest of
+	the input if there is no block.  How far it reads depends only on
+	the input, not on what is already in the project (see PushParser).
+*/
+bool DocParser::parseNext()
+{
+	if (m_lex.atEof())
+		return false;
+	if (m_cErrors>=m_cMaxErrors) {
+		if (m_posDiag)
+			*m_posDiag << m_lex.name() << ": too many errors, skipping rest of file" << endl;
+		return false;
+	}
+	if (foundDocItem()) {
+		trace << "Found DocItem" << endl;
+		m_cBlocks++;
+	}
+	return true;
+}
+
+bool DocParser::foundDocItem()
 {
 	Token tok;
-	bwassert( m_plex );
 	bwassert( m_diCurrent==0 );		// No current DocItem
 
 	if (foundStarter()) {
@@ -112,123 +522,140 @@ bool DocGen::foundDocItem()
 			trace << "Found AttributeList" << endl;
 		}
 
-		// Now expecting EndSymbol
-		m_plex->getToken(tok);
-		if (tok.type()!=Token::Symbol || tok.value()!=scEndSymbol) {
+		// Now expecting EndSymbol, which ended the last attribute
+		Token::TokenType ttEnd = m_btEnd.m_ttType;
+		if (isSymbol( m_btEnd, scStartSymbol )) {
+			// The EndSymbol is missing.  The next block starts here, and
+			// is read by the next call.
+			reportError( "\"/*" ":\" inside a doc block" );
+		} else if (ttEnd!=Token::Symbol) {
 			// Didn't get it -- warn and skip till found
-			reportSyntaxError( "EndSymbol", tok );
+			reportSyntaxError( "EndSymbol", m_btEnd );
 
-			while (tok.type()!=Token::EndOfFile ||
-			        tok.type()!=Token::Symbol || tok.value()!=scEndSymbol) {
-				m_plex->getToken(tok);
+			if (ttEnd!=Token::EndOfFile) {
+				m_lex.skipToEndSymbol( tok );
+				ttEnd = tok.type();
 			}
 		}
 
 		// Right now, I can't check to see if I need to look for
 		// a prototype, so I'll always check for functions and variables.
-		if (tok.type()!=Token::EndOfFile && m_diCurrent->needPrototype()) {
-			m_plex->getPrototype( tok );
-			if (tok.type()==Token::Text)
-				m_diCurrent->setPrototype( tok.value() );
-			else
-				m_diCurrent->setDefaultPrototype();
+		// The prototype is scanned even when it won't be used, so that
+		// where parsing resumes doesn't depend on blocks in other files
+		// (and a sharded run parses the same as a single one).
+		if (ttEnd!=Token::EndOfFile && m_diCurrent->hasPrototype()) {
+			m_lex.getPrototype( tok );
+			if (m_diCurrent->needPrototype()) {
+				if (tok.type()==Token::Text)
+					m_diCurrent->setPrototype( tok.take() );
+				else
+					m_diCurrent->setDefaultPrototype();
+			}
 		}
 
+		m_diCurrent->setSourceLocation( m_lex.name(), m_nStartLine );
+		if (m_pclsCurrent)
+			m_pclsCurrent->addSource( m_lex.name() );
+		else
+			m_project.addSource( m_lex.name() );
 		m_diCurrent = 0;			// No longer a current DocItem
 		return true;
 	}
 	return false;
 }
 
-/*	DocGen::foundStarter()
+/*	DocParser::foundStarter()
 
 	Parse Starter Symbol (includes type and name)
 
-	Returns: true if found and m_diCurrent will be set.
+	Returns: true if found and m_diCurrent will be set.  Either way the
+	stream is left after the last header token looked at.
 */
-bool DocGen::foundStarter()
+bool DocParser::foundStarter()
 {
 	Token tok;
 
-	m_plex->getStartSymbol( tok );
-	if (tok.type()==Token::Symbol) {
-		// Got start of new comment block
-		//trace << "Found StartSymbol" << endl;
-
-		if (foundDocItemTypeAndName()) {
-			bwassert( m_diCurrent );
-			// OK, I can work with this
-
-			bool hasLinkName = false;
-
-			// Check for LinkName
-			m_plex->peekToken( tok );
-			if (tok.type()==Token::Symbol && tok.value()==scHashSymbol) {
-				// Yes, there is a linkname
-				m_plex->getToken( tok );		// Eat the hash mark
-				bwassert( tok.type()==Token::Symbol );
-				bwassert( tok.value()==scHashSymbol );
-				m_plex->getToken( tok );		// My link name
-				if (tok.type()!=Token::Identifier) {
-					reportSyntaxError( "LinkName", tok );
-				} else {
-					hasLinkName = true;
-					m_diCurrent->setLinkName( tok.value() );
-				}
-			}
-			if (!hasLinkName) {
-				m_diCurrent->setDefaultLinkName();
+	m_lex.getStartSymbol( tok );
+	if (tok.type()!=Token::Symbol)
+		return false;
+
+	// Got start of new comment block
+	int nColumn;
+	m_lex.getStartLocation( m_nStartLine, nColumn );
+	//trace << "Found StartSymbol" << endl;
+
+	m_vTokens.clear();
+	m_iToken = 0;
+	m_cTokensSeen = 0;
+
+	bool isFound = foundDocItemTypeAndName();
+	if (isFound) {
+		bwassert( m_diCurrent );
+		// OK, I can work with this
+
+		bool hasLinkName = false;
+
+		// Check for LinkName
+		if (isSymbol( peekToken(), scHashSymbol )) {
+			// Yes, there is a linkname
+			getToken();					// Eat the hash mark
+			BlockToken bt = getToken();	// My link name
+			if (bt.m_ttType!=Token::Identifier) {
+				reportSyntaxError( "LinkName", bt );
+			} else {
+				hasLinkName = true;
+				m_diCurrent->setLinkName( string( m_lex.value( bt ) ) );
 			}
-			return true;
+		}
+		if (!hasLinkName) {
+			m_diCurrent->setDefaultLinkName();
 		}
 	}
-	return false;
+
+	bwassert( m_cTokensSeen>0 );
+	m_lex.skipPast( m_vTokens[m_cTokensSeen-1] );
+	return isFound;
 }
 
-/*	DocGen::foundDocItemTypeAndName()
+/*	DocParser::foundDocItemTypeAndName()
 
 	Parses type (eg: class, routine) and full name of item.
 
 	Returns: true if found and sets m_diCurrent
 */
-bool DocGen::foundDocItemTypeAndName()
+bool DocParser::foundDocItemTypeAndName()
 {
-	Token tok;
-	DocItemType typeCurDocItem;
+	DocSchema::ItemType typeCurDocItem;
 
 	// This first section determines the DocItem type and leaves the
-	// LexStream positioned at the name
+	// token index at the name
 
-	m_plex->peekToken( tok );
-	typeCurDocItem = tFunction;		// This is the default
+	BlockToken bt = peekToken();
+	typeCurDocItem = DocSchema::tFunction;		// This is the default
 
 	// See if there's a type keyword
-	if (tok.type()==Token::Identifier) {
-		int indx = findType( tok.value() );
-		if (indx>=0) {
-			typeCurDocItem = typeList[indx];
-			m_plex->getToken( tok );	// Eat the keyword
-
-			m_plex->peekToken( tok );
-			if (tok.type()==Token::Symbol && tok.value()==scColonSymbol) {
-				m_plex->getToken( tok );	// Eat the ":"
-			}
+	if (bt.m_ttType==Token::Identifier) {
+		if (m_schema.findItemType( m_lex.value( bt ), typeCurDocItem )) {
+			getToken();		// Eat the keyword
+
+			if (isSymbol( peekToken(), scColonSymbol ))
+				getToken();	// Eat the ":"
 		}
 	}
 
 	// This second section picks up the name.
 	//
 	switch (typeCurDocItem) {
-	case tProject:
+	case DocSchema::tProject:
 		return foundProjectName();
 
-	case tClass:
+	case DocSchema::tClass:
 		return foundClassName();
 
-	case tVariable:
+	case DocSchema::tVariable:
 		return foundVariableName();
 
-	case tFunction:
+	case DocSchema::tFunction:
 		return foundFunctionName();
 	}
 
@@ -236,97 +663,111 @@ bool DocGen::foundDocItemTypeAndName()
 	return false;
 }
 
-bool DocGen::foundProjectName()
+bool DocParser::foundProjectName()
 {
-	Token tok;
+	BlockToken bt = getToken();
 
-	m_plex->getToken( tok );
-	if (tok.type()!=Token::Identifier) {
-		reportSyntaxError( "ProjectName", tok );
+	if (bt.m_ttType!=Token::Identifier) {
+		reportSyntaxError( "ProjectName", bt );
 		return false;
 	}
 	m_diCurrent = &m_project;
-	m_project.setName( tok.value() );
-	//trace << "Project name set to \"" << tok.value() << "\"" << endl;
+	m_pclsCurrent = 0;
+	m_project.setName( string( m_lex.value( bt ) ) );
+	//trace << "Project name set to \"" << m_lex.value( bt ) << "\"" << endl;
 	return true;
 }
 
-bool DocGen::foundClassName()
+bool DocParser::foundClassName()
 {
-	Token tok;
-
-	m_plex->getToken( tok );
-	if (tok.type()!=Token::Identifier) {
-		reportSyntaxError( "ClassName", tok );
-		return false;
-	}
-	m_diCurrent = m_project.getClass( tok.value() );
-	//trace << "Class name set to \"" << tok.value() << "\"" << endl;
+	string sClassName;
+
+	// A class name may be qualified, eg: a::b::Class
+	do {
+		BlockToken bt = getToken();
+		if (bt.m_ttType!=Token::Identifier) {
+			reportSyntaxError( "ClassName", bt );
+			return false;
+		}
+		if (!sClassName.empty())
+			sClassName += scDblColonSymbol;
+		sClassName += m_lex.value( bt );
+	} while (getScopeSymbol());
+
+	m_pclsCurrent = m_project.getClass( sClassName );
+	m_diCurrent = m_pclsCurrent;
+	//trace << "Class name set to \"" << sClassName << "\"" << endl;
 	return true;
 }
 
-bool DocGen::foundFunctionName()
+bool DocParser::foundFunctionName()
 {
-	Token tok;
-	String sClassName;
-	String sFunctionName;
+	string sClassName;
+	string sFunctionName;
 
 	if (foundMemberName( sClassName, sFunctionName )) {
 		// Eat optional trailing ()
-		m_plex->peekToken( tok );
-		if (tok.type()==Token::Symbol && tok.value()==scParensSymbol)
-			m_plex->getToken( tok );
+		if (isSymbol( peekToken(), scParensSymbol ))
+			getToken();
 
-		m_diCurrent = m_project.getFunction( sClassName, sFunctionName );
+		m_pclsCurrent = m_project.getClass( sClassName );
+		m_diCurrent = m_pclsCurrent->getFunction( sFunctionName );
 		//trace << "Member name reset to " << m_sCurClassName << "::" << m_sCurMemberName << endl;
 		return true;
 	}
 	return false;
 }
 
-bool DocGen::foundVariableName()
+bool DocParser::foundVariableName()
 {
-	String sClassName;
-	String sVariableName;
+	string sClassName;
+	string sVariableName;
 
 	if (foundMemberName( sClassName, sVariableName )) {
-		m_diCurrent = m_project.getVariable( sClassName, sVariableName );
+		m_pclsCurrent = m_project.getClass( sClassName );
+		m_diCurrent = m_pclsCurrent->getVariable( sVariableName );
 		return true;
 	}
 	return false;
 }
 
 
-bool DocGen::foundMemberName( String& sClassName, String& sMemberName  )
+bool DocParser::foundMemberName( string& sClassName, string& sMemberName  )
 {
-	Token tok;
-	Token	tok2;
-
-	m_plex->getToken( tok );
-	m_plex->peekToken( tok2 );
-
-	// This first part determines the class name
-	if (tok.value()==scDblColonSymbol) {
-		sClassName = scGlobal;
-		m_plex->getToken( tok );				// Contains MemberName
-	} else if(tok2.value()==scDblColonSymbol) {
-		sClassName = tok.value();
-		m_plex->getToken( tok );				// Eat "::"
-		m_plex->getToken( tok );				// Contains MemberName
+	BlockToken bt = getToken();
+
+	// This first part determines the class name, qualified to any depth,
+	// eg: "::f" is global, "a::b::Class::f" is in class "a::b::Class"
+	bool isQualified = false;
+	sClassName = scGlobal;
+	if (isSymbol( bt, scDblColonSymbol )) {
+		isQualified = true;
+		bt = getToken();				// Contains the first name
+	}
+	while (bt.m_ttType==Token::Identifier && getScopeSymbol()) {
+		if (!sClassName.empty())
+			sClassName += scDblColonSymbol;
+		sClassName += m_lex.value( bt );
+		isQualified = true;
+		bt = getToken();
+	}
+	if (!isQualified) {
+		// The text after a plain name has always started from a peeked
+		// token, keep it that way
+		peekToken();
 	}
-	// If not, the membername is already in tok
 
 	// This second part processes the member name
-	if (tok.type()!=Token::Identifier) {
-		reportSyntaxError( "MemberName", tok );
+	if (bt.m_ttType!=Token::Identifier) {
+		reportSyntaxError( "MemberName", bt );
 		return false;
 	}
-	sMemberName = tok.value();
+	sMemberName = m_lex.value( bt );
 	//trace << "Member name set to " << m_sCurClassName << "::" << m_sCurMemberName << endl;
 	return true;
 }
 
-bool DocGen::foundAttributeList()
+bool DocParser::foundAttributeList()
 {
 	if (foundImpliedDescriptionAttribute()) {
 		//trace << "Found ImpliedDescriptionAttribute" << endl;
@@ -335,15 +776,17 @@ bool DocGen::foundAttributeList()
 	return foundKeywordAttributeList();
 }
 
-bool DocGen::foundImpliedDescriptionAttribute()
+bool DocParser::foundImpliedDescriptionAttribute()
 {
-	Token tok;
-
-	m_plex->getAttributeText( tok );
+	SourceText text;
 
-	if (tok.type()==Token::Text) {
-		m_diCurrent->setImpliedAttribute( tok.value() );
-		//trace << "Found Description: \"" << tok.value() << "\"" << endl;
+	// The text starts with the token after the header, if it was seen
+	const BlockToken* pbtFirst = 0;
+	if (m_cTokensSeen>m_iToken)
+		pbtFirst = &m_vTokens[m_iToken];
+	if (m_lex.getAttributeText( text, m_btEnd, pbtFirst )) {
+		m_diCurrent->setImpliedAttribute( std::move(text) );
+		//trace << "Found Description" << endl;
 
 		return true;
 	}
@@ -352,7 +795,7 @@ bool DocGen::foundImpliedDescriptionAttribute()
 	return false;
 }
 
-bool DocGen::foundKeywordAttributeList()
+bool DocParser::foundKeywordAttributeList()
 {
 	bool anyFound = false;
 
@@ -362,31 +805,109 @@ bool DocGen::foundKeywordAttributeList()
 	return anyFound;
 }
 
-bool DocGen::foundKeywordAttribute()
+bool DocParser::foundKeywordAttribute()
 {
-	Token tok;
+	SourceText text;
 
-	m_plex->peekToken( tok );
-	if (tok.type()==Token::Identifier) {
-		m_plex->getToken( tok );
-		String sKeywordName = tok.value();
-		// Note: This is a hack, but the following ":" has already been read.
+	if (m_btEnd.m_ttType==Token::Identifier) {
+		string sKeywordName( m_lex.value( m_btEnd ) );
+		// Note: the following ":" has already been read.
 
-		m_plex->getAttributeText( tok );
+		m_lex.getAttributeText( text, m_btEnd );
 
-		m_diCurrent->addAttribute( sKeywordName, tok.value() );
-		//trace << "Found Attribute " << m_sCurKeywordName << ": " << endl
-		//		<< "\"" << tok.value() << "\"" << endl;
+		m_diCurrent->addAttribute( std::move(sKeywordName), std::move(text) );
+		//trace << "Found Attribute " << m_sCurKeywordName << endl;
 		return true;
 	}
 	return false;
 }
 
-void DocGen::reportSyntaxError( const String& sExpecting, const Token& tok ) const
+/*	DocParser::peekToken -- internal routine returns the next token of
+			the block header without using it, reading it if need be.
+*/
+BlockToken DocParser::peekToken()
+{
+	if (m_iToken==m_vTokens.size())
+		m_lex.appendToken( m_vTokens );
+	if (m_cTokensSeen<=m_iToken)
+		m_cTokensSeen = m_iToken+1;
+	return m_vTokens[m_iToken];
+}
+
+/*	DocParser::getToken -- internal routine returns the next token of
+			the block header and moves past it.
+*/
+BlockToken DocParser::getToken()
+{
+	BlockToken bt = peekToken();
+
+	m_iToken++;
+	return bt;
+}
+
+/*	DocParser::getScopeSymbol -- internal routine moves past the next
+			token if it is "::" on the same line, and returns true.
+			Otherwise the token is not looked at, so a qualified name can
+			be read one level at a time without seeing the text after it.
+*/
+bool DocParser::getScopeSymbol()
+{
+	bwassert( m_cTokensSeen==m_iToken );
+	if (m_iToken==m_vTokens.size())
+		m_lex.appendToken( m_vTokens );
+
+	const BlockToken& bt = m_vTokens[m_iToken];
+	if (!(bt.m_fFlags & BlockToken::fSameLine) || !isSymbol( bt, scDblColonSymbol ))
+		return false;
+	m_cTokensSeen = ++m_iToken;
+	return true;
+}
+
+/*	DocParser::isSymbol -- internal routine returns true if bt is the
+			symbol sSymbol.
+*/
+bool DocParser::isSymbol( const BlockToken& bt, const char* sSymbol ) const
+{
+	return bt.m_ttType==Token::Symbol && m_lex.value( bt )==sSymbol;
+}
+
+/*	DocParser::reportSyntaxError()
+
+	Reports a syntax error as
+		file:line: error: expected <what>, got "<token>"
+	and counts it against the error limit for this input.  The line is
+	where the doc block containing the error starts.
+*/
+void DocParser::reportSyntaxError( const char* sExpecting, const BlockToken& bt )
 {
 	trace << endl;
 	trace << "Syntax error: Expected " << sExpecting;
-	trace << ", but got \"" << tok.value() << "\"" << endl << endl;
+	trace << ", but got \"" << m_lex.value( bt ) << "\"" << endl << endl;
+
+	string sMessage = "expected ";
+	sMessage += sExpecting;
+	if (bt.m_ttType==Token::EndOfFile) {
+		sMessage += ", got end of file";
+	} else {
+		sMessage += ", got \"";
+		sMessage += m_lex.value( bt );
+		sMessage += "\"";
+	}
+	reportError( sMessage );
+}
+
+/*	DocParser::reportError()
+
+	Reports an error as
+		file:line: error: <message>
+	and counts it against the error limit for this input.  The line is
+	where the doc block containing the error starts.
+*/
+void DocParser::reportError( const string& sMessage )
+{
+	++m_cErrors;
+	if (m_posDiag==0 || m_cErrors>m_cMaxErrors)
+		return;
 
-	// Syntax errors are ignored in the release version.
+	*m_posDiag << m_lex.name() << ":" << m_nStartLine << ": error: " << sMessage << endl;
 }
@@ -4,20 +4,36 @@ Copyright (C) 1997-2013, Brian Bray
 
 */
 
-//#include <bw/string.h>
+//#include <istream>
+//#include <ostream>
+//#include <string>
+//#include <string_view>
+//#include <vector>
 //#include "lexstream.h"
+//#include "schema.h"
 //#include "docitem.h"
+//#include "docsink.h"
+//#include "fragcache.h"
+//#include "depfile.h"
+//#include "timeline.h"
+//#include "uringsink.h"
+//#include "stageddir.h"
 
-class DocGen {
+// Parses the special comments of one input into a Project.
+class DocParser {
 public:
-	DocGen();
-	~DocGen();
+	DocParser( LexStream& lex, Project& proj, const DocSchema& schema );
 
 public:
-	void fileIn( const char* fileName );
-
-	void filesOut( const char* dirName );
-	enum DocItemType {tProject, tClass, tFunction, tVariable};
+	void parse();
+	bool parseNext();
+	void setDiagnostics( std::ostream* posDiag, int cMaxErrors );
+	int errorCount() const {
+		return m_cErrors;
+	}
+	int blockCount() const {
+		return m_cBlocks;
+	}
 
 protected:	// Parsing routines
 	bool foundDocItem();
@@ -27,17 +43,109 @@ protected:	// Parsing routines
 	bool foundClassName();
 	bool foundFunctionName();
 	bool foundVariableName();
-	bool foundMemberName( bw::String&, bw::String& );
+	bool foundMemberName( std::string&, std::string& );
 	bool foundAttributeList();
 	bool foundImpliedDescriptionAttribute();
 	bool foundKeywordAttributeList();
 	bool foundKeywordAttribute();
 
-	void reportSyntaxError( const bw::String& sExpecting, const Token& tok ) const;
+	BlockToken peekToken();
+	BlockToken getToken();
+	bool getScopeSymbol();
+	bool isSymbol( const BlockToken& bt, const char* sSymbol ) const;
+	void reportSyntaxError( const char* sExpecting, const BlockToken& bt );
+	void reportError( const std::string& sMessage );
 
 private:	// Internal Variables
-	LexStream*	m_plex;
+	LexStream&	m_lex;
+	Project&	m_project;
+	const DocSchema&	m_schema;
+	DocItem*	m_diCurrent;
+	DocClass*	m_pclsCurrent;	// Owner of m_diCurrent, 0 for the project
+	int			m_nStartLine;	// Of the current doc block
+
+	std::vector<BlockToken>	m_vTokens;	// Of the current block, as far as read
+	size_t		m_iToken;		// Next one to parse
+	size_t		m_cTokensSeen;	// Looked at, m_iToken or one more
+	BlockToken	m_btEnd;		// What ended the last attribute text
+
+	std::ostream*	m_posDiag;		// Where syntax errors go, may be 0
+	int			m_cMaxErrors;	// Rest of input skipped after this many
+	int			m_cErrors;
+	int			m_cBlocks;		// Doc blocks found
+};
+
+class PushParser;
+
+class DocGen {
+public:
+	DocGen();
+	~DocGen();
+
+public:
+	void fileIn( const char* fileName );
+	void streamIn( std::istream& fInput, const char* sourceName="<stream>" );
+	void bufferIn( const char* pData, size_t cbData, const char* sourceName="<buffer>" );
+	void beginChunks( const char* sourceName="<stream>" );
+	void chunkIn( const char* pData, size_t cbData );
+	void endChunks();
+	void setDiagnostics( std::ostream* posDiag, int cMaxErrors=DefaultMaxErrors );
+	int errorCount() const {
+		return m_cErrors;
+	}
+	int inputCount() const {
+		return m_cInputs;
+	}
+	long long inputBytes() const {
+		return m_cbInputs;
+	}
+
+	void filesOut( const char* dirName );
+	void filesOut( DocSink& sink );
+	long long outputBytes() const {
+		return m_project.bytesWritten();
+	}
+	long long markupSaved() const {
+		return m_project.markupSaved();
+	}
+
+	void partialOut( const char* fileName );
+	void mergeIn( const char* fileName );
+
+	void setSpillDir( const char* dirName );
+	void setFragmentCache( const char* fileName );
+	void setDependFile( const char* fileName, bool isPhony=false );
+	void schemaIn( const char* fileName );
 
+	void setSourceLinkTemplate( const char* sTemplate );
+	void setFormats( int fFormats );
+	Project& project();
+	typedef DocSchema::ItemType DocItemType;
+	enum {DefaultMaxErrors=20};
+	enum {LargeFileBytes=16<<20};		// fileIn() reads these a chunk at a time
+
+private:
+	void parse( LexStream& lex );
+	void projectOut( DocSink& sink );
+
+	DocGen( const DocGen& );					// Not copyable
+	DocGen& operator=( const DocGen& );
+
+private:	// Internal Variables
 	Project		m_project;
-	DocItem*	m_diCurrent;
+	DocSchema	m_schema;
+
+	std::ostream*	m_posDiag;
+	int			m_cMaxErrors;
+	int			m_cErrors;		// Total over all inputs
+	int			m_cInputs;		// Parsed
+	long long	m_cbInputs;		// Total size of the parsed inputs
+
+	SpillStore*	m_pSpill;		// 0 unless classes are kept on disk
+	FragmentCache*	m_pCache;	// 0 unless rendered members are kept
+	std::string	m_sCacheFile;
+	DependFile*	m_pDepends;		// 0 unless a depfile is written
+	std::string	m_sDependFile;
+	bool		m_isPhony;		// Depfile has a rule for each source
+	PushParser*	m_pPush;		// The input being given in chunks, or 0
 };
@@ -4,22 +4,41 @@ Copyright (C) 1997-2013, Brian Bray
 
 */
 
+#include <atomic>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
 #include <fstream>
 #include <list>
 #include <map>
+#include <memory>
+#include <ostream>
+#include <set>
+#include <string>
+#include <string_view>
+#include <vector>
 
 #include "bw/bwassert.h"
-#include "bw/string.h"
 #include "bw/countable.h"
+#include "allocstats.h"
 #include "lexstream.h"
+#include "schema.h"
 #include "docitem.h"
 #include "docgen.h"
 
-using bw::String;
+using std::string;
+using std::string_view;
+
+static AllocStats::Site s_siteAttribute( "DocItem::addAttribute", AllocStats::oAttribute );
+static AllocStats::Site s_siteSource( "DocItem::setSourceLocation", AllocStats::oAttribute );
+static AllocStats::Site s_siteClass( "Project::getClass", AllocStats::oDocItem );
+static AllocStats::Site s_siteMember( "DocClass::getMember", AllocStats::oDocItem );
 
 /*: DocItem::DocItem()				Constructor		*/
 DocItem::DocItem()
-	:	m_cRef( 1 )
+	:	m_cPrototypes( 0 ),
+	    m_cRef( 1 ),
+	    m_nSourceLine( 0 )
 {
 
 }
@@ -51,36 +70,64 @@ unsigned long DocItem::Release()
 void DocItem::clearAttributes()
 {
 	m_attribs.clear();
+	m_cPrototypes = 0;
 }
 
 /*: DocItem::addAttribute
 
 	Adds another Keyword attribute for the DocItem.
 
-	Prototype: void addAttribute( const String& sKeyword, const String& sValue );
-	Prototype: void addAttribute( const Attribute& attr );
+	"Prototype" attributes are counted as they are added, so that
+	needPrototype() does not search the list once per doc block.
+
+	The strings are moved into the DocItem, so callers can hand over
+	token text without a copy.  Text still in the input (see SourceText)
+	stays there.
+
+	Prototype: void addAttribute( string sKeyword, string sValue );
+	Prototype: void addAttribute( string sKeyword, SourceText text );
+	Prototype: void addAttribute( Attribute attr );
 */
-void DocItem::addAttribute( const String& sKeyword, const String& sValue )
+void DocItem::addAttribute( string sKeyword, string sValue )
 {
-	m_attribs.push_back( Attribute(sKeyword, sValue) );
+	AllocStats::Scope allocs( s_siteAttribute );
+	addAttribute( Attribute(std::move(sKeyword), std::move(sValue)) );
 }
 
-void DocItem::addAttribute( const Attribute& attr )
+void DocItem::addAttribute( string sKeyword, SourceText text )
 {
-	m_attribs.push_back( attr );
+	AllocStats::Scope allocs( s_siteAttribute );
+	addAttribute( Attribute(std::move(sKeyword), std::move(text)) );
+}
+
+void DocItem::addAttribute( Attribute attr )
+{
+	AllocStats::Scope allocs( s_siteAttribute );
+	if (attr.kind()==DocSchema::aPrototype)
+		++m_cPrototypes;
+	m_attribs.push_back( std::move(attr) );
 }
 
 /*: DocItem::find
-	Finds attributes stored under keyword.
+	Finds attributes stored under keyword, or with a special meaning
+	(see DocSchema).
 
 	The Keyword is case insensitive.  The attributes are returned in
 	the order of original insertion.
+
+	Prototype: AttribIterator find( string_view sKeyword ) const
+	Prototype: AttribIterator find( DocSchema::AttributeKind ak ) const
 */
-AttribIterator DocItem::find( const String& sKeyword ) const
+AttribIterator DocItem::find( string_view sKeyword ) const
 {
 	return AttribIterator( m_attribs.begin(), m_attribs.end(), sKeyword );
 }
 
+AttribIterator DocItem::find( DocSchema::AttributeKind ak ) const
+{
+	return AttribIterator( m_attribs.begin(), m_attribs.end(), ak );
+}
+
 /*: DocItem::findAll()
 
 	Returns all attributes in the original insert order.
@@ -94,9 +141,9 @@ AttribIterator DocItem::findAll() const
 
 	Sets the "*Prototype" attribute
 */
-void DocItem::setPrototype( const String& sValue )
+void DocItem::setPrototype( string sValue )
 {
-	addAttribute( "*Prototype", sValue );
+	addAttribute( DocSchema::attributeKeyword(DocSchema::aImpliedPrototype), std::move(sValue) );
 }
 
 /*: DocItem::setDefaultPrototype()
@@ -105,7 +152,7 @@ void DocItem::setPrototype( const String& sValue )
 */
 void DocItem::setDefaultPrototype()
 {
-	addAttribute( "*Prototype", "" );
+	addAttribute( DocSchema::attributeKeyword(DocSchema::aImpliedPrototype), "" );
 }
 
 
@@ -113,9 +160,9 @@ void DocItem::setDefaultPrototype()
 
 	Sets the LinkName for this DocItem
 */
-void DocItem::setLinkName( const String& sLinkName )
+void DocItem::setLinkName( string sLinkName )
 {
-	m_sLinkName = sLinkName;
+	m_sLinkName = std::move( sLinkName );
 }
 
 /*: DocItem::setDefaultLinkName()
@@ -131,9 +178,9 @@ void DocItem::setDefaultLinkName()
 
 	Sets the "*Description" attribute
 */
-void DocItem::setImpliedAttribute( const String& sValue )
+void DocItem::setImpliedAttribute( SourceText text )
 {
-	addAttribute( "*Description", sValue );
+	addAttribute( DocSchema::attributeKeyword(DocSchema::aImpliedDescription), std::move(text) );
 }
 
 /*: DocItem::setDefaultImpliedAttribute()
@@ -142,7 +189,59 @@ void DocItem::setImpliedAttribute( const String& sValue )
 */
 void DocItem::setDefaultImpliedAttribute()
 {
-	addAttribute( "*Description", "" );
+	addAttribute( DocSchema::attributeKeyword(DocSchema::aImpliedDescription), "" );
+}
+
+/*: DocItem::setSourceLocation()
+
+	Records the file and line of the doc block that defines this item, and
+	sets the "*Source" attribute to show it, as plain text ("file:line"),
+	which each output format escapes as it needs.  Only the first
+	location is kept when several blocks document the same item.
+*/
+void DocItem::setSourceLocation( string_view sFile, int nLine )
+{
+	AllocStats::Scope allocs( s_siteSource );
+	if (m_nSourceLine!=0)
+		return;
+
+	m_sSourceFile = sFile;
+	m_nSourceLine = nLine;
+
+	char szLine[16];
+	snprintf( szLine, sizeof(szLine), "%d", nLine );
+	addAttribute( DocSchema::attributeKeyword(DocSchema::aSource), m_sSourceFile + ":" + szLine );
+}
+
+/*: DocItem::getSourceLink()
+
+	Returns the link for the source location, sLinkTemplate with "{file}"
+	and "{line}" replaced, eg: "http://src/{file}#L{line}".  Returns ""
+	if the template is empty or the location is not known.  The link is
+	not escaped.
+*/
+string DocItem::getSourceLink( string_view sLinkTemplate ) const
+{
+	string sLink;
+
+	if (sLinkTemplate.empty() || m_nSourceLine==0)
+		return sLink;
+
+	char szLine[16];
+	snprintf( szLine, sizeof(szLine), "%d", m_nSourceLine );
+	size_t i = 0;
+	while (i<sLinkTemplate.size()) {
+		string_view sRest = sLinkTemplate.substr( i );
+		if (sRest.compare( 0, 6, "{file}" )==0) {
+			sLink += m_sSourceFile;
+			i += 6;
+		} else if (sRest.compare( 0, 6, "{line}" )==0) {
+			sLink += szLine;
+			i += 6;
+		} else
+			sLink += sLinkTemplate[i++];
+	}
+	return sLink;
 }
 
 /*: DocItem::getTitle()
@@ -150,16 +249,18 @@ void DocItem::setDefaultImpliedAttribute()
 	Returns the descriptive title of the item.
 
 	This is the contents of the "Title" attribute if any.  If not defined,
-	this is the first sentence of the first attribute defined.
+	this is the first sentence of the first attribute defined.  The
+	result refers into the attribute or sBuffer (see Attribute::value()),
+	so it is valid while both are unchanged.
 */
-String DocItem::getTitle() const
+string_view DocItem::getTitle( string& sBuffer ) const
 {
 	AttribIterator ai;
 
 	// First look for predefined title
-	ai = find( "Title" );
+	ai = find( DocSchema::aTitle );
 	if (!ai.atEof())
-		return ai->value();
+		return ai->value( sBuffer );
 
 	// Not there, get first attribute
 	ai = findAll();
@@ -168,11 +269,12 @@ String DocItem::getTitle() const
 		return "";
 	}
 
-	int indx = (ai->value()).indexOf( '.' );
-	if (indx<0)
-		return ai->value();		// Whole thing
+	string_view sValue = ai->value( sBuffer );
+	size_t indx = sValue.find( '.' );
+	if (indx==string_view::npos)
+		return sValue;			// Whole thing
 
-	return (ai->value()).substring(0,++indx);
+	return sValue.substr( 0, ++indx );
 }
 
 
@@ -189,7 +291,8 @@ String DocItem::getTitle() const
 
 AttribIterator::AttribIterator()
 	:	m_isAll( true ),
-	    m_sKey( "" )
+	    m_sKey( "" ),
+	    m_akKey( DocSchema::aOther )
 		// ,
 	    // m_indx( 0 ),
 	    // m_iEnd( 0 )
@@ -200,10 +303,26 @@ AttribIterator::AttribIterator
 (
     const DocItem::Attribs::const_iterator& iBegin,
     const DocItem::Attribs::const_iterator& iEnd,
-    const String& sKey
+    string_view sKey
 )
 	:	m_isAll( false ),
 	    m_sKey( sKey ),
+	    m_akKey( DocSchema::attributeKind(sKey) ),
+	    m_indx( iBegin ),
+	    m_iEnd( iEnd )
+{
+	scan();
+}
+
+AttribIterator::AttribIterator
+(
+    const DocItem::Attribs::const_iterator& iBegin,
+    const DocItem::Attribs::const_iterator& iEnd,
+    DocSchema::AttributeKind ak
+)
+	:	m_isAll( false ),
+	    m_sKey( DocSchema::attributeKeyword(ak) ),
+	    m_akKey( ak ),
 	    m_indx( iBegin ),
 	    m_iEnd( iEnd )
 {
@@ -217,6 +336,7 @@ AttribIterator::AttribIterator
 )
 	:	m_isAll( true ),
 	    m_sKey( "" ),
+	    m_akKey( DocSchema::aOther ),
 	    m_indx( iBegin ),
 	    m_iEnd( iEnd )
 {
@@ -235,8 +355,8 @@ AttribIterator::AttribIterator
 
 	Dereferences the iterator to return the current Attribute.
 
-	it->value() and (*it).value() will yield the value of the
-	current attribute for iterator 'it'.
+	it->value( sBuffer ) and (*it).value( sBuffer ) will yield the
+	value of the current attribute for iterator 'it'.
 	Similiarly, it->keyword() and (*it).keyword() will
 	yield the keyword string.
 
@@ -255,13 +375,20 @@ AttribIterator::AttribIterator
 
 /*	scan -- internal routine steps m_indx forward to next matching
 			keyword.  Keywords are compared case insensitive. Scan
-			starts at the current item.
+			starts at the current item.  Special keywords are compared
+			by their AttributeKind, without looking at the text.
 */
 void AttribIterator::scan()
 {
-	if (!m_isAll)
-		while( m_indx!=m_iEnd && !((*m_indx).keyword()).equalsIgnoreCase(m_sKey) )
+	if (m_isAll)
+		return;
+	if (m_akKey!=DocSchema::aOther) {
+		while( m_indx!=m_iEnd && (*m_indx).kind()!=m_akKey )
+			m_indx++;
+	} else {
+		while( m_indx!=m_iEnd && !equalsIgnoreCase( (*m_indx).keyword(), m_sKey ) )
 			m_indx++;
+	}
 }
 
 /*: Class Project
@@ -272,7 +399,7 @@ void AttribIterator::scan()
 
 /*: routine Project::setName			Set's project name
 
-	Prototype: void setName( const String& sName )
+	Prototype: void setName( string sName )
 */
 
 /*: routine Project::getClass
@@ -280,20 +407,46 @@ void AttribIterator::scan()
 	Returns a pointer to the DocClass object for a particular class.  If the
 	class object already exists in this project, returns a pointer to the existing object.
 	If not, it creates a new DocClass object.
+	<P>
+	sClass may be qualified to any depth, eg: "a::b::C".  Classes are
+	kept in a tree of DocScopes, one level for each name, so finding one
+	takes a lookup per level rather than a search of every class.
 */
-DocClass* Project::getClass( const String& sClass )
+DocClass* Project::getClass( string_view sClass )
 {
-	cptr<DocClass> cp;
-	ClassMap::iterator it;
-
-	it = m_mapClasses.find( sClass );
-	if (it==m_mapClasses.end()) {
-		cp = new DocClass( sClass );
-		m_mapClasses.insert( ClassMap::value_type(sClass, cp) );
-	} else {
-		cp = (*it).second;
+	AllocStats::Scope allocs( s_siteClass );
+	DocScope* pScope = &m_scopeRoot;
+	size_t iStart = 0;
+
+	while (iStart<sClass.size()) {
+		size_t iEnd = sClass.find( "::", iStart );
+		if (iEnd==string_view::npos)
+			iEnd = sClass.size();
+		pScope = pScope->getScope( sClass.substr( 0, iEnd ) );
+		iStart = iEnd+2;
 	}
-	return cp;
+	if (!pScope->m_pClass) {
+		pScope->m_pClass = new DocClass( string(sClass) );
+		m_cClasses++;
+	}
+	return pScope->m_pClass;
+}
+
+/*	Project::clearClasses -- internal routine removes every class */
+void Project::clearClasses()
+{
+	m_scopeRoot.clear();
+	m_cClasses = 0;
+}
+
+/*: routine Project::addSource
+
+	Records that sFile holds a doc block for the project itself.
+*/
+void Project::addSource( string_view sFile )
+{
+	if (m_setSources.find( sFile )==m_setSources.end())
+		m_setSources.emplace( sFile );
 }
 
 /*: routine Project::getFunction
@@ -301,7 +454,7 @@ DocClass* Project::getClass( const String& sClass )
 	Returns a pointer to the Function object for the given name.
 	Creates the Class object and Function object if necessary.
 */
-Function* Project::getFunction( const String& sClass, const String& sName )
+Function* Project::getFunction( string_view sClass, string_view sName )
 {
 	DocClass* pcls;
 
@@ -314,7 +467,7 @@ Function* Project::getFunction( const String& sClass, const String& sName )
 	Returns a pointer to the Variable object for the given name.
 	Creates the Class object and Variable object if necessary.
 */
-Variable* Project::getVariable( const String& sClass, const String& sName )
+Variable* Project::getVariable( string_view sClass, string_view sName )
 {
 	DocClass* pcls;
 
@@ -322,13 +475,23 @@ Variable* Project::getVariable( const String& sClass, const String& sName )
 	return pcls->getVariable( sName );
 }
 
+/*: routine Project::getPageName()
+
+	Returns the name of the project page, without the extension of the
+	format it is written in.
+*/
+string Project::getPageName() const
+{
+	return "index";
+}
+
 /*: routine Project::getFileName()
 
 	Returns the output filename to use.  This doesn't include a directory.
 */
-String Project::getFileName() const
+string Project::getFileName() const
 {
-	return "index.html";
+	return getPageName() + ".html";
 }
 
 
@@ -343,15 +506,16 @@ String Project::getFileName() const
 	Returns a pointer to the Function object for the given name.
 	Creates the Function object if necessary.
 */
-Function* DocClass::getFunction( const String& sName )
+Function* DocClass::getFunction( string_view sName )
 {
+	AllocStats::Scope allocs( s_siteMember );
 	cptr<Function> cp;
 	FunctionMap::iterator it;
 
 	it = m_mapFunctions.find( sName );
 	if (it==m_mapFunctions.end()) {
-		cp = new Function( m_sItemName, sName );
-		m_mapFunctions.insert( FunctionMap::value_type(sName, cp) );
+		cp = new Function( m_sItemName, string(sName) );
+		m_mapFunctions.insert( FunctionMap::value_type(string(sName), cp) );
 	} else {
 		cp = (*it).second;
 	}
@@ -363,27 +527,204 @@ Function* DocClass::getFunction( const String& sName )
 	Returns a pointer to the Variable object for the given name.
 	Creates the Variable object if necessary.
 */
-Variable* DocClass::getVariable( const String& sName )
+Variable* DocClass::getVariable( string_view sName )
 {
+	AllocStats::Scope allocs( s_siteMember );
 	cptr<Variable> cp;
 	VariableMap::iterator it;
 
 	it = m_mapVariables.find( sName );
 	if (it==m_mapVariables.end()) {
-		cp = new Variable( m_sItemName, sName );
-		m_mapVariables.insert( VariableMap::value_type(sName, cp) );
+		cp = new Variable( m_sItemName, string(sName) );
+		m_mapVariables.insert( VariableMap::value_type(string(sName), cp) );
 	} else {
 		cp = (*it).second;
 	}
 	return cp;
 }
 
+/*: routine DocClass::addSource
+
+	Records that sFile holds a doc block for the class or one of its
+	members, so its page depends on sFile.
+*/
+void DocClass::addSource( string_view sFile )
+{
+	if (m_setSources.find( sFile )==m_setSources.end())
+		m_setSources.emplace( sFile );
+}
+
+/*: routine DocClass::getDisplayName
+
+	Returns the last part of the class name, eg: "C" for "a::b::C".
+*/
+string DocClass::getDisplayName() const
+{
+	size_t i = m_sItemName.rfind( "::" );
+
+	return i==string::npos ? m_sItemName : m_sItemName.substr( i+2 );
+}
+
+/*	pageNameOf -- internal routine returns sPrefix and sName, with each
+			"::" changed to ".", as a page name.
+*/
+static string pageNameOf( string_view sPrefix, string_view sName )
+{
+	string sFile( sPrefix );
+
+	for (size_t i=0; i<sName.size(); i++) {
+		if (sName[i]==':' && i+1<sName.size() && sName[i+1]==':') {
+			sFile += '.';
+			i++;
+		} else {
+			sFile += sName[i];
+		}
+	}
+	return sFile;
+}
+
+/*: routine DocClass::getPageName
+
+	Returns the name of the class page, without the extension of the
+	format it is written in.  A qualified name has a "." for each "::",
+	eg: "a.b.C".
+*/
+string DocClass::getPageName() const
+{
+	return pageNameOf( "", m_sItemName );
+}
+
 /*: routine DocClass::getFileName
 
 	Returns the output filename to use.  This doesn't include a directory.
+	A qualified name has a "." for each "::", eg: "a.b.C.html".
+*/
+string DocClass::getFileName() const
+{
+	return getPageName() + ".html";
+}
+
+
+/*: class DocScope
+
+	One level of the qualified names of a Project: a namespace, or a
+	class that has nested names, or the unnamed global level at the
+	top.  Each level holds its own map of the next names, so a Project
+	with many namespaces has many small maps instead of one large one,
+	and each namespace gets its own page (see Project::filesOut()).
+*/
+
+/*: routine DocScope::~DocScope		Destructor, deletes the nested scopes	*/
+DocScope::~DocScope()
+{
+	clear();
+}
+
+/*	DocScope::clear -- internal routine removes the nested scopes and
+			the class.
+*/
+void DocScope::clear()
+{
+	ScopeMap::iterator it;
+	for (it=m_mapScopes.begin(); it!=m_mapScopes.end(); ++it)
+		delete (*it).second;
+	m_mapScopes.clear();
+	m_pClass = cptr<DocClass>();
+}
+
+/*	DocScope::getScope -- internal routine returns the nested scope with
+			the qualified name sName, creating it if necessary.
+			sName is this scope's name and one more level.
+*/
+DocScope* DocScope::getScope( string_view sName )
+{
+	string_view sLast = sName.substr( m_sName.empty() ? 0 : m_sName.size()+2 );
+
+	ScopeMap::iterator it = m_mapScopes.find( sLast );
+	if (it==m_mapScopes.end())
+		it = m_mapScopes.insert( ScopeMap::value_type(string(sLast), new DocScope(string(sName))) ).first;
+	return (*it).second;
+}
+
+/*: routine DocScope::getDisplayName
 
-	Prototype: String DocClass::getFileName()
+	Returns the last part of the scope name, eg: "b" for "a::b".
 */
+string DocScope::getDisplayName() const
+{
+	size_t i = m_sName.rfind( "::" );
+
+	return i==string::npos ? m_sName : m_sName.substr( i+2 );
+}
+
+/*: routine DocScope::getPageName
+
+	Returns the name of the page of the scope, eg: "namespace.a.b".
+	"namespace" cannot be a class name, so these never collide with
+	class pages.
+*/
+string DocScope::getPageName() const
+{
+	return pageNameOf( "namespace.", m_sName );
+}
+
+/*: routine DocScope::getFileName
+
+	Returns the file name of the HTML page of the scope, eg:
+	"namespace.a.b.html".
+*/
+string DocScope::getFileName() const
+{
+	return getPageName() + ".html";
+}
+
+/*: routine DocScope::find
+
+	Returns the scope below this one with the qualified name sName, eg:
+	"a::b", or 0 if there is none.  Takes a lookup per level.
+*/
+const DocScope* DocScope::find( string_view sName ) const
+{
+	const DocScope* pScope = this;
+	size_t iStart = 0;
+
+	while (pScope && iStart<sName.size()) {
+		size_t iEnd = sName.find( "::", iStart );
+		if (iEnd==string_view::npos)
+			iEnd = sName.size();
+
+		ScopeMap::const_iterator it = pScope->m_mapScopes.find( sName.substr( iStart, iEnd-iStart ) );
+		pScope = it==pScope->m_mapScopes.end() ? 0 : (*it).second;
+		iStart = iEnd+2;
+	}
+	return pScope;
+}
+
+/*: routine DocScope::nestedOf
+
+	Appends the scopes directly below this one, in name order.
+*/
+void DocScope::nestedOf( std::vector<const DocScope*>& vScopes ) const
+{
+	ScopeMap::const_iterator it;
+	for (it=m_mapScopes.begin(); it!=m_mapScopes.end(); ++it)
+		vScopes.push_back( (*it).second );
+}
+
+/*: routine DocScope::classesOf
+
+	Appends the class of this scope, then every class nested in it, in
+	name order.
+*/
+void DocScope::classesOf( std::vector<DocClass*>& vClasses ) const
+{
+	if (m_pClass)
+		vClasses.push_back( m_pClass );
+
+	ScopeMap::const_iterator it;
+	for (it=m_mapScopes.begin(); it!=m_mapScopes.end(); ++it)
+		(*it).second->classesOf( vClasses );
+}
 
 /*: class Attribute
 
@@ -397,19 +738,21 @@ Variable* DocClass::getVariable( const String& sName )
 	Constructors.  Initializes keyword and value to null or given values.
 
 	Prototype: Attribute()
-	Prototype: Attribute( const String& sKeyword, const String& sValue )
+	Prototype: Attribute( string sKeyword, string sValue )
+	Prototype: Attribute( string sKeyword, SourceText text )
 */
 /*: Attribute::keyword()
 
 	Returns keyword of the attribute.
 
-	Prototype: String& keyword()
+	Prototype: string_view keyword()
 */
 /*: Attribute::value()
 
-	Returns Value of the attribute.
+	Returns Value of the attribute.  A value still in the input is
+	made in sBuffer, so the result is valid until sBuffer changes.
 
-	Prototype: String& value()
+	Prototype: string_view value( string& sBuffer )
 */
 /*: Attribute::operators()
 
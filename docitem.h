@@ -6,22 +6,34 @@ Copyright (C) 1997-2013, Brian Bray
 */
 
 /* Needs:
+#include <cctype>
 #include <list>
 #include <map>
+#include <memory>
+#include <set>
 #include <fstream>
-#include "bw/string.h"
+#include <istream>
+#include <string>
+#include <string_view>
+#include <vector>
 #include "bw/countable.h"
+#include "lexstream.h"
+#include "schema.h"
 */
 
 
 // Ignore warning about the expanded template names being longer than 256 characters (MSVC)
 //#pragma warning( disable : 4786 )
 
-// Since the constructors look like alternative ways to make a String print
-inline std::ostream& operator<<( std::ostream& os, const bw::String& s)
+// Keywords and DocItem types are compared case insensitive
+inline bool equalsIgnoreCase( std::string_view sA, std::string_view sB )
 {
-	os << (const char*)s;
-	return os;
+	if (sA.size()!=sB.size())
+		return false;
+	for (size_t i=0; i<sA.size(); i++)
+		if (tolower( (unsigned char)sA[i] )!=tolower( (unsigned char)sB[i] ))
+			return false;
+	return true;
 }
 
 // Forward definitions
@@ -30,19 +42,32 @@ class DocClass;
 class Member;
 class Function;
 class Variable;
+class DocScope;
 class AttribIterator;
+class DocSink;
+class SpillStore;
+class FragmentCache;
+class DependFile;
+class OutputBackends;
 
 class Attribute {
 public:
-	Attribute() {};
-	Attribute( const bw::String& sKeyword, const bw::String& sValue )
-		: m_sKeyword(sKeyword), m_sValue(sValue) {}
-
-	bw::String keyword() const {
+	Attribute() : m_ak(DocSchema::aOther) {};
+	Attribute( std::string sKeyword, std::string sValue )
+		: m_sKeyword(std::move(sKeyword)), m_text(std::move(sValue)),
+		  m_ak(DocSchema::attributeKind(m_sKeyword)) {}
+	Attribute( std::string sKeyword, SourceText text )
+		: m_sKeyword(std::move(sKeyword)), m_text(std::move(text)),
+		  m_ak(DocSchema::attributeKind(m_sKeyword)) {}
+
+	std::string_view keyword() const {
 		return m_sKeyword;
 	}
-	bw::String value() const {
-		return m_sValue;
+	DocSchema::AttributeKind kind() const {
+		return m_ak;
+	}
+	std::string_view value( std::string& sBuffer ) const {
+		return m_text.value( sBuffer );
 	}
 
 	// Necessary operators for <list>
@@ -60,14 +85,18 @@ public:
 	}
 
 private:
-	bw::String		m_sKeyword;
-	bw::String		m_sValue;
+	std::string		m_sKeyword;
+	SourceText		m_text;			// May still be in the input
+	DocSchema::AttributeKind	m_ak;	// Looked up once, for find() and output
 };
 
 class DocItem {
 public:
 	friend class AttribIterator;
 
+	// The input files whose doc blocks went into a page (see DependFile)
+	typedef std::set< std::string, std::less<> >	SourceSet;
+
 	DocItem();
 	virtual ~DocItem();
 
@@ -77,41 +106,60 @@ public:		// Countable object
 
 public:		// Attributes
 	virtual void clearAttributes();
-	virtual void addAttribute( const bw::String& sKeyword, const bw::String& sValue );
-	virtual void addAttribute( const Attribute& attr );
-	virtual AttribIterator find( const bw::String& sKeyword ) const;
+	virtual void addAttribute( std::string sKeyword, std::string sValue );
+	virtual void addAttribute( std::string sKeyword, SourceText text );
+	virtual void addAttribute( Attribute attr );
+	virtual AttribIterator find( std::string_view sKeyword ) const;
+	virtual AttribIterator find( DocSchema::AttributeKind ak ) const;
 	virtual AttribIterator findAll() const;
 
 public:		// Common routines
-	friend std::ostream& operator<<( std::ostream& ost, const DocItem& di );
+	virtual bool hasPrototype() const =0;
 	virtual bool needPrototype() const =0;
-	virtual void setPrototype( const bw::String& );
+	virtual void setPrototype( std::string );
 	virtual void setDefaultPrototype();
-	virtual void setLinkName( const bw::String& );
+	virtual void setLinkName( std::string );
 	virtual void setDefaultLinkName();
-	virtual void setImpliedAttribute( const bw::String& sV );
+	virtual void setImpliedAttribute( SourceText text );
 	virtual void setDefaultImpliedAttribute();
-	virtual bw::String getName() const {
+	virtual void setSourceLocation( std::string_view sFile, int nLine );
+	std::string getSourceLink( std::string_view sLinkTemplate ) const;
+	std::string_view getSourceFile() const {
+		return m_sSourceFile;
+	}
+	int getSourceLine() const {
+		return m_nSourceLine;
+	}
+	virtual std::string_view getName() const {
 		return m_sItemName;
 	}
-	virtual bw::String getFullDisplayName() const = 0;
-	virtual bw::String getDisplayName() const = 0;
-	virtual bw::String getTitle() const;
-	virtual bw::String getLinkName() const {
+	virtual std::string getFullDisplayName() const = 0;
+	virtual std::string getDisplayName() const = 0;
+	virtual std::string_view getTitle( std::string& sBuffer ) const;
+	virtual std::string_view getLinkName() const {
 		return m_sLinkName;
 	}
 
+public:		// Partial runs (see partial.cc)
+	void partialItemOut( std::ostream& os ) const;
+	void partialItemIn( std::istream& is );
+	void mergeItem( const DocItem& di );
+
 public:		// Comparisons so that these objects can be put in sets, etc.
 //	static bool isLess( const DocItem& diA, const DocItem& diB)
 //		{return diA.getName()<diB.getName();}
 
 protected:
-	bw::String m_sLinkName;
-	bw::String m_sItemName;			// Set by subclasses
+	std::string m_sLinkName;
+	std::string m_sItemName;		// Set by subclasses
+	int		m_cPrototypes;			// Number of "Prototype" attributes
 
 private:
 	unsigned long	m_cRef;
 
+	std::string		m_sSourceFile;	// Where the first doc block was found
+	int				m_nSourceLine;	// 0 if not known
+
 	typedef std::list< Attribute > Attribs;
 	Attribs m_attribs;
 
@@ -120,7 +168,8 @@ private:
 class AttribIterator {
 public:		// Attributes
 	AttribIterator();
-	AttribIterator( const DocItem::Attribs::const_iterator&, const DocItem::Attribs::const_iterator&, const bw::String& );
+	AttribIterator( const DocItem::Attribs::const_iterator&, const DocItem::Attribs::const_iterator&, std::string_view );
+	AttribIterator( const DocItem::Attribs::const_iterator&, const DocItem::Attribs::const_iterator&, DocSchema::AttributeKind );
 	AttribIterator( const DocItem::Attribs::const_iterator&, const DocItem::Attribs::const_iterator& );
 
 	AttribIterator& operator++() {
@@ -146,129 +195,257 @@ private:	// Attributes
 	void scan();
 
 	bool						m_isAll;
-	bw::String					m_sKey;
+	std::string					m_sKey;
+	DocSchema::AttributeKind	m_akKey;		// aOther: compare m_sKey
 	DocItem::Attribs::const_iterator	m_indx;
 	DocItem::Attribs::const_iterator	m_iEnd;
 };
 
 class Member : public DocItem {
 public:
-	Member( const bw::String& sClassName, const bw::String& sName )
-		: m_sClassName( sClassName ) {
-		m_sItemName = sName;
+	Member( std::string sClassName, std::string sName )
+		: m_sClassName( std::move(sClassName) ) {
+		m_sItemName = std::move( sName );
 	}
 	virtual ~Member()
 	{}
 
 public:		// Inherited virtual functions implemented here
+	virtual bool hasPrototype() const {
+		return true;
+	}
 	virtual bool needPrototype() const {
-		return find("Prototype").atEof();
+		return m_cPrototypes==0;
 	}
 
 protected:
-	bw::String		m_sClassName;
+	std::string		m_sClassName;
 };
 
 class Function : public Member {
 public:
-	Function( const bw::String& sClassName, const bw::String& sName )
-		: Member( sClassName, sName ) {}
+	Function( std::string sClassName, std::string sName )
+		: Member( std::move(sClassName), std::move(sName) ) {}
 	virtual ~Function()
 	{}
 
-	virtual bw::String getFullDisplayName() const {
+	virtual std::string getFullDisplayName() const {
 		return m_sClassName + "::" + m_sItemName + "()";
 	}
-	virtual bw::String getDisplayName() const {
+	virtual std::string getDisplayName() const {
 		return m_sItemName + "()";
 	}
 };
 
 class Variable : public Member {
 public:
-	Variable( const bw::String& sClassName, const bw::String& sName )
-		: Member( sClassName, sName ) {}
+	Variable( std::string sClassName, std::string sName )
+		: Member( std::move(sClassName), std::move(sName) ) {}
 	virtual ~Variable()
 	{}
 
-	virtual bw::String getFullDisplayName() const {
+	virtual std::string getFullDisplayName() const {
 		return m_sClassName + "::" + m_sItemName;
 	}
-	virtual bw::String getDisplayName() const {
+	virtual std::string getDisplayName() const {
 		return m_sItemName;
 	}
 };
 
 class DocClass : public DocItem {
 public:
-	DocClass( const bw::String& sName ) {
-		m_sItemName = sName;
+	friend class Project;
+
+	DocClass( std::string sName ) {
+		m_sItemName = std::move( sName );
 	}
 	virtual ~DocClass()
 	{}
 
 public:		// Inherited virtual functions implemented here
-	virtual bool needPrototype() const {
+	virtual bool hasPrototype() const {
 		return false;
 	}
-	virtual bw::String getFullDisplayName() const {
-		return m_sItemName;
+	virtual bool needPrototype() const {
+		return false;
 	}
-	virtual bw::String getDisplayName() const {
+	virtual std::string getFullDisplayName() const {
 		return m_sItemName;
 	}
+	virtual std::string getDisplayName() const;
 
 public:		// Accessed by parsers
-	Function* getFunction( const bw::String& sName );
-	Variable* getVariable( const bw::String& sName );
+	Function* getFunction( std::string_view sName );
+	Variable* getVariable( std::string_view sName );
+	void addSource( std::string_view sFile );
+	const SourceSet& getSources() const {
+		return m_setSources;
+	}
 
 public:		// Output routines
-	friend std::ostream& operator<<( std::ostream& ost, const DocClass& dclass );
-	bw::String getFileName() const {
-		return getName()+".html";
-	}
+	std::string getPageName() const;
+	std::string getFileName() const;
+
+public:		// Partial runs (see partial.cc)
+	void partialOut( std::ostream& os ) const;
 
 private:
-	typedef std::map< bw::String, cptr<Function>, std::less<bw::String> >	FunctionMap;
-	typedef std::map< bw::String, cptr<Variable>, std::less<bw::String> >	VariableMap;
+	// std::less<> lets find() take a string_view without a copy
+	typedef std::map< std::string, cptr<Function>, std::less<> >	FunctionMap;
+	typedef std::map< std::string, cptr<Variable>, std::less<> >	VariableMap;
 
 	FunctionMap		m_mapFunctions;
 	VariableMap		m_mapVariables;
+	SourceSet		m_setSources;	// Of the class and its members
+};
+
+//	One level of qualified names, eg: "a::b" in "a::b::C".  It may be a
+//	documented class, hold nested names, or both.
+class DocScope {
+public:
+	friend class Project;
+
+	DocScope( std::string sName )
+		: m_sName( std::move(sName) ) {}
+	~DocScope();
+
+	std::string_view getName() const {
+		return m_sName;
+	}
+	std::string getDisplayName() const;
+	std::string getPageName() const;
+	std::string getFileName() const;
+	DocClass* getClass() const {
+		return m_pClass;
+	}
+	bool hasScopes() const {
+		return !m_mapScopes.empty();
+	}
+	const DocScope* find( std::string_view sName ) const;
+	void nestedOf( std::vector<const DocScope*>& vScopes ) const;
+	void classesOf( std::vector<DocClass*>& vClasses ) const;
+
+private:
+	DocScope* getScope( std::string_view sName );
+	void clear();
+
+	DocScope( const DocScope& );					// Not copyable
+	DocScope& operator=( const DocScope& );
+
+private:
+	// Owns the nested scopes
+	typedef std::map< std::string, DocScope*, std::less<> >	ScopeMap;
+
+	std::string		m_sName;		// Qualified
+	cptr<DocClass>	m_pClass;		// 0 if not documented as a class
+	ScopeMap		m_mapScopes;
 };
 
 class Project : public DocItem {
 public:
 	Project()
+		: m_scopeRoot( "" ),
+		  m_cClasses( 0 ),
+		  m_fFormats( fmtHtml ),
+		  m_pCache( 0 ),
+		  m_pDepends( 0 ),
+		  m_cbWritten( 0 ),
+		  m_cbMarkupSaved( 0 )
 	{}
 	virtual ~Project()
 	{}
 
 public:		// Inherited virtual functions implemented here
+	virtual bool hasPrototype() const {
+		return false;
+	}
 	virtual bool needPrototype() const {
 		return false;
 	}
-	virtual bw::String getFullDisplayName() const {
+	virtual std::string getFullDisplayName() const {
 		return "Project " + m_sItemName;
 	}
-	virtual bw::String getDisplayName() const {
+	virtual std::string getDisplayName() const {
 		return m_sItemName;
 	}
 
 public:		// Accessed by parsers
-	void setName( const bw::String& sName ) {
-		m_sItemName = sName;
+	void setName( std::string sName ) {
+		m_sItemName = std::move( sName );
+	}
+	void setSourceLinkTemplate( std::string sTemplate ) {
+		m_sSourceLinkTemplate = std::move( sTemplate );
+	}
+	std::string_view getSourceLinkTemplate() const {
+		return m_sSourceLinkTemplate;
 	}
-	DocClass* getClass( const bw::String& sClass );
-	Function* getFunction( const bw::String& sClass, const bw::String& sName );
-	Variable* getVariable( const bw::String& sClass, const bw::String& sName );
+	void addSource( std::string_view sFile );
+	const SourceSet& getSources() const {
+		return m_setSources;
+	}
+	DocClass* getClass( std::string_view sClass );
+	const DocScope& scopes() const {
+		return m_scopeRoot;
+	}
+	Function* getFunction( std::string_view sClass, std::string_view sName );
+	Variable* getVariable( std::string_view sClass, std::string_view sName );
 
 public:		// Output routines
-	friend std::ostream& operator<<( std::ostream& ost, const Project& proj );
-	void filesOut( const bw::String& sDir );
-	bw::String getFileName() const;
+	enum {fmtHtml=1, fmtJson=2, fmtText=4};		// See OutputBackend
+	enum {fmtMinified=8};		// With fmtHtml: compact pages, shared style
+
+	void filesOut( const std::string& sDir );
+	void filesOut( DocSink& sink );
+	bool fileOut( DocSink& sink, std::string_view sFileName ) const;
+	std::string getPageName() const;
+	std::string getFileName() const;
+	void setFormats( int fFormats ) {
+		m_fFormats = fFormats;
+	}
+	void setFragmentCache( FragmentCache* pCache ) {
+		m_pCache = pCache;
+	}
+	void setDependFile( DependFile* pDepends ) {
+		m_pDepends = pDepends;
+	}
+	long long bytesWritten() const {
+		return m_cbWritten;
+	}
+	long long markupSaved() const {
+		return m_cbMarkupSaved;
+	}
+
+public:		// Partial runs (see partial.cc)
+	void partialOut( std::ostream& os ) const;
+	static void partialClassOut( std::ostream& os, const DocClass& cls );
+	void partialIn( std::istream& is );
+	void merge( const Project& proj );
+
+public:		// Low memory runs (see spill.cc)
+	void spill( SpillStore& store );
+	void partialOut( std::ostream& os, SpillStore& store );
+	void filesOut( DocSink& sink, SpillStore& store );
+
+private:
+	void partialProjectOut( std::ostream& os ) const;
+	void indexOut( OutputBackends& backends ) const;
+	void classOut( OutputBackends& backends, const DocClass& cls ) const;
+	void scopesOut( OutputBackends& backends ) const;
+	void scopeOut( OutputBackends& backends, const DocScope& scope ) const;
+	void bodyOut( OutputBackends& backends, const DocClass& cls ) const;
+	void dependsOut( OutputBackends& backends, const std::string& sPage,
+	                 const SourceSet* pSources ) const;
+	void clearClasses();
 
 private:
-	typedef std::map< bw::String, cptr<DocClass>, std::less<bw::String> >	ClassMap;
-	ClassMap	m_mapClasses;
+	DocScope	m_scopeRoot;	// Holds the global "class", named ""
+	size_t		m_cClasses;
+	std::string	m_sSourceLinkTemplate;
+	SourceSet	m_setSources;	// Of the project doc blocks
+	int			m_fFormats;		// fmtHtml, ... written by filesOut()
+	FragmentCache*	m_pCache;		// Not owned, may be 0
+	DependFile*	m_pDepends;		// Not owned, may be 0
+	long long	m_cbWritten;	// By the last filesOut()
+	long long	m_cbMarkupSaved;	// Less than with the full markup
 };
 
@@ -0,0 +1,71 @@
+/* docsink.h -- Destinations for the generated documentation files
+
+Copyright (C) 2017, Brian Bray
+
+*/
+
+/* Needs:
+#include <fstream>
+#include <sstream>
+#include <map>
+#include <string>
+*/
+
+//	Receives the output files of a Project.
+//	Files are written one at a time: beginFile(), output to the
+//	returned stream, then endFile(), or all at once with putFile().
+//	flush() is called after the last.
+class DocSink {
+public:
+	virtual ~DocSink() {}
+
+	virtual std::ostream& beginFile( const std::string& sFileName ) = 0;
+	virtual void endFile() = 0;
+	virtual void putFile( const std::string& sFileName, std::string sData );
+	virtual void flush() {}
+};
+
+//	Writes each file into a directory.
+class DirSink : public DocSink {
+public:
+	DirSink( const std::string& sDir );
+
+	virtual std::ostream& beginFile( const std::string& sFileName );
+	virtual void endFile();
+
+private:
+	std::string		m_sDir;
+	std::string		m_sFileName;	// Being written
+	std::ofstream	m_os;
+};
+
+//	Builds each file in memory and passes the whole file to writeFile().
+class BufferedSink : public DocSink {
+public:
+	virtual std::ostream& beginFile( const std::string& sFileName );
+	virtual void endFile();
+	virtual void putFile( const std::string& sFileName, std::string sData );
+
+protected:
+	virtual void writeFile( const std::string& sFileName, std::string sData ) = 0;
+
+private:
+	std::string			m_sCurrent;
+	std::ostringstream	m_os;
+};
+
+//	Keeps each file in memory, keyed by file name.
+class MemorySink : public BufferedSink {
+public:
+	typedef std::map< std::string, std::string >	FileMap;
+
+	const FileMap& files() const {
+		return m_mapFiles;
+	}
+
+protected:
+	virtual void writeFile( const std::string& sFileName, std::string sData );
+
+private:
+	FileMap				m_mapFiles;
+};
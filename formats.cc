@@ -0,0 +1,414 @@
+/* formats.cc  -- The JSON and plain text output of DocGen
+
+Copyright (C) 2017, Brian Bray
+
+*/
+
+#include <cctype>
+#include <cstdio>
+#include <fstream>
+#include <istream>
+#include <list>
+#include <map>
+#include <memory>
+#include <ostream>
+#include <set>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "bw/countable.h"
+#include "lexstream.h"
+#include "schema.h"
+#include "docitem.h"
+#include "docsink.h"
+#include "htmlfmt.h"
+#include "fragcache.h"
+#include "backend.h"
+
+using std::ostream;
+using std::string;
+using std::string_view;
+
+// Indents of man page text, and of the details of a member
+static const char s_sIndent[] = "       ";
+static const char s_sMemberIndent[] = "           ";
+
+/*	jsonStringOut -- internal routine writes s as a JSON string */
+static void jsonStringOut( ostream& os, string_view s )
+{
+	size_t iRun = 0;
+
+	os.put( '"' );
+	for (size_t i=0; i<s.size(); i++) {
+		unsigned char ch = s[i];
+		if (ch!='"' && ch!='\\' && ch>=0x20)
+			continue;
+
+		os.write( s.data()+iRun, i-iRun );
+		iRun = i+1;
+		if (ch=='"' || ch=='\\') {
+			os.put( '\\' );
+			os.put( ch );
+		} else if (ch=='\n') {
+			os << "\\n";
+		} else if (ch=='\t') {
+			os << "\\t";
+		} else {
+			char szEscape[8];
+			snprintf( szEscape, sizeof(szEscape), "\\u%04x", ch );
+			os << szEscape;
+		}
+	}
+	os.write( s.data()+iRun, s.size()-iRun );
+	os.put( '"' );
+}
+
+
+/*: class JsonBackend
+
+	OutputBackend that writes each page as a JSON document, for tools
+	that want the documentation without parsing HTML, eg: for
+	"a.b.C.json":
+	<PRE>
+	{"page":"a.b.C","title":"a::b::C",
+	 "name":"a::b::C","link":"C","attributes":[{"keyword":"Description","value":"..."}],
+	 "functions":[{"name":"f()","link":"f","title":"...","attributes":[...]}],
+	 "variables":[]}
+	</PRE>
+	The project page ("index.json") lists "classes" and "namespaces",
+	each with the "page" that documents it, and has the "globals" as an
+	object like a class page, or null.  A namespace page only lists.
+	Attributes are in the order they are shown in the HTML, and their
+	values are as written, with any HTML in them, but for "Source",
+	which is the plain "file:line" where the item was documented.
+*/
+JsonBackend::JsonBackend( DocSink& sink )
+	:	m_sink( sink ),
+	    m_isFirst( true )
+{
+}
+
+/*	JsonBackend::separatorOut -- internal routine writes the ',' before
+			all but the first member of an object or array.
+*/
+void JsonBackend::separatorOut()
+{
+	if (!m_isFirst)
+		m_os.put( ',' );
+	m_isFirst = false;
+}
+
+/*	JsonBackend::keyOut -- internal routine starts a member of an object */
+void JsonBackend::keyOut( const char* sKey )
+{
+	separatorOut();
+	m_os << '"' << sKey << "\":";
+}
+
+void JsonBackend::beginPage( const string& sPageName, const string& sTitle )
+{
+	m_sFileName = sPageName + extension();
+	m_os.str( "" );
+	m_os.put( '{' );
+	m_isFirst = true;
+	keyOut( "page" );
+	jsonStringOut( m_os, sPageName );
+	keyOut( "title" );
+	jsonStringOut( m_os, sTitle );
+}
+
+size_t JsonBackend::endPage()
+{
+	m_os << "}\n";
+
+	string sData = m_os.str();
+	size_t cb = sData.size();
+	m_os.str( "" );
+	m_sink.putFile( m_sFileName, std::move( sData ) );
+	return cb;
+}
+
+void JsonBackend::beginItem( const DocItem& di )
+{
+	keyOut( "name" );
+	jsonStringOut( m_os, di.getFullDisplayName() );
+	keyOut( "link" );
+	jsonStringOut( m_os, di.getLinkName() );
+	keyOut( "attributes" );
+	m_os.put( '[' );
+	m_isFirst = true;
+}
+
+void JsonBackend::attributeOut( const Attribute& attr, string_view sValue )
+{
+	separatorOut();
+	m_os.put( '{' );
+	m_isFirst = true;
+	keyOut( "keyword" );
+	jsonStringOut( m_os, attr.keyword() );
+	keyOut( "value" );
+	jsonStringOut( m_os, sValue );
+	m_os.put( '}' );
+}
+
+void JsonBackend::endItem( const DocItem& di )
+{
+	m_os.put( ']' );
+	m_isFirst = false;
+}
+
+void JsonBackend::beginList( ListKind lk, const string& sHeading, size_t cEntries )
+{
+	static const char* const s_asKeys[] = {"classes", "namespaces", "functions", "variables"};
+
+	keyOut( s_asKeys[lk] );
+	m_os.put( '[' );
+	m_isFirst = true;
+}
+
+void JsonBackend::endList( ListKind lk )
+{
+	m_os.put( ']' );
+	m_isFirst = false;
+}
+
+void JsonBackend::classEntry( const DocClass& cls, ItemTitle& title )
+{
+	if (cls.getName().empty())
+		return;							// The globals, under "globals"
+
+	separatorOut();
+	m_os.put( '{' );
+	m_isFirst = true;
+	keyOut( "name" );
+	jsonStringOut( m_os, cls.getDisplayName() );
+	keyOut( "qualified" );
+	jsonStringOut( m_os, cls.getName() );
+	keyOut( "page" );
+	jsonStringOut( m_os, cls.getPageName() );
+	keyOut( "title" );
+	jsonStringOut( m_os, title.value() );
+	m_os.put( '}' );
+}
+
+void JsonBackend::scopeEntry( const DocScope& scope )
+{
+	separatorOut();
+	m_os.put( '{' );
+	m_isFirst = true;
+	keyOut( "name" );
+	jsonStringOut( m_os, scope.getDisplayName() );
+	keyOut( "qualified" );
+	jsonStringOut( m_os, scope.getName() );
+	keyOut( "page" );
+	jsonStringOut( m_os, scope.getPageName() );
+	m_os.put( '}' );
+}
+
+bool JsonBackend::beginMember( const DocItem& di, ItemTitle& title )
+{
+	separatorOut();
+	m_os.put( '{' );
+	m_isFirst = true;
+	keyOut( "name" );
+	jsonStringOut( m_os, di.getDisplayName() );
+	keyOut( "link" );
+	jsonStringOut( m_os, di.getLinkName() );
+	keyOut( "title" );
+	jsonStringOut( m_os, title.value() );
+	keyOut( "attributes" );
+	m_os.put( '[' );
+	m_isFirst = true;
+	return true;
+}
+
+void JsonBackend::endMember( const DocItem& di )
+{
+	m_os << "]}";
+	m_isFirst = false;
+}
+
+void JsonBackend::beginGlobals( const string& sHeading, bool hasGlobals )
+{
+	keyOut( "globals" );
+	if (hasGlobals) {
+		m_os.put( '{' );
+		m_isFirst = true;
+	} else {
+		m_os << "null";
+	}
+}
+
+void JsonBackend::endGlobals( bool hasGlobals )
+{
+	if (hasGlobals) {
+		m_os.put( '}' );
+		m_isFirst = false;
+	}
+}
+
+
+/*: class TextBackend
+
+	OutputBackend that writes each page as plain text laid out like a
+	man page: section headings in capitals at the margin, their text
+	indented below.  A page starts with its NAME, then the sections of
+	the item's attributes (SYNOPSIS, DESCRIPTION, one for each other
+	keyword, then SOURCE), then the CLASSES, NAMESPACES, FUNCTIONS and
+	VARIABLES it lists.  Each member is followed by its own attributes,
+	indented further.  The HTML in attribute values is dropped (see
+	HtmlFormat::plainText()), but for the SOURCE, which is plain text.
+*/
+TextBackend::TextBackend( DocSink& sink )
+	:	m_sink( sink ),
+	    m_isInGlobals( false ),
+	    m_isInMember( false )
+{
+}
+
+/*	TextBackend::sectionOut -- internal routine starts a section */
+void TextBackend::sectionOut( string_view sSection )
+{
+	m_os << '\n' << sSection << '\n';
+	m_sSection = sSection;
+}
+
+void TextBackend::beginPage( const string& sPageName, const string& sTitle )
+{
+	m_sFileName = sPageName + extension();
+	m_os.str( "" );
+	m_os << "NAME\n" << s_sIndent << sTitle << '\n';
+	m_sSection = "NAME";
+	m_isInGlobals = false;
+	m_isInMember = false;
+}
+
+size_t TextBackend::endPage()
+{
+	string sData = m_os.str();
+	size_t cb = sData.size();
+	m_os.str( "" );
+	m_sink.putFile( m_sFileName, std::move( sData ) );
+	return cb;
+}
+
+void TextBackend::beginItem( const DocItem& di )
+{
+	m_isInMember = false;
+}
+
+void TextBackend::attributeOut( const Attribute& attr, string_view sValue )
+{
+	string sSection;
+	string_view sLabel = attr.keyword();
+	bool isPrototype = false;
+	bool isPlain = false;			// Not HTML
+
+	if (sValue.find_first_not_of( " \t\r\n" )==string_view::npos)
+		return;
+
+	switch (attr.kind()) {
+	case DocSchema::aImpliedPrototype:
+	case DocSchema::aPrototype:
+		sSection = "SYNOPSIS";
+		isPrototype = true;
+		break;
+	case DocSchema::aImpliedDescription:
+	case DocSchema::aDescription:
+		sSection = "DESCRIPTION";
+		break;
+	case DocSchema::aSource:
+		sSection = "SOURCE";
+		sLabel = "Source";
+		isPlain = true;
+		break;
+	default:
+		for (size_t i=0; i<attr.keyword().size(); i++) {
+			char ch = attr.keyword()[i];
+			sSection += (ch>='a' && ch<='z') ? ch-'a'+'A' : ch;
+		}
+		break;
+	}
+
+	if (!m_isInMember) {
+		if (sSection!=m_sSection)
+			sectionOut( sSection );
+		else if (!isPrototype)
+			m_os << '\n';
+		m_os << s_sIndent;
+		if (isPlain)
+			m_os << sValue;
+		else
+			m_os << HtmlFormat::plainText( sValue, s_sIndent );
+		m_os << '\n';
+		return;
+	}
+
+	// A member's prototypes come together, the others are apart
+	if (!m_sSection.empty() && !(isPrototype && m_sSection=="SYNOPSIS"))
+		m_os << '\n';
+	m_os << s_sMemberIndent;
+	if (!isPrototype && sSection!="DESCRIPTION")
+		m_os << sLabel << ": ";
+	if (isPlain)
+		m_os << sValue;
+	else
+		m_os << HtmlFormat::plainText( sValue, s_sMemberIndent );
+	m_os << '\n';
+	m_sSection = sSection;
+}
+
+void TextBackend::beginList( ListKind lk, const string& sHeading, size_t cEntries )
+{
+	static const char* const s_asSections[] = {"CLASSES", "NAMESPACES", "FUNCTIONS", "VARIABLES"};
+
+	m_isInMember = false;
+	if (cEntries==0)
+		return;
+	sectionOut( string(m_isInGlobals ? "GLOBAL " : "") + s_asSections[lk] );
+}
+
+void TextBackend::classEntry( const DocClass& cls, ItemTitle& title )
+{
+	if (cls.getName().empty())
+		return;							// The globals, listed by themselves
+
+	string_view sTitle = title.value();
+
+	m_os << s_sIndent << cls.getName();
+	if (!sTitle.empty())
+		m_os << " - " << HtmlFormat::plainText( sTitle, s_sMemberIndent );
+	m_os << '\n';
+}
+
+void TextBackend::scopeEntry( const DocScope& scope )
+{
+	m_os << s_sIndent << scope.getName() << '\n';
+}
+
+bool TextBackend::beginMember( const DocItem& di, ItemTitle& title )
+{
+	if (m_isInMember)
+		m_os << '\n';
+	m_os << s_sIndent << di.getDisplayName() << '\n';
+	m_isInMember = true;
+	m_sSection.clear();
+	return true;
+}
+
+void TextBackend::beginGlobals( const string& sHeading, bool hasGlobals )
+{
+	m_isInGlobals = true;
+	if (!hasGlobals) {
+		sectionOut( "GLOBALS" );
+		m_os << s_sIndent << "No global functions or variables\n";
+	}
+}
+
+void TextBackend::endGlobals( bool hasGlobals )
+{
+	m_isInGlobals = false;
+}
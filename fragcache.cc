@@ -0,0 +1,255 @@
+/* fragcache.cc  -- Rendered HTML of members, kept between runs
+
+Copyright (C) 2017, Brian Bray
+
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <istream>
+#include <ostream>
+#include <sstream>
+#include <list>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "bw/bwassert.h"
+#include "bw/countable.h"
+#include "bw/exception.h"
+#include "lexstream.h"
+#include "schema.h"
+#include "docitem.h"
+#include "fragcache.h"
+
+using bw::BFileException;
+using std::string;
+using std::string_view;
+
+/*: class FragmentCache
+
+	Every Function and Variable is rendered twice, as a row of its
+	class's index and as a detail section.  Both depend only on the
+	item's names and attributes, so when the documentation is rebuilt
+	after a small edit, most of them come out the same as last time.
+	<P>
+	A FragmentCache keeps both pieces of HTML for each member, keyed by a
+	64 bit hash of its full display name, display name, link name and
+	attributes.  Class pages are then mostly put together from cached
+	text (see DocGen::setFragmentCache()):
+	<PRE>
+		docgen --cache out/.docgen-cache out *.h
+	</PRE>
+	The file is rewritten after each run with only the entries that run
+	used, so it does not grow as items are edited.  A missing or damaged
+	cache file just means everything is rendered.  The minified HTML
+	of a member (see HtmlBackend) is kept under another key, with the
+	number of bytes of markup it saved, so one cache serves both.
+	<P>
+	scCacheHeader must be changed whenever the HTML of a member changes,
+	so that files written by an older docgen are not used.
+*/
+
+static const char scCacheHeader[] = "docgen-cache 3";
+
+// FNV-1a, 64 bit
+static const FragmentCache::Key s_keyBasis = 14695981039346656037ull;
+static const FragmentCache::Key s_keyPrime = 1099511628211ull;
+
+/*	hashString -- internal routine adds a string and its length to a key,
+			so that the boundaries between strings are part of the hash.
+*/
+static void hashString( FragmentCache::Key& key, string_view s )
+{
+	size_t cb = s.size();
+	for (size_t i=0; i<sizeof(cb); i++)
+		key = (key ^ (unsigned char)(cb>>(8*i))) * s_keyPrime;
+	for (size_t i=0; i<s.size(); i++)
+		key = (key ^ (unsigned char)s[i]) * s_keyPrime;
+}
+
+/*	readString -- internal routine reads a length prefixed string from
+			the buffer [p,pEnd) and advances p past it.  Returns false if
+			the buffer does not hold one.
+*/
+static bool readString( const char*& p, const char* pEnd, string& s )
+{
+	char* pColon;
+
+	if (p>=pEnd || *p++!=' ')
+		return false;
+	unsigned long long cb = strtoull( p, &pColon, 10 );
+	if (pColon==p || pColon>=pEnd || *pColon!=':' || cb>(unsigned long long)(pEnd-pColon-1))
+		return false;
+	s.assign( pColon+1, cb );
+	p = pColon + 1 + cb;
+	return true;
+}
+
+/*	writeString -- internal routine writes a length prefixed string */
+static void writeString( std::ostream& os, string_view s )
+{
+	os << ' ' << s.size() << ':' << s;
+}
+
+
+/*: routine FragmentCache::FragmentCache		Constructor, empty	*/
+FragmentCache::FragmentCache()
+	:	m_cLoaded( 0 ),
+	    m_cLoadedUsed( 0 ),
+	    m_cHits( 0 ),
+	    m_cMisses( 0 )
+{
+}
+
+/*: routine FragmentCache::itemKey
+
+	Returns the key of an item: a hash of everything its row and detail
+	section are rendered from.  A non empty sVariant names another
+	rendering of the item, eg: "minified".
+*/
+FragmentCache::Key FragmentCache::itemKey( const DocItem& di, string_view sVariant )
+{
+	Key key = s_keyBasis;
+	string sValue;
+
+	hashString( key, di.getFullDisplayName() );
+	hashString( key, di.getDisplayName() );
+	hashString( key, di.getLinkName() );
+
+	AttribIterator it = di.findAll();
+	while (!it.atEof()) {
+		hashString( key, (*it).keyword() );
+		hashString( key, (*it).value( sValue ) );
+		++it;
+	}
+	if (!sVariant.empty())
+		hashString( key, sVariant );
+	return key;
+}
+
+/*: routine FragmentCache::find
+
+	Returns the fragments stored under key, or 0.  Found entries are kept
+	by the next save().
+*/
+const FragmentCache::Fragments* FragmentCache::find( Key key )
+{
+	EntryMap::iterator it = m_mapEntries.find( key );
+	if (it==m_mapEntries.end()) {
+		m_cMisses++;
+		return 0;
+	}
+	m_cHits++;
+	if (!(*it).second.m_isUsed) {
+		(*it).second.m_isUsed = true;
+		m_cLoadedUsed++;
+	}
+	return &(*it).second.m_frag;
+}
+
+/*: routine FragmentCache::add
+
+	Stores the fragments rendered for key, and the bytes of markup
+	their rendering saved, and returns them.
+*/
+const FragmentCache::Fragments& FragmentCache::add( Key key, string sRow, string sDetail,
+                                                    long long cbSaved )
+{
+	Entry& entry = m_mapEntries[key];
+
+	entry.m_frag.m_sRow = std::move( sRow );
+	entry.m_frag.m_sDetail = std::move( sDetail );
+	entry.m_frag.m_cbSaved = cbSaved;
+	entry.m_isUsed = true;
+	return entry.m_frag;
+}
+
+/*: routine FragmentCache::load
+
+	Reads the entries saved by an earlier run.  A file that is missing,
+	from another version of docgen, or damaged is ignored.
+*/
+void FragmentCache::load( const string& sFileName )
+{
+	std::ifstream is( sFileName.c_str(), std::ios::in | std::ios::binary );
+	if (!is.is_open())
+		return;
+
+	// Read it all at once, it is about the size of the output
+	std::ostringstream osFile;
+	osFile << is.rdbuf();
+	string sFile = osFile.str();
+
+	const char* p = sFile.data();
+	const char* pEnd = p + sFile.size();
+	size_t cchHeader = sizeof(scCacheHeader)-1;
+	if (sFile.compare( 0, cchHeader, scCacheHeader )!=0 || sFile[cchHeader]!='\n')
+		return;
+	p += cchHeader+1;
+
+	EntryMap mapLoaded;
+	while (p<pEnd && *p=='E') {
+		char* pKeyEnd;
+		char* pSavedEnd;
+		Entry entry;
+
+		Key key = strtoull( p+1, &pKeyEnd, 16 );
+		p = pKeyEnd;
+		if (!readString( p, pEnd, entry.m_frag.m_sRow ) ||
+		    !readString( p, pEnd, entry.m_frag.m_sDetail ) ||
+		    p>=pEnd || *p++!=' ')
+			return;
+		entry.m_frag.m_cbSaved = strtoll( p, &pSavedEnd, 10 );
+		if (pSavedEnd==p || pSavedEnd>=pEnd || *pSavedEnd!='\n')
+			return;
+		p = pSavedEnd+1;
+		entry.m_isUsed = false;
+		mapLoaded[key] = std::move( entry );
+	}
+	if (p<pEnd && *p=='.') {
+		m_mapEntries.swap( mapLoaded );
+		m_cLoaded = m_mapEntries.size();
+	}
+}
+
+/*: routine FragmentCache::save
+
+	Writes the entries used by this run.  The file is replaced in one
+	step, so a failed run leaves the old cache in place.  Nothing is
+	written if the file would not change.
+
+	Throws: if the file cannot be written
+*/
+void FragmentCache::save( const string& sFileName ) const
+{
+	if (m_cMisses==0 && m_cLoadedUsed==m_cLoaded)
+		return;					// Every entry was used, and no new ones
+
+	string sTemp = sFileName + ".new";
+	std::ofstream os( sTemp.c_str(), std::ios::out | std::ios::binary );
+	if (!os.is_open())
+		throw BFileException( BFileException::SystemError );
+
+	os << scCacheHeader << '\n';
+	EntryMap::const_iterator it;
+	for (it=m_mapEntries.begin(); it!=m_mapEntries.end(); ++it) {
+		if (!(*it).second.m_isUsed)
+			continue;
+		os << 'E' << ' ' << std::hex << (*it).first << std::dec;
+		writeString( os, (*it).second.m_frag.m_sRow );
+		writeString( os, (*it).second.m_frag.m_sDetail );
+		os << ' ' << (*it).second.m_frag.m_cbSaved << '\n';
+	}
+	os << ".\n";
+	os.close();
+	if (os.fail() || std::rename( sTemp.c_str(), sFileName.c_str() )!=0) {
+		std::remove( sTemp.c_str() );
+		throw BFileException( BFileException::SystemError );
+	}
+}
@@ -0,0 +1,54 @@
+/* fragcache.h -- Rendered HTML of members, kept between runs
+
+Copyright (C) 2017, Brian Bray
+
+*/
+
+/* Needs:
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include "docitem.h"
+*/
+
+//	The index row and detail section of each member, keyed by a hash of
+//	everything they are rendered from.
+class FragmentCache {
+public:
+	typedef unsigned long long Key;
+
+	struct Fragments {
+		std::string		m_sRow;			// Index table row
+		std::string		m_sDetail;		// Detail section and rule
+		long long		m_cbSaved;		// Markup left out, if minified
+	};
+
+	FragmentCache();
+
+	static Key itemKey( const DocItem& di, std::string_view sVariant=std::string_view() );
+	const Fragments* find( Key key );
+	const Fragments& add( Key key, std::string sRow, std::string sDetail, long long cbSaved );
+
+	void load( const std::string& sFileName );
+	void save( const std::string& sFileName ) const;
+
+	int hits() const {
+		return m_cHits;
+	}
+	int misses() const {
+		return m_cMisses;
+	}
+
+private:
+	struct Entry {
+		Fragments		m_frag;
+		bool			m_isUsed;		// By this run, so worth saving
+	};
+	typedef std::unordered_map< Key, Entry >	EntryMap;
+
+	EntryMap		m_mapEntries;
+	size_t			m_cLoaded;		// Entries read by load()
+	size_t			m_cLoadedUsed;	// Of those, found by this run
+	int				m_cHits;
+	int				m_cMisses;
+};
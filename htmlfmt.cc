@@ -0,0 +1,549 @@
+/* htmlfmt.cc  -- Writing attribute text into HTML output
+
+Copyright (C) 2017, Brian Bray
+
+*/
+
+#include <ostream>
+#include <string>
+#include <string_view>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "htmlfmt.h"
+
+using std::ostream;
+using std::string_view;
+
+/*: class HtmlFormat
+
+	Writes the text of attributes into the HTML output, escaping what
+	would otherwise be taken as markup.  There are three manipulators:
+	<DL>
+	<DT>literal()<DD>For prototypes.  Every '&amp;', '&lt;' and '&gt;' is
+	escaped.
+	<DT>smartText()<DD>For titles and other attributes.  The HTML tags
+	and entities the author wrote are kept, and every other '&lt;' and
+	'&amp;' is escaped, so "a &lt; b" and "list&lt;T&gt;" come out as
+	written.
+	<DT>smartFormat()<DD>For descriptions.  As smartText(), and a blank
+	line starts a new paragraph (except inside &lt;PRE&gt;).
+	<DT>plainText()<DD>For text output.  The tags the smart modes keep
+	are dropped, those that end a line or paragraph ending one, and
+	entities are replaced by their characters.  Outside &lt;PRE&gt; the
+	white space at the ends of lines is dropped and blank lines are
+	merged.  Each line after the first starts with an indent.
+	</DL>
+	A '&lt;' is only taken as a tag when it is followed by the name of an
+	HTML tag and the tag is closed by a '&gt;' before the next '&lt;'.
+	A one letter name straight after an identifier (eg: "map&lt;K,B&gt;",
+	"list&lt;B&gt;") is a template argument, and "A" and "IMG" are only
+	tags when they have attributes.  A '&amp;' is only kept when it starts
+	an entity reference.
+	<P>
+	The text is written straight into the stream's buffer.  Runs of
+	characters that need no attention are found 16 bytes at a time with
+	SSE2 where the compiler targets it.
+*/
+
+// Tags kept in smart text, upper case and sorted for lookupTag()
+static constexpr const char* s_aTags[] = {
+	"A", "ADDRESS", "B", "BIG", "BLOCKQUOTE", "BR", "CAPTION", "CENTER",
+	"CITE", "CODE", "DD", "DFN", "DIV", "DL", "DT", "EM", "FONT",
+	"H1", "H2", "H3", "H4", "H5", "H6", "HR", "I", "IMG", "KBD", "LI",
+	"OL", "P", "PRE", "Q", "S", "SAMP", "SMALL", "SPAN", "STRIKE",
+	"STRONG", "SUB", "SUP", "TABLE", "TD", "TH", "TR", "TT", "U", "UL",
+	"VAR"
+};
+static constexpr int numTags = sizeof(s_aTags)/sizeof(s_aTags[0]);
+
+static constexpr bool tagsSorted()
+{
+	for (int i=1; i<numTags; i++)
+		if (!(string_view(s_aTags[i-1])<string_view(s_aTags[i])))
+			return false;
+	return true;
+}
+static_assert( tagsSorted(), "s_aTags must be sorted" );
+
+enum { MaxTagName=10, MaxEntityName=32 };
+
+static inline bool isAlpha( char ch )
+{
+	return (ch>='A' && ch<='Z') || (ch>='a' && ch<='z');
+}
+
+static inline bool isAlnum( char ch )
+{
+	return isAlpha( ch ) || (ch>='0' && ch<='9');
+}
+
+static inline bool isSpace( char ch )
+{
+	return ch==' ' || ch=='\t' || ch=='\r' || ch=='\n';
+}
+
+/*	lookupTag -- internal routine returns the index of an upper case tag
+			name in s_aTags, or -1.
+*/
+static int lookupTag( string_view sName )
+{
+	int iLow = 0;
+	int iHigh = numTags-1;
+
+	while (iLow<=iHigh) {
+		int i = (iLow+iHigh)/2;
+		int nCmp = sName.compare( s_aTags[i] );
+		if (nCmp==0)
+			return i;
+		if (nCmp<0)
+			iHigh = i-1;
+		else
+			iLow = i+1;
+	}
+	return -1;
+}
+
+/*	findSpecial -- internal routine returns the first of ch1, ch2 or ch3
+			in [p,pEnd), or pEnd.
+*/
+static const char* findSpecial( const char* p, const char* pEnd,
+                                char ch1, char ch2, char ch3 )
+{
+#ifdef __SSE2__
+	const __m128i v1 = _mm_set1_epi8( ch1 );
+	const __m128i v2 = _mm_set1_epi8( ch2 );
+	const __m128i v3 = _mm_set1_epi8( ch3 );
+
+	while (pEnd-p>=16) {
+		__m128i v = _mm_loadu_si128( (const __m128i*)p );
+		__m128i vHit = _mm_or_si128( _mm_or_si128( _mm_cmpeq_epi8( v, v1 ),
+		                                           _mm_cmpeq_epi8( v, v2 ) ),
+		                             _mm_cmpeq_epi8( v, v3 ) );
+		int nMask = _mm_movemask_epi8( vHit );
+		if (nMask)
+			return p + __builtin_ctz( nMask );
+		p += 16;
+	}
+#endif
+	while (p<pEnd && *p!=ch1 && *p!=ch2 && *p!=ch3)
+		p++;
+	return p;
+}
+
+/*	entityLength -- internal routine returns the length of the entity
+			reference at p ("&amp;", "&#60;", "&#x3C;"), or 0.
+*/
+static size_t entityLength( const char* p, const char* pEnd )
+{
+	const char* q = p+1;
+	const char* pName;
+
+	if (q<pEnd && *q=='#') {
+		bool isHex = (q+1<pEnd && (q[1]=='x' || q[1]=='X'));
+		q += isHex ? 2 : 1;
+		pName = q;
+		while (q<pEnd && q-pName<MaxEntityName &&
+		       ((*q>='0' && *q<='9') ||
+		        (isHex && ((*q>='a' && *q<='f') || (*q>='A' && *q<='F')))))
+			q++;
+	} else {
+		pName = q;
+		if (q<pEnd && isAlpha( *q ))
+			while (q<pEnd && q-pName<MaxEntityName && isAlnum( *q ))
+				q++;
+	}
+
+	if (q==pName || q>=pEnd || *q!=';')
+		return 0;
+	return q+1-p;
+}
+
+/*	tagLength -- internal routine returns the length of the tag or
+			comment at p, or 0 if the '<' is just a less than.  Sets
+			iTag to the tag found and isEndTag if it is "</...>".
+*/
+static size_t tagLength( const char* pBegin, const char* p, const char* pEnd,
+                         int& iTag, bool& isEndTag )
+{
+	string_view sRest( p, pEnd-p );
+
+	iTag = -1;
+	isEndTag = false;
+	if (sRest.compare( 0, 4, "<!--" )==0) {
+		size_t iClose = sRest.find( "-->", 4 );
+		return iClose==string_view::npos ? 0 : iClose+3;
+	}
+
+	const char* q = p+1;
+	if (q<pEnd && *q=='/') {
+		isEndTag = true;
+		q++;
+	}
+
+	char szName[MaxTagName+1];
+	size_t cchName = 0;
+	while (q<pEnd && isAlnum( *q ) && cchName<MaxTagName) {
+		char ch = *q++;
+		szName[cchName++] = (ch>='a' && ch<='z') ? ch-'a'+'A' : ch;
+	}
+	if (cchName==0 || !isAlpha( szName[0] ) || q>=pEnd ||
+	    !(*q=='>' || *q=='/' || isSpace( *q )))
+		return 0;
+	iTag = lookupTag( string_view( szName, cchName ) );
+	if (iTag<0)
+		return 0;
+
+	// A one letter tag after an identifier is a template argument
+	if (!isEndTag && cchName==1 && p>pBegin &&
+	    (isAlnum( p[-1] ) || p[-1]=='_' || p[-1]==':'))
+		return 0;
+
+	// The tag must close before anything else opens
+	const char* pClose = q;
+	while (pClose<pEnd && *pClose!='>' && *pClose!='<')
+		pClose++;
+	if (pClose>=pEnd || *pClose=='<')
+		return 0;
+
+	// An anchor or image without attributes is not markup
+	if (!isEndTag && (string_view( szName, cchName )=="A" ||
+	                  string_view( szName, cchName )=="IMG")) {
+		const char* pAttr = q;
+		while (pAttr<pClose && isSpace( *pAttr ))
+			pAttr++;
+		if (pAttr==q || !isAlpha( *pAttr ))
+			return 0;
+	}
+	return pClose+1-p;
+}
+
+/*	put -- internal routine writes cch characters into the stream buffer */
+static inline void put( ostream& os, const char* p, size_t cch )
+{
+	if (cch && os.rdbuf()->sputn( p, cch )!=(std::streamsize)cch)
+		os.setstate( std::ios::badbit );
+}
+
+/*	literalOut -- internal routine writes text with all markup escaped */
+static void literalOut( ostream& os, string_view s )
+{
+	const char* p = s.data();
+	const char* pEnd = p + s.size();
+
+	while (p<pEnd) {
+		const char* q = findSpecial( p, pEnd, '&', '<', '>' );
+		put( os, p, q-p );
+		if (q==pEnd)
+			break;
+		if (*q=='&')
+			put( os, "&amp;", 5 );
+		else if (*q=='<')
+			put( os, "&lt;", 4 );
+		else
+			put( os, "&gt;", 4 );
+		p = q+1;
+	}
+}
+
+/*	attributeOut -- internal routine writes text as the value of a
+			quoted attribute, eg: an HREF.
+*/
+static void attributeOut( ostream& os, string_view s )
+{
+	const char* p = s.data();
+	const char* pEnd = p + s.size();
+
+	while (p<pEnd) {
+		const char* q = findSpecial( p, pEnd, '&', '<', '"' );
+		put( os, p, q-p );
+		if (q==pEnd)
+			break;
+		if (*q=='&')
+			put( os, "&amp;", 5 );
+		else if (*q=='<')
+			put( os, "&lt;", 4 );
+		else
+			put( os, "&quot;", 6 );
+		p = q+1;
+	}
+}
+
+/*	smartOut -- internal routine writes text keeping tags and entities,
+			and if isFormat, turns blank lines into paragraph breaks.
+*/
+static void smartOut( ostream& os, string_view s, bool isFormat )
+{
+	static const int iTagPre = lookupTag( "PRE" );
+	const char* pBegin = s.data();
+	const char* pEnd = pBegin + s.size();
+	const char* p = pBegin;
+	bool isInPre = false;
+
+	// Without formatting, '&' stands in for '\n' so it is never found
+	const char chNewLine = isFormat ? '\n' : '&';
+
+	while (p<pEnd) {
+		const char* q = findSpecial( p, pEnd, '&', '<', chNewLine );
+		put( os, p, q-p );
+		if (q==pEnd)
+			break;
+
+		if (*q=='&') {
+			size_t cch = entityLength( q, pEnd );
+			if (cch) {
+				put( os, q, cch );
+				p = q + cch;
+			} else {
+				put( os, "&amp;", 5 );
+				p = q + 1;
+			}
+		} else if (*q=='<') {
+			int iTag;
+			bool isEndTag;
+			size_t cch = tagLength( pBegin, q, pEnd, iTag, isEndTag );
+			if (cch) {
+				if (iTag==iTagPre)
+					isInPre = !isEndTag;
+				put( os, q, cch );
+				p = q + cch;
+			} else {
+				put( os, "&lt;", 4 );
+				p = q + 1;
+			}
+		} else {
+			// A blank line, which may hold white space, ends a paragraph
+			const char* pLastNewLine = q;
+			int cNewLines = 0;
+			const char* r = q;
+			while (r<pEnd && isSpace( *r )) {
+				if (*r=='\n') {
+					pLastNewLine = r;
+					cNewLines++;
+				}
+				r++;
+			}
+			if (cNewLines<2 || isInPre) {
+				put( os, "\n", 1 );
+				p = q + 1;
+			} else {
+				if (q==pBegin || r==pEnd)
+					put( os, "\n", 1 );
+				else
+					put( os, "\n<P>\n", 5 );
+				p = pLastNewLine + 1;
+			}
+		}
+	}
+}
+
+/*	PlainText -- internal class writes plain text a character at a time,
+			holding white space and line ends until text follows.
+*/
+class PlainText {
+public:
+	PlainText( ostream& os, string_view sIndent )
+		:	m_os( os ), m_sIndent( sIndent ), m_isInPre( false ),
+		    m_isLineStart( true ), m_hasText( false ), m_cBreaks( 0 ) {}
+
+	void setInPre( bool isInPre ) {
+		m_isInPre = isInPre;
+	}
+	//	The next text starts a line (cLines 1) or a paragraph (2)
+	void lineBreak( int cLines ) {
+		if (cLines>m_cBreaks)
+			m_cBreaks = cLines;
+		m_isLineStart = true;
+		m_sSpaces.clear();
+	}
+	void put( char ch ) {
+		put( string_view( &ch, 1 ) );
+	}
+	void put( string_view s );
+
+private:
+	ostream&	m_os;
+	string_view	m_sIndent;
+	bool		m_isInPre;
+	bool		m_isLineStart;		// Nothing written on this line yet
+	bool		m_hasText;			// Anything written
+	int			m_cBreaks;			// Line ends owed before the next text
+	std::string	m_sSpaces;			// Held until text follows on the line
+};
+
+/*	PlainText::put -- internal routine writes s, a run of characters at
+			a time.
+*/
+void PlainText::put( string_view s )
+{
+	const char* p = s.data();
+	const char* pEnd = p + s.size();
+
+	while (p<pEnd) {
+		char ch = *p;
+		if (ch=='\n') {
+			lineBreak( m_isLineStart && m_cBreaks>0 ? 2 : 1 );
+			p++;
+			continue;
+		}
+		if (isSpace( ch )) {
+			if (!m_isLineStart || m_isInPre)
+				m_sSpaces += ch;
+			p++;
+			continue;
+		}
+
+		// Text up to the next white space
+		const char* q = p+1;
+		while (q<pEnd && !isSpace( *q ))
+			q++;
+		if (m_isLineStart && m_hasText) {
+			m_os.put( '\n' );
+			if (m_cBreaks>1)
+				m_os.put( '\n' );
+			::put( m_os, m_sIndent.data(), m_sIndent.size() );
+		}
+		::put( m_os, m_sSpaces.data(), m_sSpaces.size() );
+		m_sSpaces.clear();
+		::put( m_os, p, q-p );
+		m_isLineStart = false;
+		m_hasText = true;
+		m_cBreaks = 0;
+		p = q;
+	}
+}
+
+/*	entityChar -- internal routine returns the character of an entity
+			reference, or 0 if it is not one plain text can show.
+*/
+static char entityChar( string_view sEntity )
+{
+	static const struct {
+		const char*	m_sName;
+		char		m_ch;
+	} s_aEntities[] = {
+		{"&lt;", '<'}, {"&gt;", '>'}, {"&amp;", '&'}, {"&quot;", '"'},
+		{"&apos;", '\''}, {"&nbsp;", ' '}
+	};
+
+	for (size_t i=0; i<sizeof(s_aEntities)/sizeof(s_aEntities[0]); i++)
+		if (sEntity==s_aEntities[i].m_sName)
+			return s_aEntities[i].m_ch;
+
+	if (sEntity.size()<4 || sEntity[1]!='#')
+		return 0;
+	bool isHex = sEntity[2]=='x' || sEntity[2]=='X';
+	long nChar = 0;
+	for (size_t i=isHex ? 3 : 2; i+1<sEntity.size() && nChar<128; i++) {
+		char ch = sEntity[i];
+		int nDigit = (ch>='0' && ch<='9') ? ch-'0' : (ch|0x20)-'a'+10;
+		nChar = nChar*(isHex ? 16 : 10) + nDigit;
+	}
+	return (nChar>=' ' && nChar<127) ? (char)nChar : 0;
+}
+
+/*	tagBreaks -- internal routine returns the line ends a tag stands for
+			in plain text: 2 for a paragraph, 1 for a line, else 0.
+*/
+static int tagBreaks( string_view sTag, bool isEndTag )
+{
+	static constexpr const char* s_aParagraphs[] = {
+		"BLOCKQUOTE", "DL", "OL", "P", "PRE", "TABLE", "UL"
+	};
+	static constexpr const char* s_aLines[] = {
+		"ADDRESS", "BR", "CAPTION", "CENTER", "DD", "DIV", "DT",
+		"H1", "H2", "H3", "H4", "H5", "H6", "HR", "LI", "TR"
+	};
+
+	for (size_t i=0; i<sizeof(s_aParagraphs)/sizeof(s_aParagraphs[0]); i++)
+		if (sTag==s_aParagraphs[i])
+			return (isEndTag || sTag=="P") ? 2 : 1;
+	for (size_t i=0; i<sizeof(s_aLines)/sizeof(s_aLines[0]); i++)
+		if (sTag==s_aLines[i])
+			return 1;
+	return 0;
+}
+
+/*	plainOut -- internal routine writes text without its markup, with
+			sIndent before each line after the first.
+*/
+static void plainOut( ostream& os, string_view s, string_view sIndent )
+{
+	static const int iTagPre = lookupTag( "PRE" );
+	const char* pBegin = s.data();
+	const char* pEnd = pBegin + s.size();
+	const char* p = pBegin;
+	PlainText text( os, sIndent );
+
+	while (p<pEnd) {
+		const char* q = findSpecial( p, pEnd, '&', '<', '\n' );
+		text.put( string_view( p, q-p ) );
+		if (q==pEnd)
+			break;
+
+		size_t cch = 0;
+		if (*q=='&') {
+			cch = entityLength( q, pEnd );
+			char ch = cch ? entityChar( string_view( q, cch ) ) : 0;
+			if (ch)
+				text.put( ch );
+			else
+				cch = 0;
+		} else if (*q=='<') {
+			int iTag;
+			bool isEndTag;
+			cch = tagLength( pBegin, q, pEnd, iTag, isEndTag );
+			if (cch && iTag>=0) {
+				string_view sTag = s_aTags[iTag];
+				int cBreaks = tagBreaks( sTag, isEndTag );
+				if (iTag==iTagPre)
+					text.setInPre( !isEndTag );
+				if (cBreaks)
+					text.lineBreak( cBreaks );
+				if (sTag=="LI" && !isEndTag)
+					text.put( "- " );
+				else if ((sTag=="TD" || sTag=="TH") && !isEndTag)
+					text.put( ' ' );
+			}
+		}
+		if (cch==0) {
+			text.put( *q );
+			cch = 1;
+		}
+		p = q + cch;
+	}
+}
+
+/*: routine HtmlFormat::operator<<
+
+	Writes the text of a manipulator into os.
+
+	Prototype: std::ostream& operator<<( std::ostream& os, const HtmlFormat::Text& text )
+*/
+ostream& operator<<( ostream& os, const HtmlFormat::Text& text )
+{
+	ostream::sentry sentry( os );
+	if (!sentry)
+		return os;
+
+	switch (text.m_mode) {
+	case HtmlFormat::mLiteral:
+		literalOut( os, text.m_s );
+		break;
+	case HtmlFormat::mAttribute:
+		attributeOut( os, text.m_s );
+		break;
+	case HtmlFormat::mSmartText:
+		smartOut( os, text.m_s, false );
+		break;
+	case HtmlFormat::mSmartFormat:
+		smartOut( os, text.m_s, true );
+		break;
+	case HtmlFormat::mPlainText:
+		plainOut( os, text.m_s, text.m_sIndent );
+		break;
+	}
+	return os;
+}
@@ -0,0 +1,48 @@
+/* htmlfmt.h -- Writing attribute text into HTML output
+
+Copyright (C) 2017, Brian Bray
+
+*/
+
+/* Needs:
+#include <ostream>
+#include <string_view>
+*/
+
+//	Manipulators that write text into an HTML stream, eg:
+//		os << HtmlFormat::literal( sPrototype );
+//	or, with plainText(), into plain text.
+class HtmlFormat {
+public:
+	enum Mode {
+		mLiteral,			// Escape every '&', '<' and '>'
+		mAttribute,			// Escape '&', '<' and '"', for a quoted attribute value
+		mSmartText,			// Keep tags and entities, escape the rest
+		mSmartFormat,		// As mSmartText, and blank lines start paragraphs
+		mPlainText			// Drop the tags, replace the entities
+	};
+
+	struct Text {
+		std::string_view	m_s;
+		Mode				m_mode;
+		std::string_view	m_sIndent;		// Of lines after the first, mPlainText
+	};
+
+	static Text literal( std::string_view s ) {
+		return Text{ s, mLiteral };
+	}
+	static Text attribute( std::string_view s ) {
+		return Text{ s, mAttribute };
+	}
+	static Text smartText( std::string_view s ) {
+		return Text{ s, mSmartText };
+	}
+	static Text smartFormat( std::string_view s ) {
+		return Text{ s, mSmartFormat };
+	}
+	static Text plainText( std::string_view s, std::string_view sIndent ) {
+		return Text{ s, mPlainText, sIndent };
+	}
+
+	friend std::ostream& operator<<( std::ostream& os, const Text& text );
+};
@@ -4,20 +4,113 @@ Copyright (C) 1997-2013, Brian Bray
 
 */
 
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
 #include <ios>
+#include <memory>
 #include <fstream>
+#include <string>
+#include <string_view>
+#include <vector>
 #include <cctype>
+#include <ostream>
 
 #include "bw/bwassert.h"
-#include "bw/string.h"
 #include "bw/exception.h"
+#include "allocstats.h"
 #include "lexstream.h"
 
 using bw::BFileException;
-using bw::String;
 
-static const String scOpSyms("+-*/%^&|~!=<>[]");
-static const String scWhiteSpace(" \t\f\v*/");
+static constexpr char scOpSyms[] = "+-*/%^&|~!=<>[]";
+static const char scWhiteSpace[] = " \t\f\v*/";
+
+// getToken() looks each byte up once in a table built at compile time.
+// The low bits are its class for skipping whitespace, the others say
+// where it may appear in a token.  Bytes above 127 are never letters,
+// as with isalpha() in the "C" locale.
+enum SkipClass {kBlank, kNewline, kStar, kSlash, kOther, cSkipClasses};
+enum {
+	SkipMask	= 0x07,
+	IdStart		= 0x08,		// Letter, '_' or '~'
+	IdChar		= 0x10,		// Letter, digit or '_'
+	OpSym		= 0x20,		// In scOpSyms, may follow "operator"
+	CastChar	= 0x40,		// May follow "operator(": IdChar, '*' or '&'
+};
+
+struct CharTable {
+	unsigned char	m_a[256];
+
+	constexpr unsigned char operator[]( char ch ) const {
+		return m_a[(unsigned char)ch];
+	}
+};
+
+static constexpr CharTable makeCharClasses()
+{
+	CharTable t = {};
+
+	for (int ch=0; ch<256; ch++) {
+		unsigned char b = kOther;
+		switch (ch) {
+		case ' ': case '\t': case '\f': case '\v':	b = kBlank;		break;
+		case '\n': case '\r':						b = kNewline;	break;
+		case '*':								b = kStar;		break;
+		case '/':								b = kSlash;		break;
+		}
+
+		bool isLetter = (ch>='A' && ch<='Z') || (ch>='a' && ch<='z');
+		bool isDigit = ch>='0' && ch<='9';
+		if (isLetter || ch=='_' || ch=='~')
+			b |= IdStart;
+		if (isLetter || isDigit || ch=='_')
+			b |= IdChar | CastChar;
+		if (ch=='*' || ch=='&')
+			b |= CastChar;
+		for (const char* pch=scOpSyms; *pch; pch++) {
+			if (*pch==ch)
+				b |= OpSym;
+		}
+		t.m_a[ch] = b;
+	}
+	return t;
+}
+static constexpr CharTable s_charClasses = makeCharClasses();
+
+// The second character of the double symbols "* /", "::" and "()"
+static constexpr CharTable makeSecondChars()
+{
+	CharTable t = {};
+
+	t.m_a[(unsigned char)'*'] = '/';
+	t.m_a[(unsigned char)':'] = ':';
+	t.m_a[(unsigned char)'('] = ')';
+	return t;
+}
+static constexpr CharTable s_secondChars = makeSecondChars();
+
+// Skipping before a token.  After a newline, the stars and slashes of
+// comment decoration are skipped too, but not the '*' of a "* /".
+enum SkipState {sStart, sLeading, sToken, sStarCheck};
+static constexpr unsigned char s_aaSkip[2][cSkipClasses] = {
+	//	kBlank		kNewline	kStar		kSlash		kOther
+	{	sStart,		sLeading,	sToken,		sToken,		sToken	},	// sStart
+	{	sLeading,	sLeading,	sStarCheck,	sLeading,	sToken	},	// sLeading
+};
+
+static_assert( (s_charClasses['~'] & (IdStart|IdChar))==IdStart,
+               "'~' only starts an identifier" );
+static_assert( (s_charClasses['*'] & SkipMask)==kStar
+               && (s_charClasses['*'] & (OpSym|CastChar))==(OpSym|CastChar),
+               "'*' is skipped, an operator symbol and part of a cast" );
+static_assert( s_charClasses['\xE9']==kOther, "bytes above 127 are not letters" );
+
+static AllocStats::Site s_siteReadAll( "LexStream::readAll", AllocStats::oOther );
+static AllocStats::Site s_siteGetToken( "LexStream::getToken", AllocStats::oToken );
+static AllocStats::Site s_siteAttributeText( "LexStream::getAttributeText", AllocStats::oToken );
+static AllocStats::Site s_sitePrototype( "LexStream::getPrototype", AllocStats::oToken );
 
 ///////////////////////////////////////////////////////////////////////////////
 /*: class Token
@@ -38,16 +131,28 @@ void
 Token::clear()
 {
 	m_ttType = NullToken;
-	m_sToken = "";
+	m_sToken.clear();
 }
 
 /*: routine Token::value		Returns pointer to string containing token value	*/
-const String&
+std::string_view
 Token::value() const
 {
 	return m_sToken;
 }
 
+/*: routine Token::take
+
+	Moves the token value out, leaving the token empty.  Used to hand
+	long text to a DocItem without copying it.
+*/
+std::string
+Token::take()
+{
+	m_ttType = NullToken;
+	return std::move( m_sToken );
+}
+
 /*: routine Token::type			Returns type of token	*/
 Token::TokenType
 Token::type() const
@@ -68,33 +173,119 @@ Token::type() const
 /*: routine LexStream::LexStream #ctor1
 	Opens file for Lexical scanning.
 
+	The whole file is read into memory when the LexStream is created.
+	Attribute text is left in that copy (see SourceText), which lasts
+	as long as the text does, unless the text is a small part of it
+	(see endParse()).
+
 	Throws: if file does not exist
 */
 LexStream::LexStream( const char* fileName )
-	:	m_fileInput( 0 ),
-	    // m_isCallerOwned( false ),
-	    m_isPeeked( false )
+	:	m_sName( fileName ),
+	    m_pBegin( 0 ),
+	    m_pNext( 0 ),
+	    m_pEnd( 0 ),
+	    m_isEof( false ),
+	    m_pStartSymbol( 0 ),
+	    m_pCounted( 0 ),
+	    m_pLineBegin( 0 ),
+	    m_nLine( 1 ),
+	    m_nBeginColumn( 1 )
 {
-	m_fileInput = new std::ifstream( fileName, std::ios_base::in /* | std::ios_base::nocreate | ios::binary*/ );
-	if (!m_fileInput->is_open())
+	std::ifstream fInput( fileName, std::ios_base::in | std::ios_base::binary );
+	if (!fInput.is_open())
 		throw BFileException( BFileException::FileNotFound );
+	readAll( fInput );
 }
 
 /*: routine LexStream::LexStream #ctor2
 
-	Opens token stream on existing istream.
+	Opens token stream on existing istream.  sourceName is used in
+	diagnostics.
 
-	Requires: fInput is an open istream positioned for reading, no other code should manipulate
-			'fInput' until the LexStream is deleted.  Caller must close/delete the stream after use.
+	Requires: fInput is an open istream positioned for reading.  The rest
+			of the stream is read when the LexStream is created, so the caller
+			may close/delete the stream as soon as the constructor returns.
 */
 LexStream::LexStream
 (
-    std::ifstream& fInput
+    std::istream& fInput,
+    const char* sourceName
 )
-	:	// m_isCallerOwned( true ),
-	    m_isPeeked( false )
+	:	m_sName( sourceName ),
+	    m_pBegin( 0 ),
+	    m_pNext( 0 ),
+	    m_pEnd( 0 ),
+	    m_isEof( false ),
+	    m_pStartSymbol( 0 ),
+	    m_pCounted( 0 ),
+	    m_pLineBegin( 0 ),
+	    m_nLine( 1 ),
+	    m_nBeginColumn( 1 )
 {
-	m_fileInput = &fInput;
+	readAll( fInput );
+}
+
+/*: routine LexStream::LexStream #ctor3
+
+	Opens token stream on a buffer in memory.  sourceName is used in
+	diagnostics.
+
+	Requires: pData points to cbData characters that remain valid and
+			unchanged until the LexStream is deleted.  The buffer is scanned
+			in place, it is not copied.
+*/
+LexStream::LexStream
+(
+    const char* pData,
+    size_t cbData,
+    const char* sourceName
+)
+	:	m_sName( sourceName ),
+	    m_pBegin( pData ),
+	    m_pNext( pData ),
+	    m_pEnd( pData+cbData ),
+	    m_isEof( false ),
+	    m_pStartSymbol( pData ),
+	    m_pCounted( pData ),
+	    m_pLineBegin( pData ),
+	    m_nLine( 1 ),
+	    m_nBeginColumn( 1 )
+{
+}
+
+/*	LexStream::readAll -- internal routine copies the rest of the stream
+			into m_pSource and sets up the scanning pointers.
+*/
+void LexStream::readAll( std::istream& fInput )
+{
+	AllocStats::Scope allocs( s_siteReadAll );
+	char buf[65536];
+
+	m_pSource = std::make_shared<SourceBuffer>();
+	std::string& sData = m_pSource->m_sData;
+
+	// Attribute text may be left in the buffer until output, so size it
+	// to the input where that is known, rather than grow it by doubling
+	std::streampos posBegin = fInput.tellg();
+	if (posBegin!=std::streampos( -1 )) {
+		fInput.seekg( 0, std::ios_base::end );
+		std::streampos posEnd = fInput.tellg();
+		fInput.seekg( posBegin );
+		if (posEnd>posBegin)
+			sData.reserve( size_t( posEnd-posBegin ) );
+		fInput.clear();
+	}
+
+	while (fInput.read( buf, sizeof(buf) ) || fInput.gcount()>0) {
+		sData.append( buf, fInput.gcount() );
+	}
+	if (fInput.bad())
+		throw BFileException( BFileException::SystemError );
+
+	m_pBegin = m_pNext = sData.data();
+	m_pEnd = m_pNext + sData.size();
+	m_pStartSymbol = m_pCounted = m_pLineBegin = m_pNext;
 }
 
 
@@ -105,27 +296,32 @@ LexStream::LexStream
 */
 void LexStream::getStartSymbol( Token& tok )
 {
-	bwassert( m_fileInput );
-
-	// Since this routine is called after bailing out from a syntax
-	// error, we'll start by clearing the peek buffer.
-	m_isPeeked = false;
-	m_tokPeekBuffer.clear();
-
-	// Get there
-	while( m_fileInput->eof()==0 ) {
-		if (m_fileInput->get()=='/') {
-			if (m_fileInput->peek()=='*') {		// allows " / / * : "
-				m_fileInput->get();
-				if (m_fileInput->get()==':')
+	bwassert( m_pNext<=m_pEnd );
+
+	// Get there.  memchr skips the text between slashes a word or
+	// vector at a time.
+	while( !eof() ) {
+		const char* pSlash = (const char*)memchr( m_pNext, '/', m_pEnd-m_pNext );
+		if (pSlash==0) {
+			m_pNext = m_pEnd;
+			get();					// Sets eof
+			break;
+		}
+		m_pNext = pSlash;
+		if (get()=='/') {
+			if (peek()=='*') {		// allows " / / * : "
+				get();
+				if (get()==':') {
+					m_pStartSymbol = m_pNext-3;
 					break;
+				}
 			}
 		}
 	}
 
 	tok.clear();
 
-	if (m_fileInput->eof()) {
+	if (eof()) {
 		tok.m_ttType = Token::EndOfFile;
 	} else {
 		tok.m_ttType = Token::Symbol;
@@ -156,263 +352,274 @@ LexStream::getToken
     Token& tok
 )
 {
-	// Check the peek buffer first
-	if (m_isPeeked) {
-		m_isPeeked = false;
-		tok = m_tokPeekBuffer;
-		return;
+	AllocStats::Scope allocs( s_siteGetToken );
+	BlockToken bt;
+
+	tok.clear();
+	m_pNext = scanToken( m_pNext, bt );
+	if (bt.m_fFlags & BlockToken::fEof)
+		m_isEof = true;
+	tok.m_ttType = bt.m_ttType;
+	if (bt.m_ttType!=Token::EndOfFile)
+		assignText( tok, m_pBegin+bt.m_iOffset, m_pNext );
+}
+
+/*: routine LexStream::appendToken
+
+	Scans the token after the last one in vTokens, or the next one in
+	the stream if vTokens is empty, and adds it to vTokens.  The stream
+	does not move, so a parser can look as far into a doc block as it
+	needs, without copying any text, and then skipPast() the last token
+	it used.
+*/
+void LexStream::appendToken( std::vector<BlockToken>& vTokens ) const
+{
+	const char* p = m_pNext;
+	BlockToken bt;
+
+	if (!vTokens.empty()) {
+		const BlockToken& btLast = vTokens.back();
+		p = m_pBegin + btLast.m_iOffset + btLast.m_cch;
 	}
+	scanToken( p, bt );
 
+	// A scope symbol "::" only continues a name on the same line
+	const char* pText = m_pBegin + bt.m_iOffset;
+	while (p<pText && (*p==' ' || *p=='\t'))
+		p++;
+	if (p==pText)
+		bt.m_fFlags |= BlockToken::fSameLine;
 
-	// No luck, I guess I'll have to do it.
+	vTokens.push_back( bt );
+}
 
-	char ch;
-	char ch2;
+/*: routine LexStream::skipPast
 
-	tok.clear();
+	Moves the stream to just after bt, a token from appendToken(), as
+	if every token up to it had been read by getToken().
+*/
+void LexStream::skipPast( const BlockToken& bt )
+{
+	m_pNext = m_pBegin + bt.m_iOffset + bt.m_cch;
+	if (bt.m_fFlags & BlockToken::fEof)
+		m_isEof = true;
+}
 
-	// Get a significant character
-	bool isSignificant = false;
-	bool inLeadingWhitespace = false;
-	while (!isSignificant) {
-		ch = m_fileInput->get();
-		switch (ch) {
-		case ' ':
-		case '\t':
-		case '\f':
-		case '\v':
-			break;			// Whitespace ignored
-		case '\n':
-		case '\r':
-			inLeadingWhitespace = true;
-			break;
+/*	LexStream::scanToken -- internal routine scans the token at or after
+			p into bt, and returns where the scan of the next token starts.
 
-		case '*':
-			ch2 = m_fileInput->peek();
-			if (inLeadingWhitespace && ch2!='/')
-				break;					// Stars ignored in leading whitespace
-			isSignificant = true;		// but not / *
-			break;
+	The buffer is scanned in place.  Each byte is classified by one
+	lookup in s_charClasses, and the whitespace and comment decoration
+	before a token are skipped by the s_aaSkip state table.
+*/
+const char* LexStream::scanToken( const char* p, BlockToken& bt ) const
+{
+	bt.m_fFlags = 0;
 
-		case '/':
-			if (inLeadingWhitespace)
+	// Get a significant character
+	int state = sStart;
+	while (p<m_pEnd) {
+		state = s_aaSkip[state][s_charClasses[*p] & SkipMask];
+		if (state==sToken)
+			break;
+		if (state==sStarCheck) {
+			if (p+1<m_pEnd && p[1]=='/')
 				break;
-			// otherwise fall through
-
-		default:
-			isSignificant = true;
+			state = sLeading;
 		}
+		p++;
 	}
 
-	if (m_fileInput->eof()) {
-		tok.m_ttType = Token::EndOfFile;
-		return;
+	// The character scan this replaces looked past a '*' for a '/', so
+	// a '*' at the very end is also the end of file
+	if (p==m_pEnd || (*p=='*' && p+1==m_pEnd)) {
+		bt.m_ttType = Token::EndOfFile;
+		bt.m_fFlags = BlockToken::fEof;
+		bt.m_iOffset = m_pEnd-m_pBegin;
+		bt.m_cch = 0;
+		return m_pEnd;
 	}
 
-	// Start to assemble output token
-	tok.m_sToken = ch;
-	ch2 = m_fileInput->peek();
+	char ch = *p;
+	const char* pBegin = p++;
+	if (p==m_pEnd)
+		bt.m_fFlags |= BlockToken::fEof;
 
 	// Is it some kind of Identifier ?
-	if (ch=='_' || ch=='~' || isalpha(ch) ) {
-		// Yes
-		tok.m_ttType = Token::Identifier;
-		while (ch2=='_' || isalnum(ch2)) {
-			tok.m_sToken.append( m_fileInput->get() );
-			ch2 = m_fileInput->peek();
-		}
-
-		// We now have a basic Identifier,  there are a few special cases
-		//if (inLeadingWhitespace && ch==':')
-		//{
-		//	// It's Keyword
-		//	tok.m_ttType = Keyword;
-		//	m_fileInput->get();
-		//}
-
-		if (tok.m_sToken == "operator") {
+	if (s_charClasses[ch] & IdStart) {
+		bt.m_ttType = Token::Identifier;
+		while (p<m_pEnd && (s_charClasses[*p] & IdChar))
+			p++;
+		if (p==m_pEnd)
+			bt.m_fFlags |= BlockToken::fEof;
+
+		if (p-pBegin==8 && memcmp( pBegin, "operator", 8 )==0) {
 			// It's a operator FunctionIdentifier
-			if (ch2=='(') {
+			if (p<m_pEnd && *p=='(') {
 				// for a cast or an operator()
-				do {
-					tok.m_sToken.append( m_fileInput->get() );
-					ch2 = m_fileInput->peek();
-				} while (ch2=='_' || isalnum(ch2) || ch2=='*' || ch2=='&');
-
-				if (ch2==')') {
-					tok.m_sToken.append( m_fileInput->get() );
-				}
+				p++;
+				while (p<m_pEnd && (s_charClasses[*p] & CastChar))
+					p++;
+				if (p==m_pEnd)
+					bt.m_fFlags |= BlockToken::fEof;
+				else if (*p==')')
+					p++;
 			} else {
 				// with operator symbols
-				while ( scOpSyms.indexOf(ch2)>=0 ) {
-					tok.m_sToken.append( m_fileInput->get() );
-					ch2 = m_fileInput->peek();
-				}
+				while (p<m_pEnd && (s_charClasses[*p] & OpSym))
+					p++;
+				if (p==m_pEnd)
+					bt.m_fFlags |= BlockToken::fEof;
 			}
 		}
-		return;
-	}
-
-	// Must be some kind of Symbol
-	tok.m_ttType = Token::Symbol;
-
-	// Check for double symbols
-	switch (ch) {
-	case '*':
-		if (ch2=='/') {
-			tok.m_sToken.append( m_fileInput->get() );
-		}
-		break;
-
-	case ':':
-		if (ch2==':') {
-			tok.m_sToken.append( m_fileInput->get() );
-		}
-		break;
-
-	case '(':
-		if (ch2==')') {
-			tok.m_sToken.append( m_fileInput->get() );
-		}
-		break;
+	} else {
+		// Must be some kind of Symbol, perhaps a double one
+		bt.m_ttType = Token::Symbol;
+		if (p<m_pEnd && s_secondChars[ch]!=0 && *p==s_secondChars[ch])
+			p++;
 	}
-	return;
-}
-
-/*: routine LexStream::peekToken
 
-	Returns the next token in the input stream without advancing the stream.
-*/
-void LexStream::peekToken( Token& tok )
-{
-	if (!m_isPeeked) {
-		getToken( m_tokPeekBuffer );
-		m_isPeeked = true;
-	}
-	tok = m_tokPeekBuffer;
+	bt.m_iOffset = pBegin-m_pBegin;
+	bt.m_cch = p-pBegin;
+	return p;
 }
 
+/*	scanText -- internal routine scans attribute text from p, which is
+			in the input from pBegin to pEnd, starting within a line if
+			isCopying.  The text is appended to *psText, unless psText is 0.
+			Returns where the scan stopped, with btEnd set to what ended
+			the text (see LexStream::getAttributeText()) and isEof set if
+			the scan reached the end of the input.
 
-
-/*: routine LexStream::getAttributeText
-
-	Returns all characters up to, but not including next Keyword,
-	EndSymbol, or EOF.
+	The text is all characters up to, but not including the next Keyword,
+	EndSymbol, "/ * :" or EOF, without the whitespace and comment
+	decoration at the start of each line.
 */
-void LexStream::getAttributeText( Token& tok )
+static const char* scanText
+(
+    const char* pBegin,
+    const char* p,
+    const char* pEnd,
+    bool isCopying,
+    std::string* psText,
+    BlockToken& btEnd,
+    bool& isEof
+)
 {
 	char ch;
 	char ch2;
 
 	enum {Copying, LeadingWhitespace, CheckingForKeyword, Finished} state;
 
-	tok.clear();
-	state = LeadingWhitespace;
-	ch = m_fileInput->peek();
-	if( m_isPeeked ) {
-		switch (m_tokPeekBuffer.type()) {
-		case Token::Identifier:
-			if ( ch==':' ) {
-				// This is already the keyword we're looking for
-				ch = m_fileInput->get();		// Eat :
-				ch = m_fileInput->peek();
-				if (ch!=':')
-					return;			// return NullToken and don't advance
-				else
-					m_tokPeekBuffer.m_sToken.append(':');		// We read this
-			}
-			break;
-
-		case Token::EndOfFile:
-			tok = m_tokPeekBuffer;
-			return;				// return end of file
+	state = isCopying ? Copying : LeadingWhitespace;
 
-		case Token::Symbol:
-			if (m_tokPeekBuffer.m_sToken == "*" ||
-			        m_tokPeekBuffer.m_sToken == "/" ) {
-				m_isPeeked = false;		// Ignore in leading whitespace
-				break;
-			}
-			if (m_tokPeekBuffer.m_sToken == "*/") {
-				return;					// Were at the end, return NullToken
-			}
+	// A possible keyword is left in the input, from pWord, until we
+	// know if it is one.
+	const char* pWord = 0;
 
-		default:
-			// Otherwise fall through to start the output
-			;
+	while (state!=Finished) {
+		if (state==Copying) {
+			// Most text is copied up to the end of the line, a character
+			// that can end the text, or the last character of the input
+			const char* pRun = p;
+			while (p+1<pEnd && (s_charClasses[*p] & SkipMask)!=kNewline && *p!='*' && *p!='/')
+				p++;
+			if (psText)
+				psText->append( pRun, p );
 		}
 
-		if (m_isPeeked) {		// Still?
-			// The peek buffer contains the start of the AttributeText
-			tok = m_tokPeekBuffer;
-			m_isPeeked = false;
-			state = Copying;
+		const char* pCh = p;
+		if (p<pEnd) {
+			ch = *p++;
+		} else {
+			ch = (char)EOF;
+			isEof = true;
+		}
+		if (p<pEnd) {
+			ch2 = *p;
+		} else {
+			ch2 = (char)EOF;
+			isEof = true;
 		}
 
-	}
-
-	tok.m_ttType = Token::Text;
-	m_tokPeekBuffer.clear();
-
-	while (state!=Finished) {
-		ch = m_fileInput->get();
-		ch2 = m_fileInput->peek();
+		// A "/ * :" starts the next doc block, so this one's "* /" is
+		// missing.  It ends the text, and is left to be read again.
+		if (ch=='/' && ch2=='*' && pEnd-p>=2 && p[1]==':') {
+			if (state==CheckingForKeyword && psText)
+				psText->append( pWord, pCh );
+			btEnd.m_ttType = Token::Symbol;
+			btEnd.m_fFlags = 0;
+			btEnd.m_iOffset = pCh-pBegin;
+			btEnd.m_cch = 3;
+			return pCh;
+		}
 
 		// Handle end of comment (since it's nearly the same in all states)
-		if (m_fileInput->eof() || (ch=='*' && ch2=='/')) {
-			if (state==CheckingForKeyword) {
-				tok.m_sToken.append( m_tokPeekBuffer.m_sToken );
+		if (isEof || (ch=='*' && ch2=='/')) {
+			if (state==CheckingForKeyword && psText) {
+				psText->append( pWord, pCh );
+			}
+			btEnd.m_ttType = Token::Symbol;
+			if (isEof) {
+				btEnd.m_fFlags = BlockToken::fEof;
+				btEnd.m_iOffset = pEnd-pBegin;
+				btEnd.m_cch = 0;
+			} else {
+				p++;		// Eat "/"
+				btEnd.m_fFlags = 0;
+				btEnd.m_iOffset = pCh-pBegin;
+				btEnd.m_cch = 2;
 			}
-			m_tokPeekBuffer.m_sToken = "*/";
-			m_tokPeekBuffer.m_ttType = Token::Symbol;
-			ch = m_fileInput->get();		// Eat "/"
-			m_isPeeked = true;
 			state = Finished;
 		}
 
 		switch (state) {
 		case Copying:
-			tok.m_sToken.append( ch );
+			if (psText)
+				*psText += ch;
 			if (ch == '\r' || ch=='\n')
 				state = LeadingWhitespace;
 			break;
 
 		case LeadingWhitespace:
-			if ( scWhiteSpace.indexOf(ch)>=0 )
+			if ( ch!='\0' && strchr( scWhiteSpace, ch ) )
 				break;
 			if (ch=='\r' || ch=='\n') {
-				tok.m_sToken.append( ch );
+				if (psText)
+					*psText += ch;
 				break;
 			}
 			// Otherwise fall through to CheckingForKeyword
 			state = CheckingForKeyword;
+			pWord = pCh;
 
 		case CheckingForKeyword:
-			m_tokPeekBuffer.m_sToken.append(ch);
 			if ( ch2=='_' || isalnum(ch2) )
 				break;			// Still in Identifier
 			if (ch2==':') {
 				// It may be a keyword
-				ch = m_fileInput->get();
-				ch2 = m_fileInput->peek();
-				if (ch2==':') {
+				p++;
+				if (p<pEnd && *p==':') {
 					// No, it's a ::
-					tok.m_sToken.append( m_tokPeekBuffer.m_sToken );
-					m_tokPeekBuffer.clear();
+					if (psText)
+						psText->append( pWord, p );
 					state = Copying;
-					tok.m_sToken.append(ch);
 					break;
 				} else {
-					m_tokPeekBuffer.m_ttType = Token::Identifier;
-					m_isPeeked = true;
+					if (p==pEnd)
+						isEof = true;
+					btEnd.m_ttType = Token::Identifier;
+					btEnd.m_fFlags = 0;
+					btEnd.m_iOffset = pWord-pBegin;
+					btEnd.m_cch = pCh+1-pWord;
 					state = Finished;
 					break;
 				}
 			}
 			// Otherwise, it's the end of the Identifier without a ':'
 			// so it's just part of the AttributeText
-			tok.m_sToken.append( m_tokPeekBuffer.m_sToken );
-			m_tokPeekBuffer.clear();
+			if (psText)
+				psText->append( pWord, pCh+1 );
 			state = Copying;
 			break;
 
@@ -420,7 +627,264 @@ void LexStream::getAttributeText( Token& tok )
 			break;
 		}
 	}
-	return;
+	return p;
+}
+
+/*: routine LexStream::getAttributeText
+
+	Reads the text of an attribute, all characters up to, but not
+	including next Keyword, EndSymbol, or EOF.  Returns false if there
+	is no text, as the block ends at once.
+
+	btEnd is set to what ended the text: the keyword as an Identifier,
+	whose ':' has been read, or the EndSymbol as a Symbol.  The end of
+	file ends the text as an EndSymbol too.  So does the "/ * :" of the
+	next doc block, when this one's EndSymbol is missing: btEnd is then
+	that Symbol, which is left to be read again.
+
+	If pbtFirst is given the text starts with it, and it must be the
+	last token passed to skipPast().  It may end the text at once:
+	btEnd is then the token, if it is a keyword, the EndSymbol or the
+	end of file.
+
+	Text read from a file or stream is left in the input, which text
+	keeps, and is only made when its value is asked for.  Text in a
+	caller's buffer is made now, since the buffer may not last.
+*/
+bool LexStream::getAttributeText( SourceText& text, BlockToken& btEnd, const BlockToken* pbtFirst )
+{
+	AllocStats::Scope allocs( s_siteAttributeText );
+	const char* pText = m_pNext;
+	bool isCopying = false;
+
+	text = SourceText();
+	int ch = peek();
+	if (pbtFirst) {
+		bool isStart = true;
+
+		// The header may run into the next doc block, when its "* /"
+		// is missing.  Its "/ *" may have been skipped as decoration.
+		const char* pFirst = m_pBegin+pbtFirst->m_iOffset;
+		if (pFirst-m_pBegin>=2 && isBlockStart( pFirst-2 ))
+			pFirst -= 2;
+		if (pbtFirst->m_ttType==Token::Symbol && isBlockStart( pFirst )) {
+			btEnd.m_ttType = Token::Symbol;
+			btEnd.m_fFlags = 0;
+			btEnd.m_iOffset = pFirst-m_pBegin;
+			btEnd.m_cch = 3;
+			m_pNext = pFirst;
+			return false;
+		}
+
+		switch (pbtFirst->m_ttType) {
+		case Token::Identifier:
+			if ( ch==':' ) {
+				// This is already the keyword we're looking for
+				get();			// Eat :
+				if (peek()!=':') {
+					btEnd = *pbtFirst;
+					return false;
+				}
+				// Otherwise the ':' read is part of the text
+			}
+			break;
+
+		case Token::EndOfFile:
+			btEnd = *pbtFirst;
+			return false;
+
+		case Token::Symbol:
+			if (value( *pbtFirst )=="*" || value( *pbtFirst )=="/") {
+				isStart = false;		// Ignore in leading whitespace
+				break;
+			}
+			if (value( *pbtFirst )=="*/") {
+				btEnd = *pbtFirst;
+				return false;			// Were at the end
+			}
+			break;
+
+		default:
+			;
+		}
+
+		if (isStart) {
+			// The token is the start of the AttributeText
+			pText = m_pBegin+pbtFirst->m_iOffset;
+			isCopying = true;
+		}
+	}
+
+	const char* pScan = m_pNext;
+	std::string* psText = 0;
+	if (isLeavingText()) {
+		text.m_pSource = m_pSource;
+		text.m_iBegin = pText-m_pBegin;
+		text.m_iScan = pScan-m_pBegin;
+		text.m_isCopying = isCopying;
+	} else {
+		text.m_sText.assign( pText, pScan );
+		psText = &text.m_sText;
+	}
+
+	bool isEof = false;
+	m_pNext = scanText( m_pBegin, pScan, m_pEnd, isCopying, psText, btEnd, isEof );
+	if (isEof)
+		m_isEof = true;
+	text.m_iEnd = m_pNext-m_pBegin;
+	if (text.m_pSource)
+		m_vLeft.push_back( text );
+	return true;
+}
+
+/*: routine LexStream::endParse
+
+	Ends the parse of the input; nothing more may be read.  Text left
+	in the input keeps all of the input alive, which costs more than
+	making the text when it is a small part of the input, as in a source
+	file with short comments.  Then the text left by the parse is made
+	now and the input is dropped; each SourceText finds its text by
+	where its scan started.
+*/
+void LexStream::endParse()
+{
+	enum {MadeOverhead=32};		// Heap block of a made text, roughly
+	size_t cbMade = 0;
+
+	for (size_t i=0; i<m_vLeft.size(); i++)
+		cbMade += m_vLeft[i].m_iEnd - m_vLeft[i].m_iBegin + sizeof(SourceBuffer::Made) + MadeOverhead;
+	if (!m_vLeft.empty() && cbMade<m_pSource->m_sData.size()) {
+		std::vector<SourceBuffer::Made> vMade;
+		vMade.reserve( m_vLeft.size() );
+		for (size_t i=0; i<m_vLeft.size(); i++) {
+			std::string sText;
+			m_vLeft[i].value( sText );
+			vMade.push_back( SourceBuffer::Made{ m_vLeft[i].m_iScan, std::move( sText ) } );
+		}
+		std::sort( vMade.begin(), vMade.end(),
+		           []( const SourceBuffer::Made& a, const SourceBuffer::Made& b ) {
+		               return a.m_iScan<b.m_iScan;
+		           } );
+		m_pSource->m_vMade = std::move( vMade );
+		std::string().swap( m_pSource->m_sData );
+	}
+	std::vector<SourceText>().swap( m_vLeft );
+
+	m_pBegin = m_pNext = m_pEnd = m_pStartSymbol = m_pCounted = m_pLineBegin = 0;
+	m_isEof = true;
+}
+
+/*: routine SourceText::value
+
+	Returns the text.  Text left in the input is made in sBuffer, so the
+	result is valid until sBuffer is changed.  Text is made with the
+	same scan that read it, from where that started.  If the input was
+	dropped, the text made then is returned.
+*/
+std::string_view SourceText::value( std::string& sBuffer ) const
+{
+	if (!m_pSource)
+		return m_sText;
+
+	const std::vector<SourceBuffer::Made>& vMade = m_pSource->m_vMade;
+	if (!vMade.empty()) {
+		std::vector<SourceBuffer::Made>::const_iterator it = std::lower_bound(
+			vMade.begin(), vMade.end(), m_iScan,
+			[]( const SourceBuffer::Made& made, unsigned iScan ) {
+				return made.m_iScan<iScan;
+			} );
+		bwassert( it!=vMade.end() && it->m_iScan==m_iScan );
+		return it->m_sText;
+	}
+
+	const char* pBegin = m_pSource->m_sData.data();
+	BlockToken btEnd;
+	bool isEof = false;
+
+	sBuffer.reserve( m_iEnd-m_iBegin );
+	sBuffer.assign( pBegin+m_iBegin, pBegin+m_iScan );
+	scanText( pBegin, pBegin+m_iScan, pBegin+m_pSource->m_sData.size(), m_isCopying, &sBuffer, btEnd, isEof );
+	return sBuffer;
+}
+
+
+/*	Helpers for getPrototype */
+
+// Character classes used by the prototype scanner
+enum {
+	ccOther		= 0,
+	ccSpace		= 1,		// Collapsed to a single space
+	ccIdent		= 2,		// Part of an identifier
+	ccSpecial	= 4			// Nests, terminates, or starts a comment or literal
+};
+
+static struct PrototypeClasses {
+	unsigned char	m_ac[256];
+
+	PrototypeClasses() {
+		for (int ch=0; ch<256; ch++)
+			m_ac[ch] = (ch=='_' || isalnum( ch )) ? ccIdent : ccOther;
+		for (const char* pch=" \t\n\r\f\v"; *pch; pch++)
+			m_ac[(unsigned char)*pch] = ccSpace;
+		for (const char* pch="/\"'()<>-{};:"; *pch; pch++)
+			m_ac[(unsigned char)*pch] = ccSpecial;
+	}
+	int operator[]( char ch ) const {
+		return m_ac[(unsigned char)ch];
+	}
+} s_ccProto;
+
+static inline bool isIdentChar( char ch )
+{
+	return s_ccProto[ch]==ccIdent;
+}
+
+static inline bool isSpaceChar( char ch )
+{
+	return s_ccProto[ch]==ccSpace;
+}
+
+// True if the ' at p is a digit separator, eg: 1'000, rather than the
+// start of a character literal.  It follows a digit or identifier
+// character, unless those are an encoding prefix, eg: L'x' or u8'x'.
+static bool isDigitSeparator( const char* pBegin, const char* p )
+{
+	const char* pIdent = p;
+	while (pIdent>pBegin && isIdentChar( pIdent[-1] ))
+		--pIdent;
+	if (pIdent==p)
+		return false;
+	std::string_view sPrefix( pIdent, p-pIdent );
+	return sPrefix!="L" && sPrefix!="u" && sPrefix!="U" && sPrefix!="u8";
+}
+
+// Returns the end of the string or character literal whose opening
+// quote is at p.  An unterminated literal ends before an unescaped
+// newline or the start of the next doc block, so a stray quote can't
+// swallow the rest of the file.
+static const char* skipLiteral( const char* p, const char* pEnd )
+{
+	char chQuote = *p;
+	for (++p; p<pEnd && *p!=chQuote && *p!='\n'; ++p) {
+		if (*p=='\\' && p+1<pEnd)
+			++p;
+		else if (*p=='/' && pEnd-p>=3 && p[1]=='*' && p[2]==':')
+			return p;
+	}
+	return p<pEnd && *p==chQuote ? p+1 : p;
+}
+
+// Appends the run pBegin..pEnd to sText, preceded by a single space
+// for any whitespace skipped before it.  A space ending the run is held
+// back in the same way, so it is dropped at the end of the prototype.
+static inline void appendRun( std::string& sText, bool& isSpace, const char* pBegin, const char* pEnd )
+{
+	if (pBegin==pEnd)
+		return;
+	if (isSpace && !sText.empty())
+		sText += ' ';
+	isSpace = pEnd[-1]==' ';
+	sText.append( pBegin, isSpace ? pEnd-1 : pEnd );
 }
 
 
@@ -428,49 +892,295 @@ void LexStream::getAttributeText( Token& tok )
 
 	Get function prototype following comment block.
 
-	This gets all characters until the next ';', ':', EndOfFile or '{',
-	but it's not terminated by '::'.
+	This gets all characters until the next ';', ':', EndOfFile or '{'
+	that is not nested in (), <> or {}.  So default arguments with braces,
+	template arguments and "::" are kept, and a constructor prototype
+	stops before its initializer list.  The prototype also stops before
+	the start of another doc block, even inside an unterminated string
+	or character literal, which otherwise ends at the end of its line.
+	A quote after a digit, eg: 1'000, is a digit separator.
+
+	Comments are dropped and each run of whitespace becomes a single
+	space, giving a normalized signature.  The text between whitespace
+	is copied from the input buffer a run at a time.
 */
 void LexStream::getPrototype( Token& tok )
 {
-	char ch;
+	AllocStats::Scope allocs( s_sitePrototype );
+	enum {MaxNesting=64};
+	int aAngles[MaxNesting];		// Angle depth outside each open '('
+	int nParen = 0;
+	int nAngle = 0;					// Open '<' at this paren level
+	int nBrace = 0;					// Open '{' inside the prototype
+	bool isSpace = false;			// Whitespace skipped, not yet output
+	bool isFinished = false;
+	std::string sText;
+	const char* p = m_pNext;
+	const char* pRun = p;			// Text not yet copied to sText
 
 	tok.clear();
-	bool isFinished = false;
-	while (!isFinished) {
-		ch = m_fileInput->peek();
-		if (m_fileInput->eof()) {
-			isFinished = true;
+	while (p<m_pEnd && !isFinished) {
+		// Plain text, including single spaces between words, stays in
+		// the current run.  This loop is where most of the time goes.
+		while (p<m_pEnd) {
+			int cc = s_ccProto[*p];
+			if (cc==ccOther) {
+				++p;
+			} else if (cc==ccIdent) {
+				if (*p=='o' && m_pEnd-p>=8 && memcmp( p, "operator", 8 )==0 &&
+				        (p+8==m_pEnd || !isIdentChar( p[8] )))
+					break;
+				do {
+					++p;
+				} while (p<m_pEnd && isIdentChar( *p ));
+			} else if (*p==' ' && p>pRun && p+1<m_pEnd && !isSpaceChar( p[1] )) {
+				++p;
+			} else
+				break;
+		}
+		if (p==m_pEnd)
 			break;
+
+		char ch = *p;
+
+		if (isSpaceChar( ch )) {
+			appendRun( sText, isSpace, pRun, p );
+			while (p<m_pEnd && isSpaceChar( *p ))
+				++p;
+			isSpace = true;
+			pRun = p;
+			continue;
+		}
+
+		if (isIdentChar( ch )) {
+			// "operator": its symbols are part of its name, so they are
+			// not nested and any space before them is dropped.
+			p += 8;
+			appendRun( sText, isSpace, pRun, p );
+			pRun = p;
+			while (p<m_pEnd && isSpaceChar( *p ))
+				++p;
+			const char* pSym = p;
+			if (p+1<m_pEnd && p[0]=='(' && p[1]==')')
+				p += 2;
+			else
+				while (p<m_pEnd && *p!='\0' && strchr( "+-*/%^&|~!=<>[],", *p ))
+					++p;
+			if (p!=pSym) {
+				sText.append( pSym, p );
+			} else {
+				isSpace = pSym!=pRun;		// Conversion, eg: operator char*
+			}
+			pRun = p;
+			continue;
 		}
 
 		switch (ch) {
-		case ':':
-			m_fileInput->get();
-			ch = m_fileInput->peek();
-			if (ch==':') {
-				tok.m_sToken.append( "::" );
-				tok.m_ttType = Token::Text;
-				m_fileInput->get();
-			} else
-				isFinished = true;
+		case '/':
+			if (p+1<m_pEnd && (p[1]=='/' || p[1]=='*')) {
+				appendRun( sText, isSpace, pRun, p );
+				if (p[1]=='/') {
+					// Line comment
+					p = (const char*)memchr( p, '\n', m_pEnd-p );
+					if (p==0)
+						p = m_pEnd;
+				} else if (p+2<m_pEnd && p[2]==':') {
+					isFinished = true;		// Next doc block
+				} else {
+					// Block comment
+					for (p += 2; p<m_pEnd; ++p) {
+						p = (const char*)memchr( p, '*', m_pEnd-p );
+						if (p==0 || p+1==m_pEnd) {
+							p = m_pEnd;
+							break;
+						}
+						if (p[1]=='/') {
+							p += 2;
+							break;
+						}
+					}
+				}
+				isSpace = true;
+				pRun = p;
+				continue;
+			}
+			++p;
+			break;
+
+		case '\'':
+			if (isDigitSeparator( m_pNext, p )) {
+				++p;
+				break;
+			}
+			// Fall through
+		case '"':
+			// String or character literal, may contain any of the terminators
+			p = skipLiteral( p, m_pEnd );
+			break;
+
+		case '(':
+			if (nParen<MaxNesting)
+				aAngles[nParen] = nAngle;
+			++nParen;
+			nAngle = 0;
+			++p;
+			break;
+
+		case ')':
+			if (nParen>0) {
+				--nParen;
+				nAngle = nParen<MaxNesting ? aAngles[nParen] : 0;
+			}
+			++p;
+			break;
+
+		case '<':
+			++nAngle;
+			++p;
+			break;
+
+		case '>':
+			if (nAngle>0)
+				--nAngle;
+			++p;
+			break;
+
+		case '-':
+			++p;
+			if (p<m_pEnd && *p=='>')
+				++p;						// "->" doesn't close a '<'
 			break;
 
-		case ';':
 		case '{':
-			isFinished = true;
+			if (nParen==0 && nAngle==0 && nBrace==0)
+				isFinished = true;			// Start of body
+			else {
+				++nBrace;
+				++p;
+			}
 			break;
 
-		default:
-			tok.m_sToken.append( m_fileInput->get() );
-			tok.m_ttType = Token::Text;
+		case '}':
+			if (nBrace>0)
+				--nBrace;
+			++p;
+			break;
+
+		case ';':
+			if (nParen==0 && nBrace==0)
+				isFinished = true;
+			else
+				++p;
+			break;
+
+		case ':':
+			if (p+1<m_pEnd && p[1]==':')
+				p += 2;
+			else if (nParen==0 && nAngle==0 && nBrace==0)
+				isFinished = true;			// Initializer list, label, etc.
+			else
+				++p;
+			break;
+		}
+	}
+	appendRun( sText, isSpace, pRun, p );
+
+	m_pNext = p;
+	if (p==m_pEnd)
+		m_isEof = true;				// As the character by character scan did
+
+	if (!sText.empty()) {
+		tok.m_ttType = Token::Text;
+		tok.m_sToken = std::move( sText );
+	}
+}
+
+/*	LexStream::assignText -- internal routine sets the token text to
+			the characters from pBegin to pEnd.
+*/
+void LexStream::assignText( Token& tok, const char* pBegin, const char* pEnd )
+{
+	tok.m_sToken.assign( pBegin, pEnd );
+}
+
+/*: routine LexStream::skipToEndSymbol
+
+	Skips everything up to and including the next EndSymbol "* /".
+
+	Used to resynchronize after a syntax error.  Unlike repeated calls to
+	getToken this never builds tokens, so it is a single linear pass
+	over the rest of the comment.  Returns the EndSymbol, or EndOfFile
+	if the comment is not terminated.
+*/
+void LexStream::skipToEndSymbol( Token& tok )
+{
+	tok.clear();
+	while (!eof()) {
+		const char* pStar = (const char*)memchr( m_pNext, '*', m_pEnd-m_pNext );
+		m_pNext = pStar ? pStar : m_pEnd;
+		if (get()=='*' && peek()=='/') {
+			get();
+			tok.m_ttType = Token::Symbol;
+			tok.m_sToken = "*/";
+			return;
 		}
 	}
-	return;
+	tok.m_ttType = Token::EndOfFile;
 }
 
 /*: routine LexStream::atEof()			End of File indicator	*/
 bool LexStream::atEof()
 {
-	return m_fileInput->eof();
+	return eof();
+}
+
+/*: routine LexStream::getStartLocation
+
+	Returns the line and column (both starting at 1) of the last start
+	symbol found by getStartSymbol.
+
+	Lines are only counted when a location is asked for, and then only
+	over the text skipped since the last call, so keeping track of
+	locations costs next to nothing while scanning.
+*/
+void LexStream::getStartLocation( int& nLine, int& nColumn )
+{
+	countLines( m_pStartSymbol );
+	nLine = m_nLine;
+	nColumn = int(m_pStartSymbol-m_pLineBegin) + 1;
+	if (m_pLineBegin==m_pBegin)
+		nColumn += m_nBeginColumn - 1;
+}
+
+/*: routine LexStream::setStartLocation
+
+	Sets the line and column of the first character of the input, for
+	input that continues where another left off (see PushParser).  Call
+	before anything is read.
+*/
+void LexStream::setStartLocation( int nLine, int nColumn )
+{
+	bwassert( m_pCounted==m_pBegin );
+	m_nLine = nLine;
+	m_nBeginColumn = nColumn;
+}
+
+/*	LexStream::countLines -- internal routine advances the line count up
+			to pTo.  Start symbols are found in order, so pTo never moves
+			backwards and each character is counted at most once.  memchr
+			scans a word or vector at a time.
+*/
+void LexStream::countLines( const char* pTo )
+{
+	const char* p = m_pCounted;
+
+	bwassert( pTo>=m_pCounted );
+	while (p<pTo) {
+		p = (const char*)memchr( p, '\n', pTo-p );
+		if (p==0)
+			break;
+		++m_nLine;
+		m_pLineBegin = ++p;
+	}
+	m_pCounted = pTo;
 }
@@ -5,8 +5,11 @@ Copyright (C) 1997-2013 Brian Bray
 */
 
 
-//#include <fstream.h>
-//#include <bw/string.h>
+//#include <istream>
+//#include <memory>
+//#include <string>
+//#include <string_view>
+//#include <vector>
 
 
 //	 Tokens represents a single token from the input stream
@@ -29,36 +32,155 @@ public: // Data Access
 	};
 
 	void clear();
-	const bw::String& value() const;
+	std::string_view value() const;
+	std::string take();
 	TokenType type() const;
 
 private:	// data members
 	TokenType	m_ttType;
-	bw::String	m_sToken;
+	std::string	m_sToken;
 };
 
 
+//	A token of a doc block as the place of its text in the input, so the
+//	parser can look ahead and back over a block without copying text.
+struct BlockToken {
+	enum {
+		fSameLine	= 1,	// Only spaces and tabs since the last token
+		fEof		= 2,	// Scanning it reached the end of file
+	};
+
+	Token::TokenType	m_ttType;
+	unsigned	m_fFlags;
+	size_t		m_iOffset;		// Of the text in the input
+	size_t		m_cch;
+};
+
+
+//	The input of a LexStream, which attribute text is left in.  If the
+//	text turns out to be small compared with the input, it is made when
+//	the parse ends and the input is dropped (see LexStream::endParse()).
+struct SourceBuffer {
+	struct Made {
+		unsigned		m_iScan;		// Of the SourceText
+		std::string		m_sText;
+	};
+
+	std::string			m_sData;		// The input, empty once dropped
+	std::vector<Made>	m_vMade;		// Once dropped, in m_iScan order
+};
+
+
+//	Attribute text, either made or left in the input it was read from.
+//	Text left in the input is made, with the comment decoration taken
+//	out, each time its value is asked for.
+class SourceText {
+public:	// Friends
+	friend class LexStream;
+
+public:	// Ctor
+	SourceText()
+		:	m_iBegin( 0 ), m_iScan( 0 ), m_iEnd( 0 ), m_isCopying( false ) {}
+	explicit SourceText( std::string sText )
+		:	m_sText( std::move(sText) ), m_iBegin( 0 ), m_iScan( 0 ), m_iEnd( 0 ),
+		    m_isCopying( false ) {}
+
+public:	// Data Access
+	std::string_view value( std::string& sBuffer ) const;
+	bool isInSource() const {
+		return m_pSource!=0;
+	}
+
+private:	// data members
+	std::string		m_sText;		// Made text, when not in the source
+	std::shared_ptr<const SourceBuffer>	m_pSource;	// The input, or 0
+	unsigned		m_iBegin;		// Copied as is up to m_iScan
+	unsigned		m_iScan;		// Where scanning starts
+	unsigned		m_iEnd;			// Where it stopped, bounds the text size
+	bool			m_isCopying;	// Scanning starts within a line
+};
+
 
 //	Represents an input steam of tokens.
 class LexStream {
 public:	// Initializers
 
 	LexStream( const char* fileName );
-	LexStream( std::ifstream& fInput );
+	LexStream( std::istream& fInput, const char* sourceName="<stream>" );
+	LexStream( const char* pData, size_t cbData, const char* sourceName="<buffer>" );
 
 public:	// Input member functions
 
 	void getStartSymbol( Token& tok );
 	void getToken( Token& tok );
-	void peekToken( Token& tok );
-	void getAttributeText( Token& tok );
+	void appendToken( std::vector<BlockToken>& vTokens ) const;
+	void skipPast( const BlockToken& bt );
+	std::string_view value( const BlockToken& bt ) const {
+		return std::string_view( m_pBegin+bt.m_iOffset, bt.m_cch );
+	}
+	bool getAttributeText( SourceText& text, BlockToken& btEnd, const BlockToken* pbtFirst=0 );
+	void endParse();
 	void getPrototype( Token& tok );
+	void skipToEndSymbol( Token& tok );
 	bool atEof();
+	void getStartLocation( int& nLine, int& nColumn );
+	void setStartLocation( int nLine, int nColumn );
+	size_t offset() const {
+		return m_pNext-m_pBegin;
+	}
+	size_t startOffset() const {
+		return m_pStartSymbol-m_pBegin;
+	}
+	const std::string& name() const {
+		return m_sName;
+	}
+	size_t size() const {
+		return m_pEnd-m_pBegin;
+	}
+
+private:	// Character access (same end of file rules as std::istream)
+	int get() {
+		if (m_pNext<m_pEnd)
+			return (unsigned char)*m_pNext++;
+		m_isEof = true;
+		return EOF;
+	}
+	int peek() {
+		if (m_pNext<m_pEnd)
+			return (unsigned char)*m_pNext;
+		m_isEof = true;
+		return EOF;
+	}
+	bool isBlockStart( const char* p ) const {
+		return m_pEnd-p>=3 && p[0]=='/' && p[1]=='*' && p[2]==':';
+	}
+	bool isLeavingText() const {
+		return m_pSource && size()<=unsigned( -1 );		// Offsets in SourceText fit
+	}
+	bool eof() const {
+		return m_isEof;
+	}
+	void readAll( std::istream& fInput );
+	void countLines( const char* pTo );
+	const char* scanToken( const char* p, BlockToken& bt ) const;
+	static void assignText( Token& tok, const char* pBegin, const char* pEnd );
+
+	LexStream( const LexStream& );				// Not copyable
+	LexStream& operator=( const LexStream& );
 
 private:
-	std::ifstream*	m_fileInput;
-	// bool			m_isCallerOwned;
-	Token			m_tokPeekBuffer;
-	bool			m_isPeeked;
+	std::string		m_sName;		// File name for diagnostics
+	std::shared_ptr<SourceBuffer>	m_pSource;	// Owned copy of file or stream input, or 0
+	std::vector<SourceText>	m_vLeft;	// Text left in m_pSource by this parse
+	const char*		m_pBegin;		// Of the input
+	const char*		m_pNext;		// Next character to scan
+	const char*		m_pEnd;
+	bool			m_isEof;
+
+	const char*		m_pStartSymbol;	// Last "/ * :" found
+	const char*		m_pCounted;		// Lines are counted up to here
+	const char*		m_pLineBegin;	// First character of line m_nLine
+	int				m_nLine;
+	int				m_nBeginColumn;	// Of the first character of the input
 };
 
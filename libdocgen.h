@@ -0,0 +1,53 @@
+/* libdocgen.h -- Everything needed to use docgen from another program
+
+Copyright (C) 2017, Brian Bray
+
+Usage:
+
+	DocGen dg;
+	dg.bufferIn( pSource, cbSource );		// or fileIn(), streamIn(), beginChunks()
+	MemorySink sink;
+	dg.filesOut( sink );					// or filesOut( dirName )
+
+Link with libdocgen.a and the bw library.
+*/
+
+#ifndef LIBDOCGEN_H
+#define LIBDOCGEN_H
+
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <istream>
+#include <ostream>
+#include <sstream>
+#include <list>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "bw/countable.h"
+#include "allocstats.h"
+#include "lexstream.h"
+#include "schema.h"
+#include "docitem.h"
+#include "docsink.h"
+#include "htmlfmt.h"
+#include "fragcache.h"
+#include "backend.h"
+#include "depfile.h"
+#include "timeline.h"
+#include "spill.h"
+#include "uringsink.h"
+#include "stageddir.h"
+#include "serve.h"
+#include "docgen.h"
+#include "pushparse.h"
+
+#endif
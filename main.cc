@@ -4,24 +4,64 @@ Copyright (C) 1997-2013 Brian Bray
 
 */
 
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
 #include <fstream>
+#include <sstream>
 #include <iostream>
+#include <algorithm>
+#include <atomic>
 #include <list>
 #include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
 
 #include "bw/bwassert.h"
 #include "bw/exception.h"
 #include "bw/countable.h"
-#include "bw/string.h"
+#include "allocstats.h"
 #include "lexstream.h"
+#include "schema.h"
 #include "docitem.h"
+#include "docsink.h"
+#include "fragcache.h"
+#include "depfile.h"
+#include "timeline.h"
+#include "serve.h"
 #include "docgen.h"
 
+#include <sys/resource.h>
+
 using bw::BException;
 using std::cout;
 using std::endl;
 
 void usage(void);
+static void orderShards( std::vector<const char*>& vFiles );
+static int formatsOf( const char* sFormats );
+static int errorLimitOf( const char* sLimit );
+static void statsOut( const DocGen& dg, std::chrono::steady_clock::time_point tpStart );
+static void savingsOut( const DocGen& dg );
+static void serve( DocGen& dg, const char* sAddress );
+
+//	Records a Timeline while main() runs, and writes it to a file
+//	however main() returns.
+class TimelineFile {
+public:
+	TimelineFile( const char* fileName );
+	~TimelineFile();
+
+private:
+	const char*	m_fileName;		// 0 if not recording
+};
 
 /*: Project: docgen
 
@@ -34,12 +74,75 @@ void usage(void);
 /*: routine: main()
 
   Usage:
-	docgen &lt;output directory> &lt;file> [&lt;file>...]
+	docgen [&lt;options>] &lt;output directory> &lt;file> [&lt;file>...]
+	<BR>
+	docgen [&lt;options>] --emit-partial &lt;partial> &lt;file> [&lt;file>...]
+	<BR>
+	docgen --merge &lt;output directory> &lt;partial> [&lt;partial>...]
 	<DL>
+	<DT>--max-errors &lt;n>
+	<DD>report at most n syntax errors per input file (default 20), then
+	skip the rest of that file.  n must be at least 1.
+	<DT>--source-link &lt;template>
+	<DD>link each item's source location to template, with {file} and
+	{line} replaced (eg: http://src/{file}#L{line}).
+	<DT>--emit-partial &lt;partial>
+	<DD>parse the files into a partial project file (eg: shard.3.db)
+	instead of generating html.
+	<DT>--merge
+	<DD>the inputs are partials, which are merged before generating html.
+	If every partial name contains a number they are merged in numeric
+	order, otherwise in the order given.  The result is the same as one
+	run over the files of all of the partials in that order.
+	<DT>--format &lt;formats>
+	<DD>write each page in each of formats, a comma separated list of
+	html (the default), json and text, eg: "html,json".  The project
+	is read and walked once for all of them; each format's files have
+	its own extension (.html, .json, .txt).
+	<DT>--minify
+	<DD>write the html with compact markup, and the style every page
+	repeats once, in docgen.css.  docgen reports how many bytes smaller
+	the output is.
+	<DT>--schema &lt;file>
+	<DD>read more item type keywords from file.  Each line is a keyword
+	and the built in type it is documented as, eg: "Enum Variable".  A
+	bad line is reported and docgen stops before writing anything.
+	<DT>--spill &lt;directory>
+	<DD>keep parsed classes in temporary files in directory instead of
+	in memory, for very large runs.  Memory use is then bounded by the
+	largest class rather than the whole project.
+	<DT>--cache &lt;file>
+	<DD>keep the rendered html of each member in file, so that the next
+	run only renders the members that changed (eg: out/.docgen-cache).
+	<DT>--trace-out &lt;file>
+	<DD>write how long each input, page and file write took to file, in
+	Chrome trace event format (see Timeline).
+	<DT>--serve &lt;host>:&lt;port>
+	<DD>instead of writing the html, serve it over HTTP at the address
+	(eg: 127.0.0.1:8080), rendering each page when it is first asked for
+	(see DocServer).  There is no output directory, and --spill and
+	--cache cannot be used.
+	<DT>-MD
+	<DD>also write docgen.d, a depfile listing the input files each page
+	was made from, for make (-include docgen.d) or ninja (see
+	DependFile).
+	<DT>-MF &lt;file>
+	<DD>write the depfile to file instead of docgen.d.  Implies -MD.
+	<DT>-MP
+	<DD>add an empty rule for each input to the depfile, so that make
+	does not fail once an input is removed.
+	<DT>--stats
+	<DD>when done, report the inputs and bytes parsed, the elapsed time
+	and the peak memory use (eg: for make perfcheck).
+	<DT>--alloc-stats
+	<DD>when done, report the heap allocations of the input and output
+	phases, by kind of object and by the sites that allocate most (see
+	AllocStats).
 	<DT>&lt;output directory>
 	<DD>docgen creates html files in this directory.
 	<DT>&lt;file>
-	<DD>input file name (eg: *.h *.cpp *.cc)
+	<DD>input file name (eg: *.h *.cpp *.cc), or - for the standard
+	input, which is read as it arrives, eg: git show HEAD:a.h | docgen out -
 	</DL>
 	<P>
 	The output directory will be filled with:
@@ -49,27 +152,160 @@ void usage(void);
 	<DT>&lt;class>.htm
 	<DD>routine descriptions for each class encountered.
 	</DL>
+	and, with --format, the same pages as .json or .txt files.
 */
 int main(int argc, char* argv[])
 {
+	std::chrono::steady_clock::time_point tpStart = std::chrono::steady_clock::now();
+	int cMaxErrors = DocGen::DefaultMaxErrors;
+	const char* sourceLink = "";
+	const char* partialName = 0;
+	const char* spillDir = 0;
+	const char* schemaName = 0;
+	const char* cacheName = 0;
+	const char* timelineName = 0;
+	const char* serveAddress = 0;
+	const char* dependName = 0;
+	int fFormats = Project::fmtHtml;
+	bool isPhony = false;
+	bool isMinified = false;
+	bool isMerge = false;
+	bool isStats = false;
+	bool isAllocStats = false;
+
+	// Options
+	int iArg = 1;
+	while (iArg<argc && (strncmp( argv[iArg], "--", 2 )==0 || strncmp( argv[iArg], "-M", 2 )==0)) {
+		if (strcmp( argv[iArg], "--max-errors" )==0 && iArg+1<argc) {
+			cMaxErrors = errorLimitOf( argv[iArg+1] );
+			if (cMaxErrors==0) {
+				usage();
+				return 1;
+			}
+			iArg += 2;
+		} else if (strcmp( argv[iArg], "--source-link" )==0 && iArg+1<argc) {
+			sourceLink = argv[iArg+1];
+			iArg += 2;
+		} else if (strcmp( argv[iArg], "--emit-partial" )==0 && iArg+1<argc) {
+			partialName = argv[iArg+1];
+			iArg += 2;
+		} else if (strcmp( argv[iArg], "--format" )==0 && iArg+1<argc) {
+			fFormats = formatsOf( argv[iArg+1] );
+			if (fFormats==0) {
+				usage();
+				return 1;
+			}
+			iArg += 2;
+		} else if (strcmp( argv[iArg], "--minify" )==0) {
+			isMinified = true;
+			iArg++;
+		} else if (strcmp( argv[iArg], "--schema" )==0 && iArg+1<argc) {
+			schemaName = argv[iArg+1];
+			iArg += 2;
+		} else if (strcmp( argv[iArg], "--spill" )==0 && iArg+1<argc) {
+			spillDir = argv[iArg+1];
+			iArg += 2;
+		} else if (strcmp( argv[iArg], "--cache" )==0 && iArg+1<argc) {
+			cacheName = argv[iArg+1];
+			iArg += 2;
+		} else if (strcmp( argv[iArg], "--trace-out" )==0 && iArg+1<argc) {
+			timelineName = argv[iArg+1];
+			iArg += 2;
+		} else if (strcmp( argv[iArg], "--serve" )==0 && iArg+1<argc) {
+			serveAddress = argv[iArg+1];
+			iArg += 2;
+		} else if (strcmp( argv[iArg], "-MD" )==0) {
+			if (!dependName)
+				dependName = "docgen.d";
+			iArg++;
+		} else if (strcmp( argv[iArg], "-MF" )==0 && iArg+1<argc) {
+			dependName = argv[iArg+1];
+			iArg += 2;
+		} else if (strcmp( argv[iArg], "-MP" )==0) {
+			isPhony = true;
+			iArg++;
+		} else if (strcmp( argv[iArg], "--merge" )==0) {
+			isMerge = true;
+			iArg++;
+		} else if (strcmp( argv[iArg], "--stats" )==0) {
+			isStats = true;
+			iArg++;
+		} else if (strcmp( argv[iArg], "--alloc-stats" )==0) {
+			isAllocStats = true;
+			iArg++;
+		} else {
+			usage();
+			return 1;
+		}
+	}
 
-	if( argc<3 ) {
+	// Serving renders from the Project in memory, so needs all of it,
+	// and from several threads, which a FragmentCache can't be shared
+	// by.  A depfile names pages in the output directory.
+	bool hasDir = !partialName && !serveAddress;
+	if( argc-iArg<(hasDir ? 2 : 1) || (partialName && (isMerge || serveAddress))
+	    || (serveAddress && (spillDir || cacheName)) || (dependName && !hasDir) ) {
 		usage();
 		return 1;
 	}
+	const char* dirName = hasDir ? argv[iArg++] : 0;
+	if (isAllocStats)
+		AllocStats::enable();
 
 
 	// For a windows version, move the following into it's own routine, so that main()
 	//		just handles the command line (and thus it can be replaced
 	//		with a windows program that queries for files (or gets
 	//		them dropped).
+	TimelineFile timeline( timelineName );
 	DocGen dg;
+	dg.setDiagnostics( &std::cerr, cMaxErrors );
+	dg.setSourceLinkTemplate( sourceLink );
+	dg.setFormats( isMinified ? fFormats | Project::fmtMinified : fFormats );
+	if (spillDir)
+		dg.setSpillDir( spillDir );
+	if (cacheName)
+		dg.setFragmentCache( cacheName );
+	if (dependName)
+		dg.setDependFile( dependName, isPhony );
 
 	try {
+		if (schemaName) {
+			// Items of a type the schema failed to add would be
+			// documented as the wrong type, so stop before any output
+			dg.schemaIn( schemaName );
+			if (dg.errorCount()>0)
+				return 1;
+		}
+
+		AllocStats::setPhase( AllocStats::phInput );
+		if (isMerge) {
+			// Every partial is needed, so any error is fatal
+			std::vector<const char*> vPartials( argv+iArg, argv+argc );
+			orderShards( vPartials );
+			for (size_t i=0; i<vPartials.size(); i++)
+				dg.mergeIn( vPartials[i] );
+			AllocStats::setPhase( AllocStats::phOutput );
+			if (serveAddress)
+				serve( dg, serveAddress );
+			else
+				dg.filesOut( dirName );
+			if (isMinified && dirName)
+				savingsOut( dg );
+			if (isStats)
+				statsOut( dg, tpStart );
+			if (isAllocStats)
+				AllocStats::reportOut( std::cerr );
+			return 0;
+		}
+
 		// Input phase
-		for( int i=2; i<argc; i++ ) {
+		for( int i=iArg; i<argc; i++ ) {
 			try {
-				dg.fileIn( argv[i] );
+				if (strcmp( argv[i], "-" )==0)
+					dg.streamIn( std::cin, "<stdin>" );
+				else
+					dg.fileIn( argv[i] );
 			} catch( const BException& e ) {
 				cout << e.message() << endl;
 				cout << "continuing with next input file..." << endl;
@@ -77,7 +313,19 @@ int main(int argc, char* argv[])
 		}
 
 		// Output phase
-		dg.filesOut( argv[1] );
+		AllocStats::setPhase( AllocStats::phOutput );
+		if (serveAddress)
+			serve( dg, serveAddress );
+		else if (partialName)
+			dg.partialOut( partialName );
+		else
+			dg.filesOut( dirName );
+		if (isMinified && dirName)
+			savingsOut( dg );
+		if (isStats)
+			statsOut( dg, tpStart );
+		if (isAllocStats)
+			AllocStats::reportOut( std::cerr );
 	} catch( const BException& e ) {
 		cout << e.message() << endl;
 		return 1;
@@ -93,9 +341,30 @@ void
 usage()
 {
 	cout << "Usage:\n";
-	cout << "\tdocgen <directory> <file> [<file>...]\n";
+	cout << "\tdocgen [<options>] <directory> <file> [<file>...]\n";
+	cout << "\tdocgen [<options>] --emit-partial <partial> <file> [<file>...]\n";
+	cout << "\tdocgen --merge <directory> <partial> [<partial>...]\n";
+	cout << "\tdocgen [<options>] --serve <host>:<port> <file> [<file>...]\n";
 	cout << "\t\t<directory> -- docgen creates .html files in this directory\n";
-	cout << "\t\t<file> -- input file name (eg: *.h *.cpp *.cc)\n";
+	cout << "\t\t<file> -- input file name (eg: *.h *.cpp *.cc), - for standard input\n";
+	cout << "\n";
+	cout << "\tOptions:\n";
+	cout << "\t\t--max-errors <n> -- syntax errors reported per file before skipping it\n";
+	cout << "\t\t--source-link <template> -- link source locations, eg: http://src/{file}#L{line}\n";
+	cout << "\t\t--emit-partial <partial> -- write a partial project (eg: shard.3.db), not html\n";
+	cout << "\t\t--merge -- merge partials, in the order of the number in their names\n";
+	cout << "\t\t--format <formats> -- write html, json and/or text pages, eg: html,json\n";
+	cout << "\t\t--minify -- compact html, its style shared in docgen.css\n";
+	cout << "\t\t--schema <file> -- more item types, one per line, eg: Enum Variable\n";
+	cout << "\t\t--spill <dir> -- keep parsed classes in temporary files in dir, not memory\n";
+	cout << "\t\t--cache <file> -- reuse the html of unchanged members from the last run\n";
+	cout << "\t\t--trace-out <file> -- time each input, page and write, for chrome://tracing\n";
+	cout << "\t\t--serve <host>:<port> -- serve the html over HTTP, not with --spill or --cache\n";
+	cout << "\t\t-MD -- also write docgen.d, the inputs of each page for make or ninja\n";
+	cout << "\t\t-MF <file> -- write the depfile to file instead of docgen.d\n";
+	cout << "\t\t-MP -- add an empty rule for each input to the depfile\n";
+	cout << "\t\t--stats -- report bytes parsed, elapsed time and peak memory when done\n";
+	cout << "\t\t--alloc-stats -- report heap allocations by phase, object and site when done\n";
 	cout << "\n";
 	cout << "\tThe output directory will be filled with:\n";
 	cout << "\t\tindex.html -- class index and globals.\n";
@@ -107,3 +376,154 @@ usage()
 	cout << endl;
 }
 
+/*	shardNumber -- internal routine returns the last number in the file
+			part of a partial's name (eg: 12 for "out/shard.12.db"), or -1
+			if there is none.
+*/
+static long shardNumber( const char* fileName )
+{
+	const char* pch = strrchr( fileName, '/' );
+	pch = pch ? pch+1 : fileName;
+
+	long nShard = -1;
+	while (*pch) {
+		if (isdigit( (unsigned char)*pch )) {
+			nShard = 0;
+			while (isdigit( (unsigned char)*pch ))
+				nShard = nShard*10 + (*pch++ - '0');
+		} else
+			pch++;
+	}
+	return nShard;
+}
+
+/*	orderShards -- internal routine sorts partials by shardNumber(), so
+			that shard.10.db follows shard.9.db whatever order the shell
+			expanded them in.  If any name has no number, the command line
+			order is kept.
+*/
+static void orderShards( std::vector<const char*>& vFiles )
+{
+	for (size_t i=0; i<vFiles.size(); i++)
+		if (shardNumber( vFiles[i] )<0)
+			return;
+
+	std::stable_sort( vFiles.begin(), vFiles.end(),
+	                  []( const char* pA, const char* pB ) {
+		return shardNumber( pA )<shardNumber( pB );
+	} );
+}
+
+/*	formatsOf -- internal routine returns the Project::fmtHtml, ... flags
+			of a comma separated list of format names (eg: "html,json"),
+			or 0 if a name is not known.
+*/
+static int formatsOf( const char* sFormats )
+{
+	static const struct {
+		const char*	m_sName;
+		int			m_fFormat;
+	} s_aFormats[] = {
+		{"html", Project::fmtHtml}, {"json", Project::fmtJson}, {"text", Project::fmtText}
+	};
+	int fFormats = 0;
+
+	while (*sFormats) {
+		size_t cch = strcspn( sFormats, "," );
+		int fFormat = 0;
+		for (size_t i=0; i<sizeof(s_aFormats)/sizeof(s_aFormats[0]); i++) {
+			if (strlen( s_aFormats[i].m_sName )==cch
+			    && strncmp( sFormats, s_aFormats[i].m_sName, cch )==0)
+				fFormat = s_aFormats[i].m_fFormat;
+		}
+		if (fFormat==0)
+			return 0;
+		fFormats |= fFormat;
+		sFormats += cch;
+		if (*sFormats==',')
+			sFormats++;
+	}
+	return fFormats;
+}
+
+/*	errorLimitOf -- internal routine returns the number given to
+			--max-errors, or 0 if it is not a whole number of at least 1.
+*/
+static int errorLimitOf( const char* sLimit )
+{
+	char* pEnd;
+
+	errno = 0;
+	long nLimit = strtol( sLimit, &pEnd, 10 );
+	if (pEnd==sLimit || *pEnd!='\0' || errno!=0 || nLimit<1 || nLimit>INT_MAX)
+		return 0;
+	return (int)nLimit;
+}
+
+/*	statsOut -- internal routine reports the size and cost of the run on
+			std::cerr, as "stats: key=value ..." for scripts.
+*/
+static void statsOut( const DocGen& dg, std::chrono::steady_clock::time_point tpStart )
+{
+	long long msElapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+	                          std::chrono::steady_clock::now() - tpStart ).count();
+	struct rusage ru;
+
+	if (getrusage( RUSAGE_SELF, &ru )!=0)
+		ru.ru_maxrss = 0;
+	std::cerr << "stats: inputs=" << dg.inputCount()
+	          << " bytes=" << dg.inputBytes()
+	          << " ms=" << msElapsed
+	          << " maxrss_kb=" << ru.ru_maxrss << endl;
+}
+
+/*	savingsOut -- internal routine reports how much smaller --minify
+			made the output.
+*/
+static void savingsOut( const DocGen& dg )
+{
+	long long cbFull = dg.outputBytes() + dg.markupSaved();
+
+	cout << "docgen: wrote " << dg.outputBytes() << " bytes, " << dg.markupSaved()
+	     << " (" << (cbFull>0 ? dg.markupSaved()*100/cbFull : 0)
+	     << "%) fewer than with full markup" << endl;
+}
+
+/*	TimelineFile::TimelineFile -- internal routine starts recording if
+			fileName is not 0.
+*/
+TimelineFile::TimelineFile( const char* fileName )
+	:	m_fileName( fileName )
+{
+	if (m_fileName)
+		Timeline::enable();
+}
+
+/*	TimelineFile::~TimelineFile -- internal routine writes the file */
+TimelineFile::~TimelineFile()
+{
+	if (m_fileName==0)
+		return;
+
+	std::ofstream os( m_fileName );
+	if (os.is_open()) {
+		Timeline::jsonOut( os );
+		os.close();
+	}
+	if (os.fail())
+		cout << "Cannot write " << m_fileName << endl;
+}
+
+/*	serve -- internal routine serves the parsed project over HTTP at
+			sAddress until the process is stopped.
+
+	Throws: if the address cannot be listened on
+*/
+static void serve( DocGen& dg, const char* sAddress )
+{
+	DocServer server( dg.project() );
+
+	cout << "docgen: serving " << dg.project().getFullDisplayName()
+	     << " at http://" << sAddress << "/" << endl;
+	server.run( sAddress );
+}
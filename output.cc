@@ -4,261 +4,1032 @@ Copyright (C) 1997-2013, Brian Bray
 
 */
 
+#include <atomic>
+#include <cctype>
+#include <chrono>
 #include <fstream>
+#include <ostream>
+#include <sstream>
 #include <list>
 #include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
 
 #include "bw/bwassert.h"
 #include "bw/countable.h"
 #include "bw/exception.h"
 #include "bw/string.h"
 #include "bw/html.h"
+#include "allocstats.h"
+#include "lexstream.h"
+#include "schema.h"
 #include "docitem.h"
+#include "docsink.h"
+#include "htmlfmt.h"
+#include "fragcache.h"
+#include "backend.h"
+#include "timeline.h"
+#include "depfile.h"
 
 using bw::BFileException;
 using bw::html;
 using bw::String;
 using std::ostream;
 using std::ofstream;
+using std::string;
+using std::string_view;
+
+static AllocStats::Site s_siteIndex( "Project::indexOut", AllocStats::oOutput );
+static AllocStats::Site s_siteClass( "Project::classOut", AllocStats::oOutput );
+static AllocStats::Site s_siteScope( "Project::scopeOut", AllocStats::oOutput );
+static AllocStats::Site s_siteFragments( "HtmlBackend::beginMember", AllocStats::oOutput );
 
 
 /*: routine Project::filesOut
 
 	Outputs all documentation files for the project into the given
-	directory.
+	directory or DocSink, in each of the formats set by setFormats(),
+	HTML by default, then the files the pages share, such as the
+	stylesheet of minified HTML.  bytesWritten() and markupSaved() are
+	then the size of the output and how much less it is than with
+	the full markup.
 
-	This routine looks after all the file opening and HTML prolog
-	and epilog.  The overloaded << operators output individual DocItems
-	into the BODY of the HTML output.
+	The project is walked once: the project page, a page for each
+	namespace, then a page for each class.  Every OutputBackend of the
+	run is called for each part of each page, and each attribute value
+	is made once for all of them, so another format costs another
+	backend but not another walk.
 
 	Throws if file(s) cannot be opened.
+
+	Prototype: void filesOut( const string& sDir )
+	Prototype: void filesOut( DocSink& sink )
 */
-void Project::filesOut( const String& sDir )
+void Project::filesOut( const string& sDir )
 {
-	// First, create project file
+	DirSink sink( sDir );
+	filesOut( sink );
+}
 
-	{
-		ofstream os( sDir + "/" + getFileName() );
-		if (!os.is_open())
-			throw BFileException( BFileException::SystemError );
+void Project::filesOut( DocSink& sink )
+{
+	OutputBackends backends( sink, m_fFormats, m_pCache, m_sSourceLinkTemplate );
 
-		os << html::prolog( getFullDisplayName(), "docgen by Brian Bray" );
-		os << *this;
-		os << html::epilog;
-	}
+	// First, create project file and a page for each namespace
+	indexOut( backends );
+	scopesOut( backends );
 
 	// Now write each Class file.
 
-	ClassMap::iterator it;
-	it = m_mapClasses.begin();
-	while (it!=m_mapClasses.end()) {
-		if ((*it).second->getName()!="") {		// Globals already done
-			ofstream os( sDir + "/" + (*it).second->getFileName() );
-			if (!os.is_open())
-				throw BFileException( BFileException::SystemError );
-
-			os << html::prolog( (*it).second->getFullDisplayName(),
-			                    "docgen by Brian Bray" );
-			os << *((*it).second);
-			os << html::epilog;
-		}
-		++it;
+	std::vector<DocClass*> vClasses;
+	m_scopeRoot.classesOf( vClasses );
+	for (size_t i=0; i<vClasses.size(); i++) {
+		if (!vClasses[i]->getName().empty())		// Globals already done
+			classOut( backends, *vClasses[i] );
 	}
+	backends.assetsOut();
+	sink.flush();
+	m_cbWritten = backends.written();
+	m_cbMarkupSaved = backends.markupSaved();
 }
 
+/*: routine Project::fileOut
 
-/*: routine Project::operator<<
-
-	Output the body of a project file.
+	Writes just the file named sFileName, eg: "index.html", "a.b.C.html"
+	or "a.b.C.json", as filesOut() would write it in the format of its
+	extension, or the stylesheet of minified HTML.  Returns false if the
+	project has no such file.  Only
+	reads the project, so several threads may call it at once as long
+	as no FragmentCache is set.
 */
-ostream& operator<<( ostream& os, const Project& proj )
+bool Project::fileOut( DocSink& sink, string_view sFileName ) const
 {
-	os << *((DocItem*)&proj);			// Generic attribute output
+	static const string_view svNamespace = "namespace.";
 
-	// Now output the index of classes
-	Project::ClassMap::const_iterator it;
-	it = proj.m_mapClasses.begin();
-	if (it!=proj.m_mapClasses.end()) {
-		os << html::heading3( proj.getFullDisplayName() + " classes" );
-	}
-	os << html::beginTable(2);
-
-	while (it!=proj.m_mapClasses.end()) {
-		os << html::beginRow;
-		os << html::beginCell;
-		os << html::beginLink((*it).second->getFileName());
-		os << (*it).second->getDisplayName();
-		os << html::endLink;
-		os << html::nextCell;
-		os << (*it).second->getTitle();
-		os << html::endCell;
-		os << html::endRow;
-		++it;
+	size_t iDot = sFileName.rfind( '.' );
+	if (iDot==string_view::npos)
+		return false;
+	if ((m_fFormats & fmtMinified) && sFileName==HtmlBackend::scStyleSheet) {
+		OutputBackends backends( sink, fmtHtml | fmtMinified, m_pCache, m_sSourceLinkTemplate );
+		backends.assetsOut();
+		return true;
 	}
+	int fFormat = OutputBackends::formatOf( sFileName.substr( iDot ) );
+	if (fFormat==0)
+		return false;
+	OutputBackends backends( sink, fFormat | (m_fFormats & fmtMinified), m_pCache,
+	                         m_sSourceLinkTemplate );
+	string_view sBase = sFileName.substr( 0, iDot );
 
-	os << html::endTable;
-	os << html::rule;
+	if (sBase==getPageName()) {
+		indexOut( backends );
+		return true;
+	}
 
-	// Now output the index of Globals (if any)
+	bool isScope = sBase.substr( 0, svNamespace.size() )==svNamespace;
+	if (isScope)
+		sBase.remove_prefix( svNamespace.size() );
 
-	os << html::heading3( proj.getFullDisplayName() + " globals" );
+	// The qualified name has a "::" for each "."
+	string sName;
+	for (size_t i=0; i<sBase.size(); i++) {
+		if (sBase[i]=='.')
+			sName += "::";
+		else
+			sName += sBase[i];
+	}
+	if (sName.empty())
+		return false;
 
-	it = proj.m_mapClasses.find( "" );			// Global "Class"
-	if (it!=proj.m_mapClasses.end()) {
-		os << *((*it).second);					// Output Class documentation
+	const DocScope* pScope = m_scopeRoot.find( sName );
+	if (pScope==0)
+		return false;
+	if (isScope) {
+		if (!pScope->hasScopes())
+			return false;
+		scopeOut( backends, *pScope );
 	} else {
-		os << html::boldOn << "No Global functions or variables" << html::boldOff;
+		if (pScope->getClass()==0)
+			return false;
+		classOut( backends, *pScope->getClass() );
 	}
-	return os;
+	return true;
+}
+
+/*	pagesBegin -- internal routine starts a page in every backend */
+static void pagesBegin( OutputBackends& backends, const string& sPage, const string& sTitle )
+{
+	for (size_t i=0; i<backends.size(); i++)
+		backends[i].beginPage( sPage, sTitle );
+}
+
+/*	pagesEnd -- internal routine ends the page in every backend, and
+			returns the bytes they wrote.
+*/
+static long long pagesEnd( OutputBackends& backends )
+{
+	long long cb = 0;
+
+	for (size_t i=0; i<backends.size(); i++)
+		cb += backends[i].endPage();
+	backends.addWritten( cb );
+	return cb;
 }
 
+/*	attributeTo -- internal routine makes the value of attr and passes it
+			to the backends whose bit is set in fWanted.
+*/
+static void attributeTo( OutputBackends& backends, unsigned fWanted,
+                         const Attribute& attr, string& sValue )
+{
+	string_view svValue = attr.value( sValue );
 
-/*: DocClass::operator<<
+	for (size_t i=0; i<backends.size(); i++) {
+		if (fWanted & (1u<<i))
+			backends[i].attributeOut( attr, svValue );
+	}
+}
 
-	Output the body of a class documentation file.
+/*	attributesOut -- internal routine passes the attributes of di to the
+			backends whose bit is set in fWanted, in the order they are
+			shown: prototypes, descriptions, the others in the order
+			given, then where the item came from.
 */
-ostream& operator<<( ostream& os, const DocClass& cls )
+static void attributesOut( OutputBackends& backends, unsigned fWanted, const DocItem& di )
 {
-	os << *((DocItem*)&cls);			// Generic attribute output
+	static const DocSchema::AttributeKind s_akFirst[] = {
+		DocSchema::aImpliedPrototype, DocSchema::aPrototype,
+		DocSchema::aImpliedDescription, DocSchema::aDescription
+	};
+	string sValue;					// Values still in the input are made here
+	AttribIterator it;
 
-	// Now output the index of routines
-	{
-		DocClass::FunctionMap::const_iterator it;
-		it = cls.m_mapFunctions.begin();
-		if (it!=cls.m_mapFunctions.end()) {
-			os << html::heading3( cls.getFullDisplayName() + " member functions" );
-		}
-		os << html::beginTable(2);
-
-		while (it!=cls.m_mapFunctions.end()) {
-			os << html::beginRow;
-			os << html::beginCell;
-			os << html::beginLink2Link((*it).second->getLinkName());
-			os << (*it).second->getDisplayName();
-			os << html::endLink;
-			os << html::nextCell;
-			os << (*it).second->getTitle();
-			os << html::endCell;
-			os << html::endRow;
-			++it;
-		}
+	for (size_t iKind=0; iKind<sizeof(s_akFirst)/sizeof(s_akFirst[0]); iKind++) {
+		for (it=di.find( s_akFirst[iKind] ); !it.atEof(); ++it)
+			attributeTo( backends, fWanted, *it, sValue );
+	}
 
-		os << html::endTable;
+	for (it=di.findAll(); !it.atEof(); ++it) {
+		DocSchema::AttributeKind ak = (*it).kind();
+		if (! (	ak==DocSchema::aImpliedPrototype ||
+		        ak==DocSchema::aPrototype ||
+		        ak==DocSchema::aImpliedDescription ||
+		        ak==DocSchema::aDescription ||
+		        ak==DocSchema::aSource ) )
+			attributeTo( backends, fWanted, *it, sValue );
 	}
 
-	// Now output the index of Variables
-	{
-		DocClass::VariableMap::const_iterator it;
-		it = cls.m_mapVariables.begin();
-		if (it!=cls.m_mapVariables.end()) {
-			os << html::heading3( cls.getFullDisplayName() + " member variables" );
-		}
-		os << html::beginTable(2);
-
-		while (it!=cls.m_mapVariables.end()) {
-			os << html::beginRow;
-			os << html::beginCell;
-			os << html::beginLink2Link((*it).second->getLinkName());
-			os << (*it).second->getDisplayName();
-			os << html::endLink;
-			os << html::nextCell;
-			os << (*it).second->getTitle();
-			os << html::endCell;
-			os << html::endRow;
-			++it;
-		}
+	// Last, where it came from
+	it = di.find( DocSchema::aSource );
+	if (!it.atEof())
+		attributeTo( backends, fWanted, *it, sValue );
+}
 
-		os << html::endTable;
+/*	itemOut -- internal routine passes the project or a class and its
+			attributes to every backend.
+*/
+static void itemOut( OutputBackends& backends, const DocItem& di )
+{
+	for (size_t i=0; i<backends.size(); i++)
+		backends[i].beginItem( di );
+	attributesOut( backends, (1u<<backends.size())-1, di );
+	for (size_t i=0; i<backends.size(); i++)
+		backends[i].endItem( di );
+}
+
+/*	classEntryOut -- internal routine passes a class to list to every
+			backend.
+*/
+static void classEntryOut( OutputBackends& backends, const DocClass& cls )
+{
+	ItemTitle title( cls );
+
+	for (size_t i=0; i<backends.size(); i++)
+		backends[i].classEntry( cls, title );
+}
+
+/*	scopeListsOut -- internal routine lists the classes directly in
+			scope, then the scopes in it that hold more names.
+			pclsFirst, if not 0, is listed before the classes.
+*/
+static void scopeListsOut( OutputBackends& backends, const DocScope& scope,
+                           const string& sHeading, const DocClass* pclsFirst )
+{
+	std::vector<const DocScope*> vNested;
+	scope.nestedOf( vNested );
+
+	size_t cClasses = pclsFirst ? 1 : 0;
+	size_t cScopes = 0;
+	for (size_t i=0; i<vNested.size(); i++) {
+		if (vNested[i]->getClass())
+			cClasses++;
+		if (vNested[i]->hasScopes())
+			cScopes++;
+	}
+
+	string sClasses = sHeading + " classes";
+	for (size_t i=0; i<backends.size(); i++)
+		backends[i].beginList( OutputBackend::lkClasses, sClasses, cClasses );
+	if (pclsFirst)
+		classEntryOut( backends, *pclsFirst );
+	for (size_t i=0; i<vNested.size(); i++) {
+		if (vNested[i]->getClass())
+			classEntryOut( backends, *vNested[i]->getClass() );
+	}
+	for (size_t i=0; i<backends.size(); i++)
+		backends[i].endList( OutputBackend::lkClasses );
+
+	if (cScopes==0)
+		return;
+	string sScopes = sHeading + " namespaces";
+	for (size_t i=0; i<backends.size(); i++)
+		backends[i].beginList( OutputBackend::lkScopes, sScopes, cScopes );
+	for (size_t iScope=0; iScope<vNested.size(); iScope++) {
+		if (!vNested[iScope]->hasScopes())
+			continue;
+		for (size_t i=0; i<backends.size(); i++)
+			backends[i].scopeEntry( *vNested[iScope] );
 	}
+	for (size_t i=0; i<backends.size(); i++)
+		backends[i].endList( OutputBackend::lkScopes );
+}
 
-	// Now output the Function details
-	{
-		DocClass::FunctionMap::const_iterator it;
+/*	membersOut -- internal routine lists some members of a class, with
+			the attributes of each for the backends that want them.
+*/
+template< class Map >
+static void membersOut( OutputBackends& backends, OutputBackend::ListKind lk,
+                        const Map& map, const string& sHeading )
+{
+	typename Map::const_iterator it;
 
-		os << html::rule;
+	for (size_t i=0; i<backends.size(); i++)
+		backends[i].beginList( lk, sHeading, map.size() );
 
-		it = cls.m_mapFunctions.begin();
-		while (it!=cls.m_mapFunctions.end()) {
-			os << *((*it).second);
-			os << html::rule;
-			++it;
+	for (it=map.begin(); it!=map.end(); ++it) {
+		const DocItem& di = *(*it).second;
+		ItemTitle title( di );
+		unsigned fWanted = 0;
+
+		for (size_t i=0; i<backends.size(); i++) {
+			if (backends[i].beginMember( di, title ))
+				fWanted |= 1u<<i;
 		}
+		if (fWanted)
+			attributesOut( backends, fWanted, di );
+		for (size_t i=0; i<backends.size(); i++)
+			backends[i].endMember( di );
 	}
 
-	// Now output the Variable details
-	{
-		DocClass::VariableMap::const_iterator it;
+	for (size_t i=0; i<backends.size(); i++)
+		backends[i].endList( lk );
+}
 
-		it = cls.m_mapVariables.begin();
-		while (it!=cls.m_mapVariables.end()) {
-			os << *((*it).second);
-			os << html::rule;
-			++it;
-		}
+/*	Project::dependsOut -- internal routine records the sources of the
+			page sPage in each format, or that it depends on every
+			source if pSources is 0.
+*/
+void Project::dependsOut( OutputBackends& backends, const string& sPage,
+                          const SourceSet* pSources ) const
+{
+	if (!m_pDepends)
+		return;
+
+	for (size_t i=0; i<backends.size(); i++) {
+		string sFileName = sPage + backends[i].extension();
+		if (pSources)
+			m_pDepends->add( sFileName, *pSources );
+		else
+			m_pDepends->addAll( sFileName );
 	}
+}
 
-	return os;
+/*	Project::indexOut -- internal routine writes the project file */
+void Project::indexOut( OutputBackends& backends ) const
+{
+	AllocStats::Scope allocs( s_siteIndex );
+	Timeline::Span span( "render" );
+	string sPage = getPageName();
+	string sName = getFullDisplayName();
+	const DocClass* pclsGlobal = m_scopeRoot.getClass();	// Global "Class"
+
+	pagesBegin( backends, sPage, sName );
+	itemOut( backends, *this );
+
+	// Now the index of classes and namespaces, then the globals (if any)
+	scopeListsOut( backends, m_scopeRoot, sName, pclsGlobal );
+	for (size_t i=0; i<backends.size(); i++)
+		backends[i].beginGlobals( sName + " globals", pclsGlobal!=0 );
+	if (pclsGlobal)
+		bodyOut( backends, *pclsGlobal );
+	for (size_t i=0; i<backends.size(); i++)
+		backends[i].endGlobals( pclsGlobal!=0 );
+	long long cb = pagesEnd( backends );
+
+	span.arg( "page", getFileName() );
+	span.arg( "members", (long long)m_cClasses );
+	span.arg( "bytes", cb );
+
+	dependsOut( backends, sPage, 0 );
+	if (m_pDepends) {
+		m_pDepends->addSources( m_setSources );
+		if (pclsGlobal)
+			m_pDepends->addSources( pclsGlobal->getSources() );
+	}
 }
 
-/*: DocItem::operator<<
+/*	Project::classOut -- internal routine writes the file for one class */
+void Project::classOut( OutputBackends& backends, const DocClass& cls ) const
+{
+	AllocStats::Scope allocs( s_siteClass );
+	Timeline::Span span( "render" );
+	string sPage = cls.getPageName();
+
+	pagesBegin( backends, sPage, cls.getFullDisplayName() );
+	bodyOut( backends, cls );
+	long long cb = pagesEnd( backends );
 
-	Generic output of a DocItem attributes
+	span.arg( "class", cls.getName() );
+	span.arg( "members", (long long)(cls.m_mapFunctions.size()+cls.m_mapVariables.size()) );
+	span.arg( "bytes", cb );
+
+	dependsOut( backends, sPage, &cls.getSources() );
+}
+
+/*	Project::bodyOut -- internal routine walks a class: its attributes,
+			then its member functions and variables.
 */
-ostream& operator<<( ostream& os, const DocItem& di )
+void Project::bodyOut( OutputBackends& backends, const DocClass& cls ) const
 {
-	AttribIterator it;
+	itemOut( backends, cls );
+	membersOut( backends, OutputBackend::lkFunctions, cls.m_mapFunctions,
+	            cls.getFullDisplayName() + " member functions" );
+	membersOut( backends, OutputBackend::lkVariables, cls.m_mapVariables,
+	            cls.getFullDisplayName() + " member variables" );
+	for (size_t i=0; i<backends.size(); i++)
+		backends[i].endBody( cls );
+}
+
+/*	Project::scopesOut -- internal routine writes a page for each scope
+			that holds nested names.
+*/
+void Project::scopesOut( OutputBackends& backends ) const
+{
+	std::vector<const DocScope*> vScopes;
+	m_scopeRoot.nestedOf( vScopes );
+
+	while (!vScopes.empty()) {
+		const DocScope& scope = *vScopes.back();
+		vScopes.pop_back();
+		if (!scope.hasScopes())
+			continue;
+		scope.nestedOf( vScopes );
+		scopeOut( backends, scope );
+	}
+}
+
+/*	Project::scopeOut -- internal routine writes the page of a scope,
+			listing the scope's own class (eg: its namespace
+			functions), its classes and the scopes in it.
+*/
+void Project::scopeOut( OutputBackends& backends, const DocScope& scope ) const
+{
+	AllocStats::Scope allocs( s_siteScope );
+	Timeline::Span span( "render" );
+	string sPage = scope.getPageName();
+	string sName( scope.getName() );
+
+	pagesBegin( backends, sPage, "Namespace " + sName );
+	scopeListsOut( backends, scope, sName, scope.getClass() );
+	long long cb = pagesEnd( backends );
+
+	span.arg( "page", scope.getFileName() );
+	span.arg( "bytes", cb );
+
+	dependsOut( backends, sPage, 0 );
+}
+
+
+/*: routine DocSink::putFile
+
+	Writes the whole file sFileName, whose contents are sData.  The
+	default writes it with beginFile() and endFile().
+*/
+void DocSink::putFile( const string& sFileName, string sData )
+{
+	ostream& os = beginFile( sFileName );
+	os.write( sData.data(), sData.size() );
+	endFile();
+}
+
+
+/*: class DirSink
+
+	DocSink that writes each file into a directory.
+*/
+DirSink::DirSink( const string& sDir )
+	:	m_sDir( sDir )
+{
+}
+
+/*: routine DirSink::beginFile
+
+	Creates the file in the directory.
+
+	Throws: if the file cannot be opened
+*/
+ostream& DirSink::beginFile( const string& sFileName )
+{
+	m_sFileName = sFileName;
+	m_os.open( m_sDir + "/" + sFileName );
+	if (!m_os.is_open())
+		throw BFileException( BFileException::SystemError );
+	return m_os;
+}
+
+/*: routine DirSink::endFile		Closes the current file		*/
+void DirSink::endFile()
+{
+	Timeline::Span span( "write" );
+	span.arg( "file", m_sFileName );
+	m_os.close();
+	if (m_os.fail())
+		throw BFileException( BFileException::SystemError );
+}
+
+
+/*: class BufferedSink
+
+	DocSink that builds each file in memory, then hands the whole file
+	to writeFile(), for sinks that want complete files (see UringSink).
+*/
+ostream& BufferedSink::beginFile( const string& sFileName )
+{
+	m_sCurrent = sFileName;
+	m_os.str( "" );
+	m_os.clear();
+	return m_os;
+}
+
+void BufferedSink::endFile()
+{
+	writeFile( m_sCurrent, m_os.str() );
+}
+
+void BufferedSink::putFile( const string& sFileName, string sData )
+{
+	writeFile( sFileName, std::move( sData ) );
+}
+
+
+/*: class MemorySink
+
+	DocSink that keeps each file in memory, for programs that embed
+	docgen.  files() maps the file names to their contents.
+*/
+void MemorySink::writeFile( const string& sFileName, string sData )
+{
+	m_mapFiles[sFileName] = std::move( sData );
+}
+
+
+
+/*: class OutputBackends
+
+	The OutputBackend of each format in fFormats (Project::fmtHtml,
+	fmtJson and fmtText), in that order, writing into sink.  The HTML
+	pages take the members that have not changed from pCache, which may
+	be 0, and are minified if fFormats has Project::fmtMinified.  Their
+	source locations link to sSourceLink (see DocItem::getSourceLink()),
+	unless it is empty.  The bytes written are added up as the pages end
+	(see addWritten()).
+*/
+OutputBackends::OutputBackends( DocSink& sink, int fFormats, FragmentCache* pCache,
+                                string_view sSourceLink )
+	:	m_cbWritten( 0 )
+{
+	if (fFormats & Project::fmtHtml)
+		m_vBackends.push_back( new HtmlBackend( sink, pCache, (fFormats & Project::fmtMinified)!=0,
+		                                        sSourceLink ) );
+	if (fFormats & Project::fmtJson)
+		m_vBackends.push_back( new JsonBackend( sink ) );
+	if (fFormats & Project::fmtText)
+		m_vBackends.push_back( new TextBackend( sink ) );
+}
+
+OutputBackends::~OutputBackends()
+{
+	for (size_t i=0; i<m_vBackends.size(); i++)
+		delete m_vBackends[i];
+}
+
+/*: routine OutputBackends::assetsOut
+
+	Writes the files that the pages of each backend share, after the
+	pages.
+*/
+void OutputBackends::assetsOut()
+{
+	for (size_t i=0; i<m_vBackends.size(); i++)
+		m_cbWritten += m_vBackends[i]->assetsOut();
+}
+
+/*: routine OutputBackends::markupSaved
+
+	Returns how many bytes smaller the pages written so far are than in
+	the full markup of their formats.
+*/
+long long OutputBackends::markupSaved() const
+{
+	long long cb = 0;
+
+	for (size_t i=0; i<m_vBackends.size(); i++)
+		cb += m_vBackends[i]->markupSaved();
+	return cb;
+}
 
-	// Heading
-	os << html::defineLink( di.getLinkName() );
-	os << html::heading1( di.getFullDisplayName() );
-
-	// First, prototype
-	it = di.find( "*Prototype" );
-	while (!it.atEof()) {
-		os << html::newPara << html::italicOn;
-		os << html::literal( (*it).value() );
-		os << html::italicOff;
-		++it;
+/*: routine OutputBackends::formatOf
+
+	Returns the format whose files have the extension sExtension (eg:
+	".json"), or 0 if there is none.
+*/
+int OutputBackends::formatOf( string_view sExtension )
+{
+	if (sExtension==".html")
+		return Project::fmtHtml;
+	if (sExtension==".json")
+		return Project::fmtJson;
+	if (sExtension==".txt")
+		return Project::fmtText;
+	return 0;
+}
+
+
+/*: class HtmlBackend
+
+	OutputBackend that writes the HTML pages.  Each item gets a heading,
+	its prototypes in italics, its descriptions, then the other
+	attributes as a definition list.  A class page lists its member
+	functions and variables in tables, with their details after the
+	tables, so the details are kept aside while the tables are written.
+	<P>
+	With a FragmentCache, the table row and details of a member that
+	has not changed since the last run are taken from the cache, and
+	the member's attributes are not asked for.
+	<P>
+	The source location of an item links to sSourceLink, with the item's
+	file and line put in, unless it is empty.
+	<P>
+	If isMinified, the pages are written with the compact markup of
+	HtmlMarkup, and their style is in one stylesheet, scStyleSheet,
+	written by assetsOut().  markupSaved() is then how many bytes the
+	pages are smaller than in the full markup.
+*/
+
+const char HtmlBackend::scStyleSheet[] = "docgen.css";
+
+static const char s_sStyle[] =
+	"body{max-width:43em;margin-left:auto;margin-right:auto;background:white}\n";
+
+/*: class HtmlMarkup
+
+	The markup HtmlBackend writes between the text of a page, as pieces
+	indexed by HtmlBackend::Markup: the full markup of bw::html, with
+	the style and generator in the head of every page, or the compact
+	markup of a minified page, which links to the shared stylesheet,
+	has short tags and leaves out the end tags HTML does not need.
+	<P>
+	The full pieces are cut out of what the html manipulators write for
+	a marker, so they are written exactly as before and each piece is
+	made once, not once for each use.
+*/
+struct HtmlMarkup {
+	string	m_as[HtmlBackend::cMarkup];
+	long long	m_acbSaved[HtmlBackend::cMarkup];	// Full less compact size
+};
+
+static const char s_sMarker[] = "\x01";
+
+/*	markupOf -- internal routine returns what an html manipulator writes */
+template <class Manip>
+static string markupOf( const Manip& manip )
+{
+	std::ostringstream os;
+
+	os << manip;
+	return os.str();
+}
+
+/*	splitMarkup -- internal routine cuts the markup written for the
+			marker into the parts before and after it.
+*/
+static void splitMarkup( const string& sMarkup, string& sBefore, string& sAfter )
+{
+	size_t i = sMarkup.find( s_sMarker );
+
+	bwassert( i!=string::npos );
+	sBefore = sMarkup.substr( 0, i );
+	sAfter = sMarkup.substr( i+sizeof(s_sMarker)-1 );
+}
+
+/*	makeMarkup -- internal routine makes both sets of pieces */
+static void makeMarkup( HtmlMarkup& full, HtmlMarkup& compact )
+{
+	String sMarker( s_sMarker );
+	string* as = full.m_as;
+	string sCell = markupOf( html::beginRow ) + markupOf( html::beginCell );
+	string sLinkEnd, sHeading;
+
+	splitMarkup( markupOf( html::prolog( sMarker, "docgen by Brian Bray" ) ),
+	             as[HtmlBackend::mPage], as[HtmlBackend::mPageTitleEnd] );
+	as[HtmlBackend::mPageEnd] = markupOf( html::epilog );
+	splitMarkup( markupOf( html::defineLink( sMarker ) ), as[HtmlBackend::mHeading], sLinkEnd );
+	splitMarkup( markupOf( html::heading1( sMarker ) ), sHeading, as[HtmlBackend::mHeadingEnd] );
+	as[HtmlBackend::mHeadingName] = sLinkEnd + sHeading;
+	as[HtmlBackend::mPrototype] = markupOf( html::newPara ) + markupOf( html::italicOn );
+	as[HtmlBackend::mPrototypeEnd] = markupOf( html::italicOff );
+	as[HtmlBackend::mPara] = markupOf( html::newPara );
+	as[HtmlBackend::mDefinitions] = markupOf( html::beginDefinitionList );
+	splitMarkup( markupOf( html::definition( sMarker ) ),
+	             as[HtmlBackend::mTerm], as[HtmlBackend::mTermEnd] );
+	as[HtmlBackend::mDefinitionsEnd] = markupOf( html::endDefinitionList );
+	splitMarkup( markupOf( html::heading3( sMarker ) ),
+	             as[HtmlBackend::mListHeading], as[HtmlBackend::mListHeadingEnd] );
+	as[HtmlBackend::mTable] = markupOf( html::beginTable(2) );
+	as[HtmlBackend::mTableEnd] = markupOf( html::endTable );
+	splitMarkup( markupOf( html::beginLink( sMarker ) ),
+	             as[HtmlBackend::mRow], as[HtmlBackend::mRowName] );
+	as[HtmlBackend::mRow].insert( 0, sCell );
+	splitMarkup( markupOf( html::beginLink2Link( sMarker ) ),
+	             as[HtmlBackend::mMemberRow], as[HtmlBackend::mMemberRowName] );
+	as[HtmlBackend::mMemberRow].insert( 0, sCell );
+	as[HtmlBackend::mRowTitle] = markupOf( html::endLink ) + markupOf( html::nextCell );
+	as[HtmlBackend::mRowEnd] = markupOf( html::endCell ) + markupOf( html::endRow );
+	as[HtmlBackend::mRule] = markupOf( html::rule );
+	as[HtmlBackend::mBold] = markupOf( html::boldOn );
+	as[HtmlBackend::mBoldEnd] = markupOf( html::boldOff );
+	splitMarkup( markupOf( html::beginLink( sMarker ) ),
+	             as[HtmlBackend::mLink], as[HtmlBackend::mLinkName] );
+	as[HtmlBackend::mLinkEnd] = markupOf( html::endLink );
+
+	static const char* const s_asCompact[HtmlBackend::cMarkup] = {
+		"<!DOCTYPE html><html><head><meta charset=utf-8><title>",
+		"</title><link rel=stylesheet href=docgen.css></head><body>", "\n",
+		"<h1 id=\"", "\">", "</h1>",
+		"<p><i>", "</i>", "<p>",
+		"<dl>", "<dt>", "<dd>", "</dl>",
+		"<h3>", "</h3>", "<table>", "</table>",
+		"<tr><td><a href=\"", "\">", "<tr><td><a href=\"#", "\">", "</a><td>", "",
+		"<hr>", "<b>", "</b>", "<a href=\"", "\">", "</a>"
+	};
+	for (int m=0; m<HtmlBackend::cMarkup; m++) {
+		compact.m_as[m] = s_asCompact[m];
+		full.m_acbSaved[m] = 0;
+		compact.m_acbSaved[m] = (long long)full.m_as[m].size() - (long long)compact.m_as[m].size();
 	}
-	it = di.find( "Prototype" );
-	while (!it.atEof()) {
-		os << html::newPara << html::italicOn;
-		os << html::literal( (*it).value() );
-		os << html::italicOff;
-		++it;
+}
+
+/*	htmlMarkup -- internal routine returns the full or compact pieces */
+static const HtmlMarkup& htmlMarkup( bool isMinified )
+{
+	static HtmlMarkup s_full, s_compact;
+	static const bool s_isMade = (makeMarkup( s_full, s_compact ), true);
+
+	(void)s_isMade;
+	return isMinified ? s_compact : s_full;
+}
+
+HtmlBackend::HtmlBackend( DocSink& sink, FragmentCache* pCache, bool isMinified,
+                          string_view sSourceLink )
+	:	m_sink( sink ),
+	    m_pCache( pCache ),
+	    m_isMinified( isMinified ),
+	    m_pMarkup( &htmlMarkup( isMinified ) ),
+	    m_cbSaved( 0 ),
+	    m_cbMemberSaved( 0 ),
+	    m_sSourceLink( sSourceLink ),
+	    m_pdi( 0 ),
+	    m_pos( &m_os ),
+	    m_isInDefinitions( false ),
+	    m_isFromCache( false ),
+	    m_key( 0 )
+{
+	// Every item's row and details depend on how they are marked up
+	// and where their source locations link to
+	if (isMinified)
+		m_sKeyVariant = "minified";
+	if (!m_sSourceLink.empty())
+		m_sKeyVariant += "\nlink " + m_sSourceLink;
+}
+
+/*	HtmlBackend::markupOut -- internal routine writes a piece of markup */
+inline void HtmlBackend::markupOut( ostream& os, Markup m )
+{
+	os << m_pMarkup->m_as[m];
+	m_cbSaved += m_pMarkup->m_acbSaved[m];
+}
+
+void HtmlBackend::beginPage( const string& sPageName, const string& sTitle )
+{
+	m_sFileName = sPageName + extension();
+	m_os.str( "" );
+	markupOut( m_os, mPage );
+	m_os << sTitle;
+	markupOut( m_os, mPageTitleEnd );
+}
+
+size_t HtmlBackend::endPage()
+{
+	markupOut( m_os, mPageEnd );
+
+	string sData = m_os.str();
+	size_t cb = sData.size();
+	m_os.str( "" );
+	m_sink.putFile( m_sFileName, std::move( sData ) );
+	return cb;
+}
+
+/*	HtmlBackend::headingOut -- internal routine starts the section of an
+			item, where it can be linked to.
+*/
+void HtmlBackend::headingOut( const DocItem& di )
+{
+	markupOut( *m_pos, mHeading );
+	*m_pos << di.getLinkName();
+	markupOut( *m_pos, mHeadingName );
+	*m_pos << di.getFullDisplayName();
+	markupOut( *m_pos, mHeadingEnd );
+	m_isInDefinitions = false;
+}
+
+/*	HtmlBackend::definitionsOut -- internal routine starts the
+			definition list of the item's other attributes, if it is
+			not started.
+*/
+void HtmlBackend::definitionsOut()
+{
+	if (!m_isInDefinitions) {
+		markupOut( *m_pos, mDefinitions );
+		m_isInDefinitions = true;
 	}
+}
+
+void HtmlBackend::beginItem( const DocItem& di )
+{
+	m_pos = &m_os;
+	m_pdi = &di;
+	headingOut( di );
+}
+
+/*	HtmlBackend::sourceOut -- internal routine writes the source location
+			of the current item, linked to its source if there is a
+			template.
+*/
+void HtmlBackend::sourceOut( ostream& os, string_view sLocation )
+{
+	string sLink = m_pdi ? m_pdi->getSourceLink( m_sSourceLink ) : string();
 
-	// Now, description
-	it = di.find( "*Description" );
-	while (!it.atEof()) {
-		os << html::newPara;
-		os << html::smartFormat( (*it).value() );
-		++it;
+	if (sLink.empty()) {
+		os << HtmlFormat::literal( sLocation );
+		return;
 	}
-	it = di.find( "Description" );
-	while (!it.atEof()) {
-		os << html::newPara;
-		os << html::smartFormat( (*it).value() );
-		++it;
+	markupOut( os, mLink );
+	os << HtmlFormat::attribute( sLink );
+	markupOut( os, mLinkName );
+	os << HtmlFormat::literal( sLocation );
+	markupOut( os, mLinkEnd );
+}
+
+void HtmlBackend::attributeOut( const Attribute& attr, string_view sValue )
+{
+	ostream& os = *m_pos;
+
+	switch (attr.kind()) {
+	case DocSchema::aImpliedPrototype:
+	case DocSchema::aPrototype:
+		markupOut( os, mPrototype );
+		os << HtmlFormat::literal( sValue );
+		markupOut( os, mPrototypeEnd );
+		break;
+	case DocSchema::aImpliedDescription:
+	case DocSchema::aDescription:
+		markupOut( os, mPara );
+		os << HtmlFormat::smartFormat( sValue );
+		break;
+	case DocSchema::aSource:
+		definitionsOut();
+		markupOut( os, mTerm );
+		os << "Source:";
+		markupOut( os, mTermEnd );
+		sourceOut( os, sValue );
+		break;
+	default:
+		definitionsOut();
+		markupOut( os, mTerm );
+		os << attr.keyword() << ':';
+		markupOut( os, mTermEnd );
+		os << HtmlFormat::smartText( sValue );
+		break;
 	}
+}
 
-	// Now, every other attribute
-	os << html::beginDefinitionList;
-
-	it = di.findAll();
-	while (!it.atEof()) {
-		String sKey = (*it).keyword();
-		if (! (	sKey.equalsIgnoreCase("*Prototype") ||
-		        sKey.equalsIgnoreCase("Prototype") ||
-		        sKey.equalsIgnoreCase("*Description") ||
-		        sKey.equalsIgnoreCase("Description") ) ) {
-			os << html::definition( sKey + ":" );
-			os << (*it).value();
-		}
-		++it;
+void HtmlBackend::endItem( const DocItem& di )
+{
+	definitionsOut();
+	markupOut( *m_pos, mDefinitionsEnd );
+}
+
+void HtmlBackend::beginList( ListKind lk, const string& sHeading, size_t cEntries )
+{
+	if (cEntries>0) {
+		markupOut( m_os, mListHeading );
+		m_os << sHeading;
+		markupOut( m_os, mListHeadingEnd );
+	}
+	markupOut( m_os, mTable );
+}
+
+void HtmlBackend::endList( ListKind lk )
+{
+	markupOut( m_os, mTableEnd );
+}
+
+void HtmlBackend::classEntry( const DocClass& cls, ItemTitle& title )
+{
+	markupOut( m_os, mRow );
+	m_os << cls.getFileName();
+	markupOut( m_os, mRowName );
+	m_os << HtmlFormat::literal( cls.getDisplayName() );
+	markupOut( m_os, mRowTitle );
+	m_os << HtmlFormat::smartText( title.value() );
+	markupOut( m_os, mRowEnd );
+}
+
+void HtmlBackend::scopeEntry( const DocScope& scope )
+{
+	markupOut( m_os, mRow );
+	m_os << scope.getFileName();
+	markupOut( m_os, mRowName );
+	m_os << HtmlFormat::literal( scope.getDisplayName() );
+	markupOut( m_os, mRowTitle );
+	markupOut( m_os, mRowEnd );
+}
+
+/*	HtmlBackend::rowOut -- internal routine outputs the index row of a
+			member.
+*/
+void HtmlBackend::rowOut( ostream& os, const DocItem& di, ItemTitle& title )
+{
+	markupOut( os, mMemberRow );
+	os << di.getLinkName();
+	markupOut( os, mMemberRowName );
+	os << HtmlFormat::literal( di.getDisplayName() );
+	markupOut( os, mRowTitle );
+	os << HtmlFormat::smartText( title.value() );
+	markupOut( os, mRowEnd );
+}
+
+/*: routine HtmlBackend::beginMember
+
+	Writes the index row of a member, and starts its details.  Returns
+	false if both came from the cache.
+*/
+bool HtmlBackend::beginMember( const DocItem& di, ItemTitle& title )
+{
+	m_isFromCache = false;
+	m_pdi = &di;
+	if (m_pCache==0) {
+		rowOut( m_os, di, title );
+		m_pos = &m_ssDetails;
+		headingOut( di );
+		return true;
+	}
+
+	AllocStats::Scope allocs( s_siteFragments );
+	m_key = FragmentCache::itemKey( di, m_sKeyVariant );
+	const FragmentCache::Fragments* pfrag = m_pCache->find( m_key );
+	if (pfrag) {
+		m_os << pfrag->m_sRow;
+		m_ssDetails << pfrag->m_sDetail;
+		m_cbSaved += pfrag->m_cbSaved;
+		m_isFromCache = true;
+		return false;
 	}
 
-	os << html::endDefinitionList;
+	// Rendered apart, to be added to the cache
+	std::ostringstream osRow;
+	m_cbMemberSaved = m_cbSaved;
+	rowOut( osRow, di, title );
+	m_sRow = osRow.str();
+	m_os << m_sRow;
+	m_osMember.str( "" );
+	m_pos = &m_osMember;
+	headingOut( di );
+	return true;
+}
+
+void HtmlBackend::endMember( const DocItem& di )
+{
+	if (m_isFromCache)
+		return;
+
+	definitionsOut();
+	markupOut( *m_pos, mDefinitionsEnd );
+	markupOut( *m_pos, mRule );
+	if (m_pos==&m_osMember) {
+		AllocStats::Scope allocs( s_siteFragments );
+		const FragmentCache::Fragments& frag = m_pCache->add( m_key, std::move( m_sRow ),
+		                                                      m_osMember.str(),
+		                                                      m_cbSaved-m_cbMemberSaved );
+		m_ssDetails << frag.m_sDetail;
+	}
+}
+
+void HtmlBackend::beginGlobals( const string& sHeading, bool hasGlobals )
+{
+	markupOut( m_os, mRule );
+	markupOut( m_os, mListHeading );
+	m_os << sHeading;
+	markupOut( m_os, mListHeadingEnd );
+	if (!hasGlobals) {
+		markupOut( m_os, mBold );
+		m_os << "No Global functions or variables";
+		markupOut( m_os, mBoldEnd );
+	}
+}
+
+/*: routine HtmlBackend::endBody
+
+	Ends the page of a class (or the globals) with the details of its
+	members, after the tables.
+*/
+void HtmlBackend::endBody( const DocClass& cls )
+{
+	markupOut( m_os, mRule );
+	if (m_ssDetails.tellp()>0)
+		m_os << m_ssDetails.rdbuf();
+	m_ssDetails.str( "" );
+	m_ssDetails.clear();
+	m_pos = &m_os;
+}
+
+/*: routine HtmlBackend::assetsOut
+
+	Writes the stylesheet of minified pages, whose size counts against
+	what they saved.  Full pages have their style in each page, and no
+	assets.
+*/
+size_t HtmlBackend::assetsOut()
+{
+	size_t cb = sizeof(s_sStyle)-1;
 
-	return os;
+	if (!m_isMinified)
+		return 0;
+	m_sink.putFile( scStyleSheet, s_sStyle );
+	m_cbSaved -= cb;
+	return cb;
 }
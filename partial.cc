@@ -0,0 +1,333 @@
+/* partial.cc  -- Partial Projects for sharded runs
+
+Copyright (C) 2017, Brian Bray
+
+*/
+
+#include <atomic>
+#include <cctype>
+#include <fstream>
+#include <istream>
+#include <ostream>
+#include <list>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "bw/bwassert.h"
+#include "bw/countable.h"
+#include "bw/exception.h"
+#include "allocstats.h"
+#include "lexstream.h"
+#include "schema.h"
+#include "docitem.h"
+
+using bw::BFileException;
+using std::istream;
+using std::ostream;
+using std::string;
+
+static AllocStats::Site s_sitePartialIn( "Project::partialIn", AllocStats::oOther );
+
+/*: class Project
+
+	A Project can be written out before any HTML is generated, as a
+	"partial", and partials read back and merged into one Project.  This
+	lets the input phase of a large run be split over several processes
+	or machines:
+	<PRE>
+		docgen --emit-partial shard.1.db a.h b.h
+		docgen --emit-partial shard.2.db c.h
+		docgen --merge out shard.1.db shard.2.db
+	</PRE>
+	Merging partials in order gives the same Project as a single run over
+	all of the files in that order.
+	<P>
+	A partial is text: a header line, then one record per DocItem.  Every
+	string is written as its length, a colon and the bytes, so attribute
+	values need no quoting.  The project and class records are followed
+	by "S" records naming the input files of their doc blocks, which
+	version 1 partials do not have.
+*/
+
+static const char scPartialHeader[] = "docgen-partial 2";
+static const char scPartialHeader1[] = "docgen-partial 1";
+
+/*	writeString -- internal routine writes a length prefixed string */
+static void writeString( ostream& os, std::string_view s )
+{
+	os << ' ' << s.size() << ':' << s;
+}
+
+/*	readString -- internal routine reads a string written by writeString
+
+	Throws: if the input is truncated or not in partial format
+*/
+static void readString( istream& is, string& s )
+{
+	size_t cb;
+
+	if (!(is >> cb) || is.get()!=':')
+		throw BFileException( BFileException::SystemError );
+	s.resize( cb );
+	if (cb && !is.read( &s[0], cb ))
+		throw BFileException( BFileException::SystemError );
+}
+
+
+/*	sourcesOut -- internal routine writes an "S" record for each file */
+static void sourcesOut( ostream& os, const DocItem::SourceSet& setSources )
+{
+	DocItem::SourceSet::const_iterator it;
+	for (it=setSources.begin(); it!=setSources.end(); ++it) {
+		os << 'S';
+		writeString( os, *it );
+		os << '\n';
+	}
+}
+
+
+/*: routine Project::partialOut
+
+	Writes the whole Project to os in partial format.  Classes and
+	members are written in name order, so the same Project always gives
+	the same partial.
+*/
+void Project::partialOut( ostream& os ) const
+{
+	partialProjectOut( os );
+
+	std::vector<DocClass*> vClasses;
+	m_scopeRoot.classesOf( vClasses );
+	for (size_t i=0; i<vClasses.size(); i++)
+		vClasses[i]->partialOut( os );
+	os << ".\n";
+}
+
+/*	Project::partialProjectOut -- internal routine starts a partial with
+			the header and the project record.
+*/
+void Project::partialProjectOut( ostream& os ) const
+{
+	os << scPartialHeader << '\n';
+
+	os << 'P';
+	writeString( os, m_sItemName );
+	partialItemOut( os );
+	sourcesOut( os, m_setSources );
+}
+
+/*: routine Project::partialClassOut
+
+	Writes a partial holding just one class and its members, without the
+	project itself.  Several of these may follow each other in one file;
+	partialIn() reads one at a time.
+*/
+void Project::partialClassOut( ostream& os, const DocClass& cls )
+{
+	os << scPartialHeader << '\n';
+	cls.partialOut( os );
+	os << ".\n";
+}
+
+/*: routine Project::partialIn
+
+	Reads a partial written by partialOut() into this Project, which
+	should be empty.  Use merge() to combine it with other partials.
+
+	Throws: if the input is truncated or not a partial
+*/
+void Project::partialIn( istream& is )
+{
+	AllocStats::Scope allocs( s_sitePartialIn );
+	string sHeader;
+
+	is >> std::ws;
+	std::getline( is, sHeader );
+	if (sHeader!=scPartialHeader && sHeader!=scPartialHeader1)
+		throw BFileException( BFileException::SystemError );
+
+	DocClass* pcls = 0;				// Owner of the following members
+	char chKind = 0;
+	while (is >> chKind && chKind!='.') {
+		string sName;
+		DocItem* pdi;
+
+		readString( is, sName );
+		if (chKind=='S') {			// Source of the record before
+			if (pcls)
+				pcls->addSource( sName );
+			else
+				addSource( sName );
+			continue;
+		}
+		switch (chKind) {
+		case 'P':
+			m_sItemName = sName;
+			pdi = this;
+			break;
+
+		case 'C':
+			pcls = getClass( sName );
+			pdi = pcls;
+			break;
+
+		case 'F':
+		case 'V':
+			if (pcls==0)
+				throw BFileException( BFileException::SystemError );
+			if (chKind=='F')
+				pdi = pcls->getFunction( sName );
+			else
+				pdi = pcls->getVariable( sName );
+			break;
+
+		default:
+			throw BFileException( BFileException::SystemError );
+		}
+		pdi->partialItemIn( is );
+	}
+	if (chKind!='.' || !is)
+		throw BFileException( BFileException::SystemError );
+}
+
+/*: routine Project::merge
+
+	Adds the DocItems of proj, which was read from a later partial, to
+	this Project.  See DocItem::mergeItem() for how each item is merged.
+	The project name is taken from proj if proj documents the project,
+	and the source files of the project and of each class are added.
+*/
+void Project::merge( const Project& proj )
+{
+	mergeItem( proj );
+	if (proj.getSourceLine()!=0)
+		m_sItemName = proj.m_sItemName;
+	m_setSources.insert( proj.m_setSources.begin(), proj.m_setSources.end() );
+
+	std::vector<DocClass*> vClasses;
+	proj.m_scopeRoot.classesOf( vClasses );
+	for (size_t i=0; i<vClasses.size(); i++) {
+		const DocClass& cls = *vClasses[i];
+		DocClass* pcls = getClass( cls.getName() );
+
+		pcls->mergeItem( cls );
+		pcls->m_setSources.insert( cls.m_setSources.begin(), cls.m_setSources.end() );
+
+		DocClass::FunctionMap::const_iterator itf;
+		for (itf=cls.m_mapFunctions.begin(); itf!=cls.m_mapFunctions.end(); ++itf)
+			pcls->getFunction( (*itf).first )->mergeItem( *(*itf).second );
+
+		DocClass::VariableMap::const_iterator itv;
+		for (itv=cls.m_mapVariables.begin(); itv!=cls.m_mapVariables.end(); ++itv)
+			pcls->getVariable( (*itv).first )->mergeItem( *(*itv).second );
+	}
+}
+
+
+/*: routine DocClass::partialOut
+
+	Writes the records of the class and its members.
+*/
+void DocClass::partialOut( ostream& os ) const
+{
+	os << 'C';
+	writeString( os, m_sItemName );
+	partialItemOut( os );
+	sourcesOut( os, m_setSources );
+
+	FunctionMap::const_iterator itf;
+	for (itf=m_mapFunctions.begin(); itf!=m_mapFunctions.end(); ++itf) {
+		os << 'F';
+		writeString( os, (*itf).first );
+		(*itf).second->partialItemOut( os );
+	}
+
+	VariableMap::const_iterator itv;
+	for (itv=m_mapVariables.begin(); itv!=m_mapVariables.end(); ++itv) {
+		os << 'V';
+		writeString( os, (*itv).first );
+		(*itv).second->partialItemOut( os );
+	}
+}
+
+
+/*: routine DocItem::partialItemOut
+
+	Writes the link name, source location and attributes of this item in
+	partial format.  The record kind and name are written by the caller.
+*/
+void DocItem::partialItemOut( ostream& os ) const
+{
+	writeString( os, m_sLinkName );
+	writeString( os, m_sSourceFile );
+	os << ' ' << m_nSourceLine << ' ' << m_attribs.size() << '\n';
+
+	string sValue;
+	Attribs::const_iterator it;
+	for (it=m_attribs.begin(); it!=m_attribs.end(); ++it) {
+		writeString( os, (*it).keyword() );
+		writeString( os, (*it).value( sValue ) );
+		os << '\n';
+	}
+}
+
+/*: routine DocItem::partialItemIn
+
+	Reads what partialItemOut() wrote into this item.
+
+	Throws: if the input is truncated or not in partial format
+*/
+void DocItem::partialItemIn( istream& is )
+{
+	size_t cAttribs;
+
+	readString( is, m_sLinkName );
+	readString( is, m_sSourceFile );
+	if (!(is >> m_nSourceLine >> cAttribs))
+		throw BFileException( BFileException::SystemError );
+
+	for (size_t i=0; i<cAttribs; i++) {
+		string sKeyword;
+		string sValue;
+
+		readString( is, sKeyword );
+		readString( is, sValue );
+		addAttribute( std::move(sKeyword), std::move(sValue) );
+	}
+}
+
+/*: routine DocItem::mergeItem
+
+	Appends the attributes of di, the same item from a later partial,
+	as if its doc blocks had followed ours in a single run:
+	<UL>
+	<LI>The link name of the last documented item wins.
+	<LI>The source location of the first one is kept, and a later
+	"*Source" attribute is dropped.
+	<LI>Once a "Prototype" attribute has been seen, a single run does not
+	extract prototypes for the item, so a later "*Prototype" is dropped.
+	</UL>
+*/
+void DocItem::mergeItem( const DocItem& di )
+{
+	Attribs::const_iterator it;
+	for (it=di.m_attribs.begin(); it!=di.m_attribs.end(); ++it) {
+		if (m_cPrototypes>0 && (*it).kind()==DocSchema::aImpliedPrototype)
+			continue;
+		if (m_nSourceLine!=0 && (*it).kind()==DocSchema::aSource)
+			continue;
+		addAttribute( *it );
+	}
+
+	if (di.m_nSourceLine!=0) {		// Only documented items set these
+		m_sLinkName = di.m_sLinkName;
+		if (m_nSourceLine==0) {
+			m_sSourceFile = di.m_sSourceFile;
+			m_nSourceLine = di.m_nSourceLine;
+		}
+	}
+}
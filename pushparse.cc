@@ -0,0 +1,242 @@
+/* pushparse.cc  -- Parsing an input given a chunk at a time
+
+Copyright (C) 2017, Brian Bray
+
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <istream>
+#include <ostream>
+#include <sstream>
+#include <list>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "bw/countable.h"
+#include "allocstats.h"
+#include "lexstream.h"
+#include "schema.h"
+#include "docitem.h"
+#include "docsink.h"
+#include "fragcache.h"
+#include "depfile.h"
+#include "timeline.h"
+#include "uringsink.h"
+#include "stageddir.h"
+#include "docgen.h"
+#include "pushparse.h"
+
+using std::string;
+
+enum {
+	WindowSize		= 65536,	// Input gathered before a parse is tried
+	MaxLookahead	= 16,		// Furthest a scan looks past where it stops
+};
+
+static AllocStats::Site s_siteChunkIn( "PushParser::chunkIn", AllocStats::oOther );
+
+/*: class PushParser
+
+	Parses an input that cannot be read all at once, such as a pipe or
+	an editor buffer that arrives in pieces.  The chunks may be split
+	anywhere, even within a "/ * :" or a "* /", and the result is the
+	same as for the whole input in a LexStream, with the same
+	diagnostics and locations.
+	<P>
+	Chunks are gathered in a window.  Once it is big enough, it is parsed
+	into a scratch Project to find how much of it is finished: the doc
+	blocks, and the prototypes after them, whose reading stopped at
+	least MaxLookahead short of the end, so that no more input could
+	change them.  Only those are then parsed into the project, since a
+	DocParser adds to its project as it reads.  What is left, from the
+	start of the first unfinished block, or from where the search for
+	one got to, is kept for the next chunks.
+	<P>
+	A window is parsed again when it has grown by its own size or by
+	WindowSize, whichever is more, so a block longer than a window is not
+	read over and over.  Attribute text is made as it is read, as the
+	window does not last (see LexStream::getAttributeText()).
+*/
+
+/*: routine PushParser::PushParser
+
+	Constructor.  sourceName is the name of the input in diagnostics
+	and source locations.
+*/
+PushParser::PushParser( Project& proj, const DocSchema& schema, const char* sourceName )
+	:	m_project( proj ),
+	    m_schema( schema ),
+	    m_sName( sourceName ),
+	    m_posDiag( 0 ),
+	    m_cMaxErrors( DocGen::DefaultMaxErrors ),
+	    m_cbNextParse( WindowSize ),
+	    m_nLine( 1 ),
+	    m_nColumn( 1 ),
+	    m_cbInput( 0 ),
+	    m_cErrors( 0 ),
+	    m_cBlocks( 0 ),
+	    m_isSkipping( false )
+{
+}
+
+/*: routine PushParser::setDiagnostics
+
+	Sets the stream for syntax errors (0 for none) and the number of
+	errors in the input after which the rest of it is skipped.
+*/
+void PushParser::setDiagnostics( std::ostream* posDiag, int cMaxErrors )
+{
+	m_posDiag = posDiag;
+	m_cMaxErrors = cMaxErrors;
+}
+
+/*: routine PushParser::chunkIn
+
+	Adds the next cbData characters of the input, and parses the doc
+	blocks they finish.  The data is copied, so it only needs to remain
+	valid during the call.
+*/
+void PushParser::chunkIn( const char* pData, size_t cbData )
+{
+	m_cbInput += cbData;
+	while (cbData>0 && !m_isSkipping) {
+		size_t cb = std::min( cbData, m_cbNextParse-m_sWindow.size() );
+		{
+			AllocStats::Scope allocs( s_siteChunkIn );
+			m_sWindow.append( pData, cb );
+		}
+		pData += cb;
+		cbData -= cb;
+		if (m_sWindow.size()>=m_cbNextParse)
+			windowIn( false );
+	}
+}
+
+/*: routine PushParser::end
+
+	Parses the rest of the input, as its end.
+*/
+void PushParser::end()
+{
+	if (!m_isSkipping)
+		windowIn( true );
+	string().swap( m_sWindow );
+}
+
+/*	PushParser::windowIn -- internal routine parses what is finished in
+			the window, or all of it if isLast, and drops what is done with.
+*/
+void PushParser::windowIn( bool isLast )
+{
+	Timeline::Span span( "parse" );
+	const char* pData = m_sWindow.data();
+	size_t cbData = m_sWindow.size();
+	size_t cReads = 0;
+	size_t cbFinished = cbData;
+
+	if (!isLast)
+		cbFinished = finishedIn( pData, cbData, cReads );
+
+	LexStream lex( pData, cbData, m_sName.c_str() );
+	DocParser parser( lex, m_project, m_schema );
+
+	lex.setStartLocation( m_nLine, m_nColumn );
+	parser.setDiagnostics( m_posDiag, m_cMaxErrors-m_cErrors );
+	if (isLast) {
+		parser.parse();
+	} else {
+		for (size_t i=0; i<cReads; i++)
+			parser.parseNext();
+		if (parser.errorCount()>=m_cMaxErrors-m_cErrors) {
+			parser.parseNext();			// Reports it
+			m_isSkipping = true;
+		}
+	}
+	m_cErrors += parser.errorCount();
+	m_cBlocks += parser.blockCount();
+
+	span.arg( "file", m_sName );
+	span.arg( "bytes", (long long)cbData );
+	span.arg( "blocks", parser.blockCount() );
+
+	if (isLast || m_isSkipping) {
+		m_sWindow.clear();
+		return;
+	}
+
+	size_t cbDone = resumeAt( pData, cbData, cbFinished );
+	skipLines( pData, cbDone );
+	m_sWindow.erase( 0, cbDone );
+	m_cbNextParse = m_sWindow.size() + std::max( m_sWindow.size(), (size_t)WindowSize );
+}
+
+/*	PushParser::finishedIn -- internal routine returns how much of the
+			input pData a parse of it finishes, and in cReads the number of
+			DocParser::parseNext() calls that read it.  The parse is into
+			a scratch Project, without diagnostics.
+*/
+size_t PushParser::finishedIn( const char* pData, size_t cbData, size_t& cReads ) const
+{
+	Project projScratch;
+	LexStream lex( pData, cbData, m_sName.c_str() );
+	DocParser parser( lex, projScratch, m_schema );
+	size_t cbFinished = 0;
+
+	parser.setDiagnostics( 0, m_cMaxErrors-m_cErrors );
+	cReads = 0;
+	while (parser.parseNext() && !lex.atEof() && lex.offset()+MaxLookahead<=cbData) {
+		cbFinished = lex.offset();
+		cReads++;
+	}
+	return cbFinished;
+}
+
+/*	PushParser::resumeAt -- internal routine returns where, at or after
+			iFrom, the search of pData for the next start symbol can start
+			over with more input: at the start symbol, if there is one.
+
+	Otherwise it is past everything the search is done with.  A '/' in
+	the last two characters may begin a start symbol with the next
+	chunk, or may be part of one that is not, so the search must see
+	it again.
+*/
+size_t PushParser::resumeAt( const char* pData, size_t cbData, size_t iFrom ) const
+{
+	LexStream lex( pData+iFrom, cbData-iFrom, m_sName.c_str() );
+	Token tok;
+
+	lex.getStartSymbol( tok );
+	if (tok.type()==Token::Symbol)
+		return iFrom + lex.startOffset();
+
+	size_t i = cbData;
+	while (i>iFrom && (pData[i-1]=='/' || (i-1>iFrom && pData[i-2]=='/')))
+		i--;
+	return i;
+}
+
+/*	PushParser::skipLines -- internal routine moves the location of the
+			start of the window past cbData characters of it.
+*/
+void PushParser::skipLines( const char* pData, size_t cbData )
+{
+	const char* p = pData;
+	const char* pEnd = pData+cbData;
+	const char* pNewline;
+
+	while ((pNewline = (const char*)memchr( p, '\n', pEnd-p ))!=0) {
+		m_nLine++;
+		m_nColumn = 1;
+		p = pNewline+1;
+	}
+	m_nColumn += int(pEnd-p);
+}
@@ -0,0 +1,62 @@
+/* pushparse.h -- Parsing an input given a chunk at a time
+
+Copyright (C) 2017, Brian Bray
+
+*/
+
+/* Needs:
+#include <ostream>
+#include <string>
+#include "schema.h"
+#include "docitem.h"
+*/
+
+//	Parses the special comments of one input as it arrives, in chunks
+//	split anywhere, keeping only the input from the start of the doc
+//	block not yet finished.
+class PushParser {
+public:
+	PushParser( Project& proj, const DocSchema& schema, const char* sourceName );
+
+	void setDiagnostics( std::ostream* posDiag, int cMaxErrors );
+	void chunkIn( const char* pData, size_t cbData );
+	void end();
+
+	const std::string& name() const {
+		return m_sName;
+	}
+	int errorCount() const {
+		return m_cErrors;
+	}
+	int blockCount() const {
+		return m_cBlocks;
+	}
+	long long size() const {
+		return m_cbInput;
+	}
+
+private:
+	void windowIn( bool isLast );
+	size_t finishedIn( const char* pData, size_t cbData, size_t& cReads ) const;
+	size_t resumeAt( const char* pData, size_t cbData, size_t iFrom ) const;
+	void skipLines( const char* pData, size_t cbData );
+
+	PushParser( const PushParser& );				// Not copyable
+	PushParser& operator=( const PushParser& );
+
+private:
+	Project&			m_project;
+	const DocSchema&	m_schema;
+	std::string			m_sName;		// Of the input, for diagnostics
+	std::ostream*		m_posDiag;
+	int					m_cMaxErrors;
+
+	std::string			m_sWindow;		// Input not yet parsed
+	size_t				m_cbNextParse;	// Size of m_sWindow to parse at
+	int					m_nLine;		// Of the first character of m_sWindow
+	int					m_nColumn;
+	long long			m_cbInput;		// Given so far
+	int					m_cErrors;
+	int					m_cBlocks;
+	bool				m_isSkipping;	// Too many errors, the rest is ignored
+};
@@ -0,0 +1,289 @@
+/* schema.cc  -- The keywords docgen recognizes in special comments
+
+Copyright (C) 2017, Brian Bray
+
+*/
+
+#include <cctype>
+#include <istream>
+#include <ostream>
+#include <list>
+#include <map>
+#include <memory>
+#include <set>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "bw/bwassert.h"
+#include "bw/countable.h"
+#include "lexstream.h"
+#include "schema.h"
+#include "docitem.h"
+
+using std::string;
+using std::string_view;
+
+/*: class DocSchema
+
+	The keywords of the doc comment grammar.  These are the DocItem types
+	that may start a special comment:
+	<PRE>
+		Project  Class  Function  Member  Routine  Variable
+	</PRE>
+	and the attribute keywords which are output specially:
+	<PRE>
+		Prototype  Description  Title
+	</PRE>
+	together with the attributes docgen adds itself (*Prototype,
+	*Description and *Source).
+	<P>
+	The built in keywords are in a perfect hash table computed by the
+	compiler, so recognizing one takes a hash and a single compare.
+	More item types can be added from a config file with readConfig(),
+	eg: "Enum Variable" to document enums like variables.  They go into a
+	second perfect hash table, built when they are added.
+*/
+
+// Entries of the built in keyword table
+enum EntryKind {kItemType, kAttribute};
+
+struct SchemaEntry {
+	const char*		m_sKeyword;
+	EntryKind		m_ek;
+	int				m_nValue;		// ItemType or AttributeKind
+};
+
+static constexpr SchemaEntry s_aBuiltIns[] = {
+	{ "Project",		kItemType,	DocSchema::tProject },
+	{ "Class",			kItemType,	DocSchema::tClass },
+	{ "Variable",		kItemType,	DocSchema::tVariable },
+	{ "Function",		kItemType,	DocSchema::tFunction },
+	{ "Member",			kItemType,	DocSchema::tFunction },
+	{ "Routine",		kItemType,	DocSchema::tFunction },
+	{ "Prototype",		kAttribute,	DocSchema::aPrototype },
+	{ "Description",	kAttribute,	DocSchema::aDescription },
+	{ "Title",			kAttribute,	DocSchema::aTitle },
+	{ "*Prototype",		kAttribute,	DocSchema::aImpliedPrototype },
+	{ "*Description",	kAttribute,	DocSchema::aImpliedDescription },
+	{ "*Source",		kAttribute,	DocSchema::aSource }
+};
+static constexpr int numBuiltIns = sizeof(s_aBuiltIns)/sizeof(s_aBuiltIns[0]);
+
+/*	keywordHash -- internal routine is a case insensitive FNV-1a hash,
+			varied by nSeed until a table has no collisions.
+*/
+static constexpr unsigned keywordHash( string_view sKeyword, unsigned nSeed )
+{
+	unsigned nHash = 2166136261u ^ nSeed;
+	for (size_t i=0; i<sKeyword.size(); i++) {
+		char ch = sKeyword[i];
+		if (ch>='A' && ch<='Z')
+			ch = ch - 'A' + 'a';
+		nHash = (nHash ^ (unsigned char)ch) * 16777619u;
+	}
+	return nHash;
+}
+
+// The built in table, with the seed that makes it perfect
+struct BuiltInTable {
+	enum {NumSlots=32};				// Power of 2, over twice numBuiltIns
+
+	unsigned		m_nSeed;
+	signed char		m_aSlots[NumSlots];		// Index into s_aBuiltIns or -1
+};
+
+static constexpr BuiltInTable makeBuiltInTable()
+{
+	for (unsigned nSeed=0; ; nSeed++) {
+		BuiltInTable tbl = { nSeed, {} };
+		bool isPerfect = true;
+
+		for (int i=0; i<BuiltInTable::NumSlots; i++)
+			tbl.m_aSlots[i] = -1;
+		for (int i=0; i<numBuiltIns && isPerfect; i++) {
+			unsigned nSlot = keywordHash( s_aBuiltIns[i].m_sKeyword, nSeed ) % BuiltInTable::NumSlots;
+			if (tbl.m_aSlots[nSlot]>=0)
+				isPerfect = false;
+			tbl.m_aSlots[nSlot] = i;
+		}
+		if (isPerfect)
+			return tbl;
+	}
+}
+
+static constexpr BuiltInTable s_tblBuiltIns = makeBuiltInTable();
+
+/*	findBuiltIn -- internal routine returns the built in entry for a
+			keyword, or 0.
+*/
+static const SchemaEntry* findBuiltIn( string_view sKeyword )
+{
+	unsigned nSlot = keywordHash( sKeyword, s_tblBuiltIns.m_nSeed ) % BuiltInTable::NumSlots;
+	int i = s_tblBuiltIns.m_aSlots[nSlot];
+
+	if (i>=0 && equalsIgnoreCase( sKeyword, s_aBuiltIns[i].m_sKeyword ))
+		return &s_aBuiltIns[i];
+	return 0;
+}
+
+
+/*: routine DocSchema::DocSchema		Constructor, built in keywords only	*/
+DocSchema::DocSchema()
+	:	m_nSeed( 0 )
+{
+}
+
+/*: routine DocSchema::findItemType
+
+	Looks up an item type keyword, built in or added.  Returns false if
+	sKeyword is not one.
+*/
+bool DocSchema::findItemType( string_view sKeyword, ItemType& type ) const
+{
+	const SchemaEntry* pse = findBuiltIn( sKeyword );
+	if (pse) {
+		if (pse->m_ek!=kItemType)
+			return false;
+		type = (ItemType)pse->m_nValue;
+		return true;
+	}
+
+	if (m_vUserTypes.empty())
+		return false;
+
+	unsigned nSlot = keywordHash( sKeyword, m_nSeed ) & (m_vSlots.size()-1);
+	int i = m_vSlots[nSlot];
+	if (i>=0 && equalsIgnoreCase( sKeyword, m_vUserTypes[i].m_sKeyword )) {
+		type = m_vUserTypes[i].m_type;
+		return true;
+	}
+	return false;
+}
+
+/*: routine DocSchema::attributeKind
+
+	Returns the special meaning of an attribute keyword, or aOther.
+	Attributes cannot be added, so this does not need a DocSchema.
+*/
+DocSchema::AttributeKind DocSchema::attributeKind( string_view sKeyword )
+{
+	const SchemaEntry* pse = findBuiltIn( sKeyword );
+
+	if (pse && pse->m_ek==kAttribute)
+		return (AttributeKind)pse->m_nValue;
+	return aOther;
+}
+
+/*: routine DocSchema::attributeKeyword
+
+	Returns the keyword docgen stores an attribute under.  Returns "" for
+	aOther.
+*/
+const char* DocSchema::attributeKeyword( AttributeKind ak )
+{
+	for (int i=0; i<numBuiltIns; i++)
+		if (s_aBuiltIns[i].m_ek==kAttribute && s_aBuiltIns[i].m_nValue==ak)
+			return s_aBuiltIns[i].m_sKeyword;
+	return "";
+}
+
+/*: routine DocSchema::addItemType
+
+	Adds sKeyword as an item type that is documented as the built in type
+	sAs (eg: "Macro" as "Function").  Returns false, and adds nothing, if
+	sAs is not a built in item type, or sKeyword is already a keyword or
+	is not an identifier.
+*/
+bool DocSchema::addItemType( string_view sKeyword, string_view sAs )
+{
+	const SchemaEntry* pseAs = findBuiltIn( sAs );
+	ItemType type;
+
+	if (pseAs==0 || pseAs->m_ek!=kItemType)
+		return false;
+	if (sKeyword.empty() || findBuiltIn( sKeyword ) || findItemType( sKeyword, type ))
+		return false;
+	for (size_t i=0; i<sKeyword.size(); i++)
+		if (!(sKeyword[i]=='_' || isalnum( (unsigned char)sKeyword[i] )))
+			return false;			// Would never be scanned as one token
+
+	UserType ut;
+	ut.m_sKeyword = sKeyword;
+	ut.m_type = (ItemType)pseAs->m_nValue;
+	m_vUserTypes.push_back( ut );
+	rehash();
+	return true;
+}
+
+/*	DocSchema::rehash -- internal routine rebuilds the perfect hash of the
+			added item types.
+*/
+void DocSchema::rehash()
+{
+	size_t cSlots = 4;
+	while (cSlots<2*m_vUserTypes.size())
+		cSlots *= 2;
+
+	for (m_nSeed=0; ; m_nSeed++) {
+		bool isPerfect = true;
+
+		m_vSlots.assign( cSlots, -1 );
+		for (size_t i=0; i<m_vUserTypes.size() && isPerfect; i++) {
+			unsigned nSlot = keywordHash( m_vUserTypes[i].m_sKeyword, m_nSeed ) & (cSlots-1);
+			if (m_vSlots[nSlot]>=0)
+				isPerfect = false;
+			m_vSlots[nSlot] = (int)i;
+		}
+		if (isPerfect)
+			return;
+		if (m_nSeed%64==63)
+			cSlots *= 2;				// Keeps the search short
+	}
+}
+
+/*: routine DocSchema::readConfig
+
+	Adds item types from a config file.  Each line is a new keyword and
+	the built in type it is documented as:
+	<PRE>
+		# Extra item types
+		Enum		Variable
+		Macro		Function
+		Typedef		Class
+	</PRE>
+	Blank lines and lines starting with '#' are ignored.  Bad lines are
+	reported to posDiag (if not 0) as "name:line: error: ..." and skipped.
+
+	Returns: the number of bad lines
+*/
+int DocSchema::readConfig( std::istream& is, const string& sName, std::ostream* posDiag )
+{
+	string sLine;
+	int nLine = 0;
+	int cErrors = 0;
+
+	while (std::getline( is, sLine )) {
+		std::istringstream isLine( sLine );
+		string sKeyword;
+		string sAs;
+		string sExtra;
+
+		nLine++;
+		if (!(isLine >> sKeyword) || sKeyword[0]=='#')
+			continue;
+
+		const char* sError = 0;
+		if (!(isLine >> sAs) || (isLine >> sExtra))
+			sError = "expected <keyword> <item type>";
+		else if (!addItemType( sKeyword, sAs ))
+			sError = "unknown item type, or keyword already defined or not an identifier";
+		if (sError) {
+			++cErrors;
+			if (posDiag)
+				*posDiag << sName << ":" << nLine << ": error: " << sError << std::endl;
+		}
+	}
+	return cErrors;
+}
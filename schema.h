@@ -0,0 +1,51 @@
+/* schema.h -- The keywords docgen recognizes in special comments
+
+Copyright (C) 2017, Brian Bray
+
+*/
+
+/* Needs:
+#include <istream>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+*/
+
+//	The DocItem type keywords (eg: "class", "routine") and the attribute
+//	keywords that docgen treats specially (eg: "Prototype").  Keywords are
+//	case insensitive and are found with a perfect hash.
+class DocSchema {
+public:
+	enum ItemType {tProject, tClass, tFunction, tVariable};
+	enum AttributeKind {
+		aOther,					// Any keyword without a special meaning
+		aPrototype,				// "Prototype"
+		aDescription,			// "Description"
+		aTitle,					// "Title"
+		aImpliedPrototype,		// "*Prototype", found after the comment
+		aImpliedDescription,	// "*Description", text before any keyword
+		aSource					// "*Source", where the item was documented
+	};
+
+	DocSchema();
+
+	bool findItemType( std::string_view sKeyword, ItemType& type ) const;
+	static AttributeKind attributeKind( std::string_view sKeyword );
+	static const char* attributeKeyword( AttributeKind ak );
+
+	bool addItemType( std::string_view sKeyword, std::string_view sAs );
+	int readConfig( std::istream& is, const std::string& sName, std::ostream* posDiag );
+
+private:
+	void rehash();
+
+private:
+	struct UserType {
+		std::string		m_sKeyword;
+		ItemType		m_type;
+	};
+	std::vector< UserType >	m_vUserTypes;	// From readConfig()
+	std::vector< int >		m_vSlots;		// Index into m_vUserTypes or -1
+	unsigned				m_nSeed;		// Makes the hash of m_vSlots perfect
+};
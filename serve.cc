@@ -0,0 +1,468 @@
+/* serve.cc  -- Serving a Project's pages over HTTP as they are requested
+
+Copyright (C) 2017, Brian Bray
+
+*/
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <list>
+#include <map>
+#include <set>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "bw/countable.h"
+#include "bw/exception.h"
+#include "lexstream.h"
+#include "schema.h"
+#include "docitem.h"
+#include "docsink.h"
+#include "timeline.h"
+#include "serve.h"
+
+using bw::BFileException;
+using std::string;
+using std::string_view;
+
+/*: class DocServer
+
+	Writing every page of a large project takes minutes, when someone
+	reviewing a branch only looks at a few of them.  A DocServer keeps
+	the parsed Project in memory and renders a page when it is asked
+	for, with "docgen --serve 127.0.0.1:8080 *.h".
+	<P>
+	Rendered pages are kept in a cache, up to a total size, and the
+	least recently used page is dropped first, so a page that has been
+	asked for before is sent without any rendering.  Connections are
+	handed to a pool of threads, each serving one connection at a time
+	for as long as the client keeps it alive (HTTP/1.1 keep-alive), or
+	until it has been idle for IdleSeconds.  A client that sends a
+	request slowly is cut off once its request line and headers have
+	taken RequestSeconds.  Pages that are not cached
+	are rendered by the threads at the same time, which is safe as
+	rendering only reads the Project (see Project::fileOut()).  So the
+	Project must not have a FragmentCache, and main() rejects --serve
+	with --cache.
+	<P>
+	Only GET and HEAD are served.  "/" is index.html.  Any page may be
+	asked for as .json or .txt instead, in that format (see
+	OutputBackend).
+*/
+
+enum {
+	IdleSeconds = 5,				// A keep-alive connection is closed after this
+	RequestSeconds = 10,			// To receive a request line and headers
+	MaxRequestBytes = 16384			// Of a request line and headers
+};
+
+typedef std::shared_ptr<const string>	PagePtr;
+
+struct DocServer::State {
+	const Project&			m_proj;
+	int						m_fdListen;
+
+	// Connections waiting for a thread
+	std::mutex				m_mutexQueue;
+	std::condition_variable	m_cvQueue;
+	std::deque<int>			m_dqConnections;
+	std::vector<std::thread>	m_vThreads;
+
+	// Rendered pages, most recently used first
+	typedef std::list< std::pair<string, PagePtr> >	PageList;
+	std::mutex				m_mutexCache;
+	PageList				m_lstPages;
+	std::unordered_map< string, PageList::iterator >	m_mapPages;
+	size_t					m_cbCached;
+	size_t					m_cbMaxCached;
+
+	State( const Project& proj )
+		:	m_proj( proj ), m_fdListen( -1 ), m_cbCached( 0 ), m_cbMaxCached( 0 ) {}
+
+	PagePtr page( const string& sFileName );
+	void workerRun();
+	void connectionRun( int fd );
+};
+
+// One request, as much of it as docgen needs
+struct Request {
+	string		m_sMethod;
+	string		m_sTarget;
+	bool		m_isKeepAlive;
+};
+
+/*	equalsHeader -- internal routine returns true if the header line
+			sLine is sName, in any case.  Sets sValue to its value.
+*/
+static bool equalsHeader( string_view sLine, string_view sName, string_view& sValue )
+{
+	if (sLine.size()<=sName.size() || sLine[sName.size()]!=':'
+	    || !equalsIgnoreCase( sLine.substr( 0, sName.size() ), sName ))
+		return false;
+
+	sValue = sLine.substr( sName.size()+1 );
+	while (!sValue.empty() && (sValue.front()==' ' || sValue.front()=='\t'))
+		sValue.remove_prefix( 1 );
+	while (!sValue.empty() && (sValue.back()==' ' || sValue.back()=='\t'))
+		sValue.remove_suffix( 1 );
+	return true;
+}
+
+/*	parseRequest -- internal routine parses the request line and headers
+			in sHead.  Returns false if it is not HTTP.
+*/
+static bool parseRequest( string_view sHead, Request& req )
+{
+	size_t iEol = sHead.find( "\r\n" );
+	string_view sLine = sHead.substr( 0, iEol );
+
+	size_t iSp1 = sLine.find( ' ' );
+	size_t iSp2 = iSp1==string_view::npos ? iSp1 : sLine.find( ' ', iSp1+1 );
+	if (iSp2==string_view::npos)
+		return false;
+	req.m_sMethod = string( sLine.substr( 0, iSp1 ) );
+	req.m_sTarget = string( sLine.substr( iSp1+1, iSp2-iSp1-1 ) );
+	string_view sVersion = sLine.substr( iSp2+1 );
+	if (sVersion.substr( 0, 5 )!="HTTP/")
+		return false;
+
+	// HTTP/1.1 keeps connections alive unless told otherwise
+	req.m_isKeepAlive = sVersion!="HTTP/1.0";
+	while (iEol!=string_view::npos) {
+		size_t iStart = iEol+2;
+		iEol = sHead.find( "\r\n", iStart );
+		string_view sValue;
+		if (equalsHeader( sHead.substr( iStart, iEol-iStart ), "Connection", sValue )) {
+			if (equalsIgnoreCase( sValue, "close" ))
+				req.m_isKeepAlive = false;
+			else if (equalsIgnoreCase( sValue, "keep-alive" ))
+				req.m_isKeepAlive = true;
+		}
+	}
+	return true;
+}
+
+/*	sendAll -- internal routine sends the head and body of a response.
+			Returns false if the connection failed.
+*/
+static bool sendAll( int fd, const string& sHead, string_view sBody )
+{
+	struct iovec aiov[2];
+	aiov[0].iov_base = (void*)sHead.data();
+	aiov[0].iov_len = sHead.size();
+	aiov[1].iov_base = (void*)sBody.data();
+	aiov[1].iov_len = sBody.size();
+
+	struct iovec* piov = aiov;
+	int ciov = sBody.empty() ? 1 : 2;
+	while (ciov>0) {
+		ssize_t cb = writev( fd, piov, ciov );
+		if (cb<0 && errno==EINTR)
+			continue;
+		if (cb<=0)
+			return false;
+		while (ciov>0 && (size_t)cb>=piov->iov_len) {
+			cb -= piov->iov_len;
+			piov++;
+			ciov--;
+		}
+		if (ciov>0) {
+			piov->iov_base = (char*)piov->iov_base + cb;
+			piov->iov_len -= cb;
+		}
+	}
+	return true;
+}
+
+/*	responseHead -- internal routine returns the status line and headers
+			of a response.
+*/
+static string responseHead( const char* sStatus, size_t cbBody, bool isKeepAlive,
+                           const char* sType="text/html" )
+{
+	std::ostringstream os;
+
+	os << "HTTP/1.1 " << sStatus << "\r\n"
+	   << "Content-Type: " << sType << "; charset=UTF-8\r\n"
+	   << "Content-Length: " << cbBody << "\r\n"
+	   << "Connection: " << (isKeepAlive ? "keep-alive" : "close") << "\r\n"
+	   << "\r\n";
+	return os.str();
+}
+
+
+/*	contentType -- internal routine returns the media type of a page,
+			from the extension of its file name.
+*/
+static const char* contentType( string_view sFileName )
+{
+	size_t iDot = sFileName.rfind( '.' );
+	string_view sExtension = iDot==string_view::npos ? string_view() : sFileName.substr( iDot );
+
+	if (sExtension==".json")
+		return "application/json";
+	if (sExtension==".txt")
+		return "text/plain";
+	if (sExtension==".css")
+		return "text/css";
+	return "text/html";
+}
+
+
+/*	DocServer::State::page -- internal routine returns the page named
+			sFileName from the cache, rendering it if it is not
+			there.  Returns 0 if the project has no such page.
+*/
+PagePtr DocServer::State::page( const string& sFileName )
+{
+	{
+		std::lock_guard<std::mutex> lock( m_mutexCache );
+		std::unordered_map< string, PageList::iterator >::iterator it = m_mapPages.find( sFileName );
+		if (it!=m_mapPages.end()) {
+			m_lstPages.splice( m_lstPages.begin(), m_lstPages, (*it).second );
+			return (*it).second->second;
+		}
+	}
+
+	// Render without the lock, so that other pages are still served
+	MemorySink sink;
+	if (!m_proj.fileOut( sink, sFileName ))
+		return PagePtr();
+	PagePtr pPage = std::make_shared<const string>( std::move( sink.files().begin()->second ) );
+
+	std::lock_guard<std::mutex> lock( m_mutexCache );
+	if (m_mapPages.find( sFileName )!=m_mapPages.end() || pPage->size()>m_cbMaxCached)
+		return pPage;					// Rendered by another thread too, or too big
+	m_lstPages.emplace_front( sFileName, pPage );
+	m_mapPages[sFileName] = m_lstPages.begin();
+	m_cbCached += pPage->size();
+	while (m_cbCached>m_cbMaxCached) {
+		m_cbCached -= m_lstPages.back().second->size();
+		m_mapPages.erase( m_lstPages.back().first );
+		m_lstPages.pop_back();
+	}
+	return pPage;
+}
+
+/*	DocServer::State::workerRun -- internal routine serves connections
+			from the queue, one at a time, until the server is
+			destroyed (a connection of -1).
+*/
+void DocServer::State::workerRun()
+{
+	for (;;) {
+		int fd;
+		{
+			std::unique_lock<std::mutex> lock( m_mutexQueue );
+			m_cvQueue.wait( lock, [this] { return !m_dqConnections.empty(); } );
+			fd = m_dqConnections.front();
+			if (fd<0)
+				return;					// Left in the queue for the other threads
+			m_dqConnections.pop_front();
+		}
+		connectionRun( fd );
+		close( fd );
+	}
+}
+
+/*	DocServer::State::connectionRun -- internal routine answers the
+			requests on one connection until it is closed, is idle
+			for too long, is too slow to send a request or asks to be
+			closed.
+*/
+void DocServer::State::connectionRun( int fd )
+{
+	string sIn;
+	char buf[4096];
+
+	for (;;) {
+		// Read up to the end of the headers; pipelined requests stay in
+		// sIn.  SO_RCVTIMEO only limits each wait, so the whole head has
+		// a deadline too, from its first byte.
+		std::chrono::steady_clock::time_point tpDeadline;
+		bool hasDeadline = false;
+		size_t iEnd;
+		while ((iEnd = sIn.find( "\r\n\r\n" ))==string::npos) {
+			if (sIn.size()>MaxRequestBytes)
+				return;
+			if (!sIn.empty() && !hasDeadline) {
+				tpDeadline = std::chrono::steady_clock::now() + std::chrono::seconds( RequestSeconds );
+				hasDeadline = true;
+			} else if (hasDeadline && std::chrono::steady_clock::now()>tpDeadline)
+				return;
+			ssize_t cb = recv( fd, buf, sizeof(buf), 0 );
+			if (cb<0 && errno==EINTR)
+				continue;
+			if (cb<=0)
+				return;					// Closed, idle or failed
+			sIn.append( buf, cb );
+		}
+
+		Timeline::Span span( "serve" );
+		Request req;
+		bool isHttp = parseRequest( string_view( sIn ).substr( 0, iEnd+2 ), req );
+		sIn.erase( 0, iEnd+4 );
+		if (!isHttp) {
+			sendAll( fd, responseHead( "400 Bad Request", 0, false ), "" );
+			return;
+		}
+		span.arg( "target", req.m_sTarget );
+
+		bool isHead = req.m_sMethod=="HEAD";
+		if (!isHead && req.m_sMethod!="GET") {
+			// A body may follow, which is not read, so close
+			static const char sBody[] = "<HTML><BODY>Only GET is supported</BODY></HTML>\n";
+			sendAll( fd, responseHead( "405 Method Not Allowed", sizeof(sBody)-1, false ), sBody );
+			return;
+		}
+
+		// "/a.b.C.html?x" is the file "a.b.C.html"
+		string sFileName = req.m_sTarget.substr( 0, req.m_sTarget.find_first_of( "?#" ) );
+		if (sFileName=="/")
+			sFileName = "/" + m_proj.getFileName();
+		PagePtr pPage;
+		if (sFileName.size()>1 && sFileName[0]=='/' && sFileName.find( '/', 1 )==string::npos)
+			pPage = page( sFileName.substr( 1 ) );
+
+		bool isSent;
+		if (pPage) {
+			isSent = sendAll( fd, responseHead( "200 OK", pPage->size(), req.m_isKeepAlive,
+			                                    contentType( sFileName ) ),
+			                  isHead ? string_view() : string_view( *pPage ) );
+		} else {
+			static const char sBody[] = "<HTML><BODY>No such page</BODY></HTML>\n";
+			isSent = sendAll( fd, responseHead( "404 Not Found", sizeof(sBody)-1, req.m_isKeepAlive ),
+			                  isHead ? string_view() : string_view( sBody ) );
+		}
+		if (!isSent || !req.m_isKeepAlive)
+			return;
+	}
+}
+
+
+/*: routine DocServer::DocServer
+
+	Serves the pages of proj, which must not change while the server is
+	running.  Up to cbCache bytes of rendered pages are kept.  cThreads
+	connections are served at once, by default one per processor and
+	at least four.
+*/
+DocServer::DocServer( const Project& proj, size_t cbCache, int cThreads )
+	:	m_pState( new State( proj ) )
+{
+	m_pState->m_cbMaxCached = cbCache;
+	if (cThreads<=0)
+		cThreads = std::max( 4, (int)std::thread::hardware_concurrency() );
+	for (int i=0; i<cThreads; i++)
+		m_pState->m_vThreads.emplace_back( &State::workerRun, m_pState );
+}
+
+/*: routine DocServer::~DocServer
+
+	Destructor.  Stops the threads once they have finished the
+	connections they are serving.
+*/
+DocServer::~DocServer()
+{
+	{
+		std::lock_guard<std::mutex> lock( m_pState->m_mutexQueue );
+		m_pState->m_dqConnections.push_front( -1 );
+	}
+	m_pState->m_cvQueue.notify_all();
+	for (size_t i=0; i<m_pState->m_vThreads.size(); i++)
+		m_pState->m_vThreads[i].join();
+
+	std::deque<int>::iterator it;
+	for (it=m_pState->m_dqConnections.begin(); it!=m_pState->m_dqConnections.end(); ++it)
+		if (*it>=0)
+			close( *it );
+	if (m_pState->m_fdListen>=0)
+		close( m_pState->m_fdListen );
+	delete m_pState;
+}
+
+/*: routine DocServer::run
+
+	Listens on sAddress, "host:port" (eg: "127.0.0.1:8080", or
+	"[::1]:8080"), and serves connections until the process is stopped.
+
+	Throws: if the address cannot be listened on
+*/
+void DocServer::run( const string& sAddress )
+{
+	size_t iColon = sAddress.rfind( ':' );
+	if (iColon==string::npos)
+		throw BFileException( BFileException::SystemError );
+	string sHost = sAddress.substr( 0, iColon );
+	string sPort = sAddress.substr( iColon+1 );
+	if (sHost.size()>=2 && sHost.front()=='[' && sHost.back()==']')
+		sHost = sHost.substr( 1, sHost.size()-2 );
+
+	struct addrinfo hints;
+	memset( &hints, 0, sizeof(hints) );
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
+	struct addrinfo* pai = 0;
+	if (getaddrinfo( sHost.empty() ? 0 : sHost.c_str(), sPort.c_str(), &hints, &pai )!=0)
+		throw BFileException( BFileException::SystemError );
+
+	int fd = socket( pai->ai_family, pai->ai_socktype | SOCK_CLOEXEC, pai->ai_protocol );
+	int nOn = 1;
+	if (fd>=0)
+		setsockopt( fd, SOL_SOCKET, SO_REUSEADDR, &nOn, sizeof(nOn) );
+	bool isListening = fd>=0 && bind( fd, pai->ai_addr, pai->ai_addrlen )==0
+	                   && listen( fd, SOMAXCONN )==0;
+	freeaddrinfo( pai );
+	if (!isListening) {
+		if (fd>=0)
+			close( fd );
+		throw BFileException( BFileException::SystemError );
+	}
+	m_pState->m_fdListen = fd;
+
+	signal( SIGPIPE, SIG_IGN );			// A closed connection is seen by writev()
+	for (;;) {
+		int fdConn = accept4( m_pState->m_fdListen, 0, 0, SOCK_CLOEXEC );
+		if (fdConn<0) {
+			if (errno==EMFILE || errno==ENFILE) {
+				// Out of descriptors until some connections close
+				std::this_thread::sleep_for( std::chrono::milliseconds( 100 ) );
+				continue;
+			}
+			if (errno==EINTR || errno==ECONNABORTED)
+				continue;
+			throw BFileException( BFileException::SystemError );
+		}
+
+		// Small responses go out at once, and idle connections are closed
+		struct timeval tvIdle = {IdleSeconds, 0};
+		setsockopt( fdConn, IPPROTO_TCP, TCP_NODELAY, &nOn, sizeof(nOn) );
+		setsockopt( fdConn, SOL_SOCKET, SO_RCVTIMEO, &tvIdle, sizeof(tvIdle) );
+		{
+			std::lock_guard<std::mutex> lock( m_pState->m_mutexQueue );
+			m_pState->m_dqConnections.push_back( fdConn );
+		}
+		m_pState->m_cvQueue.notify_one();
+	}
+}
@@ -0,0 +1,31 @@
+/* serve.h -- Serving a Project's pages over HTTP as they are requested
+
+Copyright (C) 2017, Brian Bray
+
+*/
+
+/* Needs:
+#include <string>
+#include "docitem.h"
+*/
+
+//	A small HTTP server that renders the pages of a parsed Project on
+//	request and keeps the most recently used ones.
+class DocServer {
+public:
+	struct State;					// Threads, queue and page cache, see serve.cc
+
+	DocServer( const Project& proj, size_t cbCache=DefaultCacheBytes, int cThreads=0 );
+	~DocServer();
+
+	void run( const std::string& sAddress );
+
+	enum {DefaultCacheBytes=64*1024*1024};
+
+private:
+	DocServer( const DocServer& );					// Not copyable
+	DocServer& operator=( const DocServer& );
+
+private:
+	State*		m_pState;
+};
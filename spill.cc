@@ -0,0 +1,243 @@
+/* spill.cc  -- Low memory runs, with parsed classes kept on disk
+
+Copyright (C) 2017, Brian Bray
+
+*/
+
+#include <cctype>
+#include <cstdio>
+#include <fstream>
+#include <istream>
+#include <ostream>
+#include <sstream>
+#include <list>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "bw/bwassert.h"
+#include "bw/countable.h"
+#include "bw/exception.h"
+#include "lexstream.h"
+#include "schema.h"
+#include "docitem.h"
+#include "docsink.h"
+#include "fragcache.h"
+#include "backend.h"
+#include "spill.h"
+
+using bw::BFileException;
+using std::ostream;
+using std::string;
+using std::string_view;
+
+/*: class SpillStore
+
+	Keeps the parsed classes of a Project in files, so that a run over a
+	very large set of inputs needs memory for the largest class rather
+	than for the whole project.
+	<P>
+	After each input, Project::spill() appends every class that was
+	parsed to that class's file in partial format and drops it from
+	memory.  When the output is written, each class is read back and
+	merged on its own (see Project::merge()), so the result is the same
+	as when everything is kept in memory.  Only the title of each class
+	stays in memory, for the index page.
+	<P>
+	The files are created in a directory of their own, made with
+	mkdtemp() in the given directory when the first class is added, so
+	that several stores, in one process or many, can share a spill
+	directory.  The files and the directory are removed when the
+	SpillStore is destroyed.
+*/
+
+/*: routine SpillStore::SpillStore		Constructor		*/
+SpillStore::SpillStore( const string& sDir )
+	:	m_sDir( sDir ),
+	    m_cFiles( 0 )
+{
+}
+
+/*: routine SpillStore::~SpillStore		Destructor, removes the files	*/
+SpillStore::~SpillStore()
+{
+	ClassMap::const_iterator it;
+	for (it=m_mapClasses.begin(); it!=m_mapClasses.end(); ++it)
+		std::remove( (*it).second.m_sFile.c_str() );
+	if (!m_sStoreDir.empty())
+		rmdir( m_sStoreDir.c_str() );
+}
+
+/*	SpillStore::storeDir -- internal routine returns the directory of
+			the store's files, making it the first time.
+
+	Throws: if the directory cannot be made
+*/
+const string& SpillStore::storeDir()
+{
+	if (m_sStoreDir.empty()) {
+		string sTemplate = m_sDir + "/docgen-spill.XXXXXX";
+		std::vector<char> vPath( sTemplate.begin(), sTemplate.end() );
+
+		vPath.push_back( '\0' );
+		if (mkdtemp( vPath.data() )==0)
+			throw BFileException( BFileException::SystemError );
+		m_sStoreDir = vPath.data();
+	}
+	return m_sStoreDir;
+}
+
+/*: routine SpillStore::add
+
+	Appends a class to its file.  The title the class will have once all
+	of its parts are merged is worked out as they are added.
+
+	Throws: if the file cannot be written
+*/
+void SpillStore::add( const DocClass& cls )
+{
+	ClassMap::iterator it = m_mapClasses.find( cls.getName() );
+	if (it==m_mapClasses.end()) {
+		char szFile[16];
+		ClassEntry entry;
+
+		snprintf( szFile, sizeof(szFile), "/%d", m_cFiles++ );
+		entry.m_sFile = storeDir() + szFile;
+		entry.m_hasFirstAttribute = false;
+		entry.m_hasTitleAttribute = false;
+		it = m_mapClasses.insert( ClassMap::value_type(string(cls.getName()), entry) ).first;
+	}
+	ClassEntry& entry = (*it).second;
+
+	// Same rules as DocItem::getTitle(), over all the parts
+	if (!entry.m_hasTitleAttribute) {
+		string sValue;
+		AttribIterator ai = cls.find( DocSchema::aTitle );
+		if (!ai.atEof()) {
+			entry.m_sTitle = ai->value( sValue );
+			entry.m_hasTitleAttribute = true;
+		} else if (!entry.m_hasFirstAttribute && !cls.findAll().atEof()) {
+			entry.m_sTitle = cls.getTitle( sValue );
+			entry.m_hasFirstAttribute = true;
+		}
+	}
+
+	std::ofstream os( entry.m_sFile.c_str(), std::ios::out | std::ios::app | std::ios::binary );
+	if (!os.is_open())
+		throw BFileException( BFileException::SystemError );
+	Project::partialClassOut( os, cls );
+	os.close();
+	if (os.fail())
+		throw BFileException( BFileException::SystemError );
+}
+
+/*: routine SpillStore::load
+
+	Reads every part of a class back and merges them into proj.
+
+	Throws: if the file cannot be read
+*/
+void SpillStore::load( string_view sClass, Project& proj ) const
+{
+	ClassMap::const_iterator it = m_mapClasses.find( sClass );
+	if (it==m_mapClasses.end())
+		return;
+
+	std::ifstream is( (*it).second.m_sFile.c_str(), std::ios::in | std::ios::binary );
+	if (!is.is_open())
+		throw BFileException( BFileException::SystemError );
+
+	while (!(is >> std::ws).eof()) {
+		Project projPart;
+
+		projPart.partialIn( is );
+		proj.merge( projPart );
+	}
+}
+
+
+/*: routine Project::spill
+
+	Moves every class parsed so far into the store.  The project's own
+	attributes stay in memory.
+*/
+void Project::spill( SpillStore& store )
+{
+	std::vector<DocClass*> vClasses;
+	m_scopeRoot.classesOf( vClasses );
+	for (size_t i=0; i<vClasses.size(); i++)
+		store.add( *vClasses[i] );
+	clearClasses();
+}
+
+/*: routine Project::partialOut
+
+	Writes the project and the classes in the store as one partial,
+	reading one class at a time.
+
+	Prototype: void partialOut( std::ostream& os, SpillStore& store )
+*/
+void Project::partialOut( ostream& os, SpillStore& store )
+{
+	spill( store );
+	partialProjectOut( os );
+
+	SpillStore::ClassMap::const_iterator it;
+	for (it=store.classes().begin(); it!=store.classes().end(); ++it) {
+		Project proj;
+
+		store.load( (*it).first, proj );
+		proj.getClass( (*it).first )->partialOut( os );
+	}
+	os << ".\n";
+}
+
+/*: routine Project::filesOut
+
+	Prototype: void filesOut( DocSink& sink, SpillStore& store )
+
+	Outputs the documentation of a project whose classes are in a
+	SpillStore.  The index page is written from the title of each class
+	and the globals, then the class pages one class at a time.
+*/
+void Project::filesOut( DocSink& sink, SpillStore& store )
+{
+	spill( store );
+
+	SpillStore::ClassMap::const_iterator it;
+	for (it=store.classes().begin(); it!=store.classes().end(); ++it) {
+		const SpillStore::ClassEntry& entry = (*it).second;
+
+		if ((*it).first.empty())
+			continue;				// Globals are shown in full below
+		DocClass* pcls = getClass( (*it).first );
+		if (entry.m_hasFirstAttribute || entry.m_hasTitleAttribute)
+			pcls->addAttribute( DocSchema::attributeKeyword(DocSchema::aTitle), entry.m_sTitle );
+	}
+	store.load( "", *this );
+
+	OutputBackends backends( sink, m_fFormats, m_pCache, m_sSourceLinkTemplate );
+	indexOut( backends );
+	scopesOut( backends );
+	clearClasses();
+
+	for (it=store.classes().begin(); it!=store.classes().end(); ++it) {
+		if ((*it).first.empty())
+			continue;				// Globals already done
+		Project proj;
+
+		store.load( (*it).first, proj );
+		classOut( backends, *proj.getClass( (*it).first ) );
+	}
+	backends.assetsOut();
+	sink.flush();
+	m_cbWritten = backends.written();
+	m_cbMarkupSaved = backends.markupSaved();
+}
@@ -0,0 +1,47 @@
+/* spill.h -- On-disk store of parsed classes for low memory runs
+
+Copyright (C) 2017, Brian Bray
+
+*/
+
+/* Needs:
+#include <map>
+#include <string>
+#include <string_view>
+#include "docitem.h"
+*/
+
+//	Holds the classes of a Project on disk, one file per class, so that
+//	only the class being parsed or output is in memory.
+class SpillStore {
+public:
+	// What the index page needs to know about a class
+	struct ClassEntry {
+		std::string		m_sFile;		// Partials for this class, in order
+		std::string		m_sTitle;
+		bool			m_hasFirstAttribute;	// m_sTitle is from the first attribute
+		bool			m_hasTitleAttribute;	// m_sTitle is from a "Title:"
+	};
+	typedef std::map< std::string, ClassEntry, std::less<> >	ClassMap;
+
+	SpillStore( const std::string& sDir );
+	~SpillStore();
+
+	void add( const DocClass& cls );
+	void load( std::string_view sClass, Project& proj ) const;
+	const ClassMap& classes() const {
+		return m_mapClasses;
+	}
+
+private:
+	const std::string& storeDir();
+
+	SpillStore( const SpillStore& );				// Not copyable
+	SpillStore& operator=( const SpillStore& );
+
+private:
+	std::string		m_sDir;			// Where the store's directory is made
+	std::string		m_sStoreDir;	// Of the files, only this store's, "" until made
+	int				m_cFiles;
+	ClassMap		m_mapClasses;
+};
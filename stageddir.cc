@@ -0,0 +1,369 @@
+/* stageddir.cc  -- Building an output directory beside the live one
+
+Copyright (C) 2017, Brian Bray
+
+*/
+
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <string_view>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
+
+#include "bw/exception.h"
+#include "timeline.h"
+#include "stageddir.h"
+
+using bw::BFileException;
+using std::string;
+
+#ifndef RENAME_EXCHANGE
+#define RENAME_EXCHANGE		(1 << 1)		// From <linux/fs.h>
+#endif
+
+/*: class StagedDir
+
+	Writing pages straight into the output directory means that anyone
+	reading it during a run, such as a web server, sees a mix of old,
+	new and half written pages.  A StagedDir is built instead in a
+	hidden sibling, ".<name>.XXXXXX", and publish() puts it in place
+	with a single rename, so readers see either the old tree or the new
+	one.
+	<P>
+	Before the swap, every file of the live directory that was not
+	written again is hard linked into the new tree, and subdirectories
+	are made again there and their files linked the same way, so nothing
+	that was there is lost and the live tree is not touched until the
+	swap.  The same is done by a caller for files whose content has not
+	changed (see UringSink::setLinkFrom()), so an unchanged page keeps
+	its inode and its modification time.
+	<P>
+	The swap is renameat2() with RENAME_EXCHANGE.  If the output name
+	is a symbolic link to one of our trees, the link is replaced instead,
+	and the tree it pointed to is removed.  A symbolic link to anywhere
+	else is the user's, so it is left alone and the pages are written
+	through it in place.  Where exchange is not
+	supported (not Linux, or a file system without it), the live
+	directory is renamed aside and replaced by a symbolic link to the
+	new tree; later runs then flip the link.  Only that first switch
+	leaves a moment with no directory.
+	<P>
+	The output directory, and any missing parents, are created.  A
+	directory that cannot have a sibling on the same file system, such
+	as "." or a mount point, is written in place as before, and so is
+	one whose parent cannot be written to.
+*/
+
+/*	isDots -- internal routine returns true for "", "." and ".." */
+static bool isDots( const string& s )
+{
+	return s.empty() || s=="." || s=="..";
+}
+
+/*	isStagedName -- internal routine returns true if sName is the name
+			of a tree staged for sBase, ".<sBase>.XXXXXX".
+*/
+static bool isStagedName( const string& sName, const string& sBase )
+{
+	return sName.size()==sBase.size()+8 && sName[0]=='.'
+	       && sName.compare( 1, sBase.size(), sBase )==0 && sName[sBase.size()+1]=='.';
+}
+
+/*	isOurLink -- internal routine returns true if the symbolic link
+			sLink points to a sibling tree that docgen staged for sBase.
+*/
+static bool isOurLink( const string& sLink, const string& sBase )
+{
+	char szTarget[4096];
+	ssize_t cch = readlink( sLink.c_str(), szTarget, sizeof(szTarget)-1 );
+	return cch>0 && isStagedName( string( szTarget, cch ), sBase );
+}
+
+/*	makeDirs -- internal routine creates sDir and any missing parents.
+
+	Throws: if a directory cannot be created
+*/
+static void makeDirs( const string& sDir )
+{
+	for (size_t i=1; i<=sDir.size(); i++) {
+		if (i<sDir.size() && sDir[i]!='/')
+			continue;
+		string sPrefix = sDir.substr( 0, i );
+		if (mkdir( sPrefix.c_str(), 0777 )!=0 && errno!=EEXIST)
+			throw BFileException( BFileException::SystemError );
+	}
+}
+
+/*	exchange -- internal routine atomically swaps the names sA and sB.
+			Returns 0, or -1 with errno set.
+*/
+static int exchange( const string& sA, const string& sB )
+{
+#ifdef SYS_renameat2
+	return (int)syscall( SYS_renameat2, AT_FDCWD, sA.c_str(), AT_FDCWD, sB.c_str(),
+	                     RENAME_EXCHANGE );
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+/*	removeOld -- internal routine removes the old tree sOld after a swap.
+
+	Only names that are also in the new tree sNew are removed, so that a
+	file added to the old tree during the run is not lost; the old tree
+	is then left behind.  Subdirectories are removed the same way.
+*/
+static void removeOld( const string& sOld, const string& sNew )
+{
+	DIR* pDir = opendir( sOld.c_str() );
+	if (pDir==0)
+		return;
+
+	struct dirent* pEntry;
+	while ((pEntry = readdir( pDir ))!=0) {
+		string sName = pEntry->d_name;
+		if (isDots( sName ))
+			continue;
+
+		struct stat stOld, stNew;
+		string sPath = sOld + "/" + sName;
+		string sNewPath = sNew + "/" + sName;
+		if (lstat( sPath.c_str(), &stOld )!=0 || lstat( sNewPath.c_str(), &stNew )!=0)
+			continue;
+		if (!S_ISDIR(stOld.st_mode))
+			unlink( sPath.c_str() );
+		else if (S_ISDIR(stNew.st_mode))
+			removeOld( sPath, sNewPath );
+	}
+	closedir( pDir );
+	rmdir( sOld.c_str() );
+}
+
+/*	removeTree -- internal routine removes sDir and everything in it */
+static void removeTree( const string& sDir )
+{
+	chmod( sDir.c_str(), 0700 );				// A carried over mode may not allow it
+	DIR* pDir = opendir( sDir.c_str() );
+	if (pDir) {
+		struct dirent* pEntry;
+		while ((pEntry = readdir( pDir ))!=0) {
+			string sName = pEntry->d_name;
+			if (isDots( sName ))
+				continue;
+
+			struct stat st;
+			string sPath = sDir + "/" + sName;
+			if (lstat( sPath.c_str(), &st )!=0)
+				continue;
+			if (S_ISDIR(st.st_mode))
+				removeTree( sPath );
+			else
+				unlink( sPath.c_str() );
+		}
+		closedir( pDir );
+	}
+	rmdir( sDir.c_str() );
+}
+
+
+/*: routine StagedDir::StagedDir
+
+	Creates the staging directory for sDir, with the same permissions
+	as sDir, or decides to write in place.  Creates sDir's parents.
+
+	Throws: if a directory cannot be created
+*/
+StagedDir::StagedDir( const string& sDir )
+	:	m_sDir( sDir )
+{
+	while (m_sDir.size()>1 && m_sDir.back()=='/')
+		m_sDir.pop_back();
+
+	size_t iSlash = m_sDir.rfind( '/' );
+	string sBase = iSlash==string::npos ? m_sDir : m_sDir.substr( iSlash+1 );
+	string sParent = iSlash==string::npos ? string( "." )
+	               : iSlash==0 ? string( "/" ) : m_sDir.substr( 0, iSlash );
+	if (isDots( sBase )) {
+		makeDirs( m_sDir );
+		return;
+	}
+	makeDirs( sParent );
+
+	struct stat stDir, stParent;
+	mode_t mode;
+	if (lstat( m_sDir.c_str(), &stDir )==0 && S_ISLNK(stDir.st_mode)
+	    && !isOurLink( m_sDir, sBase ))
+		return;							// The user's link, write through it
+	if (stat( m_sDir.c_str(), &stDir )==0) {
+		if (!S_ISDIR(stDir.st_mode) || stat( sParent.c_str(), &stParent )!=0
+		    || stDir.st_dev!=stParent.st_dev)
+			return;						// Write in place, and fail there
+		mode = stDir.st_mode & 07777;
+	} else {
+		mode_t modeMask = umask( 0 );
+		umask( modeMask );
+		mode = 0777 & ~modeMask;
+	}
+
+	string sTemplate = sParent + "/." + sBase + ".XXXXXX";
+	if (mkdtemp( &sTemplate[0] )==0) {
+		if (errno!=EACCES && errno!=EROFS)
+			throw BFileException( BFileException::SystemError );
+		makeDirs( m_sDir );				// No sibling allowed, write in place
+		return;
+	}
+	m_sStaging = sTemplate;
+	chmod( m_sStaging.c_str(), mode );
+}
+
+/*: routine StagedDir::~StagedDir
+
+	Destructor.  If the tree was not published, removes what was written
+	or linked into it.  The live directory was not changed.
+*/
+StagedDir::~StagedDir()
+{
+	if (!m_sStaging.empty())
+		removeTree( m_sStaging );
+}
+
+/*: routine StagedDir::publish
+
+	Makes the staged tree the live directory.  Does nothing if the tree
+	was written in place.
+
+	Throws: if the tree cannot be put in place; the live directory is
+	then as it was
+*/
+void StagedDir::publish()
+{
+	if (m_sStaging.empty())
+		return;
+
+	Timeline::Span span( "publish" );
+	span.arg( "dir", m_sDir );
+
+	struct stat st;
+	if (lstat( m_sDir.c_str(), &st )!=0) {
+		if (errno!=ENOENT || rename( m_sStaging.c_str(), m_sDir.c_str() )!=0)
+			throw BFileException( BFileException::SystemError );
+		m_sStaging.clear();
+		return;
+	}
+
+	carryOver( m_sDir, m_sStaging );
+	swapIn();
+}
+
+/*	StagedDir::carryOver -- internal routine brings everything in sFrom
+			that was not written again into sTo, in the staged tree:
+			files as hard links, subdirectories by making them again
+			and carrying over what is in them.  sFrom is only read.
+
+	Throws: if an entry cannot be brought over
+*/
+void StagedDir::carryOver( const string& sFrom, const string& sTo )
+{
+	DIR* pDir = opendir( sFrom.c_str() );
+	if (pDir==0)
+		throw BFileException( BFileException::SystemError );
+
+	struct dirent* pEntry;
+	while ((pEntry = readdir( pDir ))!=0) {
+		string sName = pEntry->d_name;
+		if (isDots( sName ))
+			continue;
+
+		struct stat st, stStaged;
+		string sPath = sFrom + "/" + sName;
+		string sStaged = sTo + "/" + sName;
+		if (lstat( sPath.c_str(), &st )!=0)
+			continue;					// Removed since readdir()
+		if (S_ISDIR(st.st_mode)) {
+			bool isStaged = lstat( sStaged.c_str(), &stStaged )==0;
+			if (isStaged && !S_ISDIR(stStaged.st_mode))
+				continue;				// Written again as a file
+			if (isStaged || mkdir( sStaged.c_str(), 0700 )==0) {
+				try {
+					carryOver( sPath, sStaged );
+				} catch (...) {
+					closedir( pDir );
+					throw;
+				}
+				if (!isStaged)
+					chmod( sStaged.c_str(), st.st_mode & 07777 );
+				continue;
+			}
+		} else if (linkat( AT_FDCWD, sPath.c_str(), AT_FDCWD, sStaged.c_str(), 0 )==0
+		           || errno==EEXIST) {
+			continue;
+		}
+		closedir( pDir );
+		throw BFileException( BFileException::SystemError );
+	}
+	closedir( pDir );
+}
+
+/*	StagedDir::swapIn -- internal routine swaps the staged tree with the
+			live one and removes the old tree.
+
+	Throws: if the swap fails
+*/
+void StagedDir::swapIn()
+{
+	string sParent, sBase;
+	size_t iSlash = m_sStaging.rfind( '/' );
+	sParent = m_sStaging.substr( 0, iSlash );
+	sBase = m_sStaging.substr( iSlash+1 );
+
+	struct stat st;
+	if (lstat( m_sDir.c_str(), &st )==0 && S_ISLNK(st.st_mode)) {
+		char szTarget[4096];
+		ssize_t cch = readlink( m_sDir.c_str(), szTarget, sizeof(szTarget)-1 );
+		string sTarget( szTarget, cch>0 ? cch : 0 );
+
+		string sLink = m_sStaging + ".link";
+		if (symlink( sBase.c_str(), sLink.c_str() )!=0)
+			throw BFileException( BFileException::SystemError );
+		if (rename( sLink.c_str(), m_sDir.c_str() )!=0) {
+			unlink( sLink.c_str() );
+			throw BFileException( BFileException::SystemError );
+		}
+
+		// Remove the old tree only if it was staged by docgen
+		string sPrefix = sBase.substr( 0, sBase.size()-6 );
+		if (sTarget.size()==sBase.size() && sTarget.compare( 0, sPrefix.size(), sPrefix )==0)
+			removeOld( sParent + "/" + sTarget, m_sStaging );
+		m_sStaging.clear();
+		return;
+	}
+
+	if (exchange( m_sStaging, m_sDir )==0) {
+		removeOld( m_sStaging, m_sDir );
+		m_sStaging.clear();
+		return;
+	}
+	if (errno!=EINVAL && errno!=ENOSYS)
+		throw BFileException( BFileException::SystemError );
+
+	// No exchange: move the directory aside and link to the new tree
+	string sAside = m_sStaging + ".old";
+	if (rename( m_sDir.c_str(), sAside.c_str() )!=0)
+		throw BFileException( BFileException::SystemError );
+	if (symlink( sBase.c_str(), m_sDir.c_str() )!=0) {
+		rename( sAside.c_str(), m_sDir.c_str() );
+		throw BFileException( BFileException::SystemError );
+	}
+	removeOld( sAside, m_sStaging );
+	m_sStaging.clear();
+}
@@ -0,0 +1,36 @@
+/* stageddir.h -- Building an output directory beside the live one
+
+Copyright (C) 2017, Brian Bray
+
+*/
+
+/* Needs:
+#include <string>
+*/
+
+//	A directory that is rebuilt in a sibling staging directory and then
+//	swapped into place at once by publish().
+class StagedDir {
+public:
+	StagedDir( const std::string& sDir );
+	~StagedDir();
+
+	const std::string& path() const {
+		return m_sStaging.empty() ? m_sDir : m_sStaging;
+	}
+	bool isStaged() const {
+		return !m_sStaging.empty();
+	}
+	void publish();
+
+private:
+	void carryOver( const std::string& sFrom, const std::string& sTo );
+	void swapIn();
+
+	StagedDir( const StagedDir& );					// Not copyable
+	StagedDir& operator=( const StagedDir& );
+
+private:
+	std::string		m_sDir;			// The live directory, or symlink to it
+	std::string		m_sStaging;		// Being built, empty if built in place
+};
@@ -0,0 +1,97 @@
+#!/bin/sh
+# complexity.sh -- checks that docgen runs in linear time on worst case input
+#
+# Usage: test/complexity.sh [<docgen>]
+#
+# Each case generates a pathological input at 1x, 10x and 100x its base
+# size and times a full docgen run over it.  A case fails if ten times
+# the input takes more than TOLERANCE (default 3) times ten times as long.
+# The quotes case also fails if any routine loses its prototype.
+#
+# Copyright (C) 2017, Brian Bray
+
+DOCGEN=${1:-./docgen}
+TOLERANCE=${TOLERANCE:-3}
+BASE=${BASE:-2000}
+WORK=${TMPDIR:-/tmp}/docgen-complexity.$$
+
+trap 'rm -rf $WORK' 0 1 2 15
+mkdir -p $WORK/out
+
+# gen <case> <n> -- writes the input for a case with n units to stdout
+gen()
+{
+	awk -v c="$1" -v n="$2" 'BEGIN {
+		if (c=="same") {			# many blocks for one item
+			for (i=0; i<n; i++) printf "/*: Foo::bar  text */\nint Foo::bar();\n"
+		} else if (c=="stars") {	# one very long line of stars
+			printf "/*: Foo::bar\n"; for (i=0; i<n*50; i++) printf "*"; printf "\n*/\n"
+		} else if (c=="colons") {	# one very long line of colons
+			printf "/*: Foo::bar\n"; for (i=0; i<n*50; i++) printf ":"; printf "\n*/\n"
+		} else if (c=="ident") {	# one very long possible keyword
+			printf "/*: Foo::bar\n"; for (i=0; i<n*50; i++) printf "a"; printf "\n*/\n"
+		} else if (c=="operator") {	# operator( followed by stars
+			printf "/*: Foo::operator("; for (i=0; i<n*50; i++) printf "*"; printf " */\n"
+		} else if (c=="keywords") {	# many attributes on one item
+			printf "/*: Foo::bar\n"; for (i=0; i<n; i++) printf "Key%d: value\n", i; printf "*/\n"
+		} else if (c=="prototype") {	# one very long prototype
+			printf "/*: Foo::bar */\nint Foo::bar("; for (i=0; i<n*5; i++) printf "int a%d, ", i; printf "int z);\n"
+		} else if (c=="errors") {	# many malformed blocks
+			for (i=0; i<n; i++) printf "/*: class 1bad */\n"
+		} else if (c=="unterminated") {	# a block that never ends
+			printf "/*: Foo::bar\n"; for (i=0; i<n; i++) printf "  * more text for the description\n"
+		} else if (c=="quotes") {	# digit separators and unterminated literals
+			for (i=0; i<n; i++) printf "/*: routine f%d */\nint f%d( int x = 1\047000 );\n", i, i
+		}
+	}'
+}
+
+# now -- prints the time in milliseconds
+now()
+{
+	date +%s%N | cut -c1-13
+}
+
+# timerun <file> -- prints the milliseconds taken to run docgen on file
+timerun()
+{
+	rm -f $WORK/out/*
+	t0=`now`
+	$DOCGEN --max-errors 1000000000 $WORK/out $1 >/dev/null 2>&1
+	t1=`now`
+	awk -v t0=$t0 -v t1=$t1 'BEGIN { print t1-t0 }'
+}
+
+status=0
+printf "%-14s %10s %10s %10s\n" "case" "1x ms" "10x ms" "100x ms"
+for c in same stars colons ident operator keywords prototype errors unterminated quotes
+do
+	times=""
+	for scale in 1 10 100
+	do
+		gen $c `expr $BASE \* $scale` >$WORK/in.h
+		times="$times `timerun $WORK/in.h`"
+	done
+	set -- $times
+	printf "%-14s %10s %10s %10s" $c $1 $2 $3
+	# Times under 20ms are mostly process startup, so they are rounded up
+	if awk -v a=$2 -v b=$3 -v tol=$TOLERANCE 'BEGIN {
+			if (a<20) a=20
+			exit !(b > a*10*tol)
+		}'
+	then
+		echo "   FAILED: superlinear"
+		status=1
+	# A quote must not swallow the text after it, so every routine
+	# keeps its own prototype
+	elif [ $c = quotes ] && [ `grep -o "int f[0-9]*( int x = 1'000 )[^;]" \
+			$WORK/out/index.html | wc -l` -ne `expr $BASE \* 100` ]
+	then
+		echo "   FAILED: prototypes lost"
+		status=1
+	else
+		echo ""
+	fi
+done
+
+exit $status
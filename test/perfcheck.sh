@@ -0,0 +1,137 @@
+#!/bin/sh
+# perfcheck.sh -- checks docgen's throughput and memory against a baseline
+#
+# Usage: test/perfcheck.sh [<docgen> [<baseline>]]
+#
+# Generates a fixed synthetic project of FILES (default 2000) files with
+# several classes each, runs docgen over it RUNS (default 5) times with
+# --stats, and takes the median throughput (input MB per second) and the
+# median peak RSS.  Fails if throughput is more than TOLERANCE (default
+# 0.25, ie: 25%) below the baseline, or peak RSS more than TOLERANCE
+# above it.
+#
+# The baseline file holds "files <n>", "throughput_mbs <n>" and
+# "maxrss_kb <n>" lines.  It depends on the machine and build, so after
+# a deliberate change, or on a new machine, record a new one with:
+#	UPDATE=1 test/perfcheck.sh ./docgen test/perf.baseline
+#
+# Copyright (C) 2017, Brian Bray
+
+DOCGEN=${1:-./docgen}
+BASELINE=${2:-test/perf.baseline}
+TOLERANCE=${TOLERANCE:-0.25}
+FILES=${FILES:-2000}
+RUNS=${RUNS:-5}
+WORK=${TMPDIR:-/tmp}/docgen-perfcheck.$$
+
+trap 'rm -rf $WORK' 0 1 2 15
+mkdir -p $WORK/in $WORK/out
+
+# gen <n> -- writes file n of the project into $WORK/in
+gen()
+{
+	awk -v n="$1" 'BEGIN {
+		for (c=0; c<4; c++) {
+			cls = sprintf( "Class%d_%d", n, c )
+			printf "/*: class %s  One of the classes of file %d\n\n", cls, n
+			printf "\tA longer description of the class, as the first paragraph of\n"
+			printf "\tits page.  It mentions a < b, &amp; and <B>markup</B>.\n*/\n"
+			printf "class %s {\npublic:\n", cls
+			for (m=0; m<10; m++) {
+				printf "/*: routine %s::get%d  Returns item %d of the class\n\n", cls, m, m
+				printf "\tLooks the item up and returns it.  Items are numbered from\n"
+				printf "\tzero; asking for one that does not exist returns 0.\n\n"
+				printf "\tReturns: the item, or 0\n*/\n"
+				printf "\tconst Item* get%d( int nIndex, const std::string& sName ) const;\n\n", m
+			}
+			for (v=0; v<4; v++) {
+				printf "/*: variable %s::m_n%d  A counter */\n\tint m_n%d;\n", cls, v, v
+			}
+			printf "};\n\n"
+		}
+		printf "/*: routine helper%d  A global helper */\nvoid helper%d();\n", n, n
+	}' >$WORK/in/f$1.h
+}
+
+# median -- prints the median of the numbers on stdin
+median()
+{
+	sort -n | awk '{ a[NR]=$1 } END { print a[int((NR+1)/2)] }'
+}
+
+# stat <key> <line> -- prints the value of key=value in a --stats line
+stat()
+{
+	echo "$2" | tr ' ' '\n' | sed -n "s/^$1=//p"
+}
+
+i=0
+while [ $i -lt $FILES ]
+do
+	gen $i
+	i=`expr $i + 1`
+done
+
+: >$WORK/runs
+r=0
+while [ $r -lt $RUNS ]
+do
+	rm -rf $WORK/out/*
+	line=`$DOCGEN --stats $WORK/out $WORK/in/*.h 2>&1 >/dev/null | grep '^stats:'`
+	if [ -z "$line" ]
+	then
+		echo "perfcheck: $DOCGEN did not report --stats"
+		exit 1
+	fi
+	bytes=`stat bytes "$line"`
+	ms=`stat ms "$line"`
+	rss=`stat maxrss_kb "$line"`
+	awk -v b=$bytes -v ms=$ms -v rss=$rss 'BEGIN {
+		if (ms<1) ms=1
+		printf "%.2f %d\n", b/1048576/(ms/1000), rss
+	}' >>$WORK/runs
+	r=`expr $r + 1`
+done
+
+mbs=`cut -d' ' -f1 $WORK/runs | median`
+rss=`cut -d' ' -f2 $WORK/runs | median`
+echo "perfcheck: $FILES files, $bytes bytes, median of $RUNS runs: $mbs MB/s, $rss KB peak RSS"
+
+if [ -n "$UPDATE" ]
+then
+	{
+		echo "# docgen perfcheck baseline, `uname -sm`, `date +%Y-%m-%d`"
+		printf "files %s\nthroughput_mbs %s\nmaxrss_kb %s\n" $FILES $mbs $rss
+	} >$BASELINE
+	echo "perfcheck: baseline written to $BASELINE"
+	exit 0
+fi
+
+if [ ! -f $BASELINE ]
+then
+	echo "perfcheck: no baseline $BASELINE (make one with UPDATE=1)"
+	exit 1
+fi
+base_files=`sed -n 's/^files //p' $BASELINE`
+if [ "$base_files" != "$FILES" ]
+then
+	echo "perfcheck: baseline is for $base_files files, not $FILES"
+	exit 1
+fi
+base_mbs=`sed -n 's/^throughput_mbs //p' $BASELINE`
+base_rss=`sed -n 's/^maxrss_kb //p' $BASELINE`
+echo "perfcheck: baseline $base_mbs MB/s, $base_rss KB, tolerance $TOLERANCE"
+
+status=0
+if awk -v v=$mbs -v b=$base_mbs -v tol=$TOLERANCE 'BEGIN { exit !(v < b*(1-tol)) }'
+then
+	echo "perfcheck: FAILED: throughput regressed"
+	status=1
+fi
+if awk -v v=$rss -v b=$base_rss -v tol=$TOLERANCE 'BEGIN { exit !(v > b*(1+tol)) }'
+then
+	echo "perfcheck: FAILED: peak RSS regressed"
+	status=1
+fi
+[ $status -eq 0 ] && echo "perfcheck: passed"
+exit $status
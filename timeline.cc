@@ -0,0 +1,204 @@
+/* timeline.cc  -- Timed spans of a run, for a trace viewer
+
+Copyright (C) 2017, Brian Bray
+
+*/
+
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <unistd.h>
+
+#include "timeline.h"
+
+using std::string;
+using std::string_view;
+
+/*: class Timeline
+
+	Aggregate counts cannot say which file or class is slow, so docgen
+	can record a span for each step of a run:
+	<DL>
+	<DT>parse<DD>One input, with its name, size and number of doc blocks
+	<DT>render<DD>One page, with its class, number of members and size
+	<DT>write<DD>Closing one output file, which flushes what is left
+	</DL>
+	With "--trace-out run.json" the spans are written in Chrome trace
+	event format, to be opened in chrome://tracing or Perfetto.
+	<P>
+	Each thread appends its spans to its own buffer, so recording takes
+	no lock.  A Span that is created while the Timeline is not enabled
+	records nothing and costs a test.  jsonOut() should be called once
+	the threads that record are done.
+*/
+
+bool Timeline::s_isEnabled = false;
+std::chrono::steady_clock::time_point Timeline::s_tpStart;
+
+namespace {
+
+// A finished span
+struct SpanEvent {
+	const char*		m_sName;
+	long long		m_usStart;
+	long long		m_usDuration;
+	string			m_sArgs;
+};
+
+// The spans of one thread
+struct ThreadBuffer {
+	int						m_nThread;		// Small number, for the viewer
+	std::vector< SpanEvent >	m_vEvents;
+};
+
+// Every thread's buffer, kept until the end of the run
+std::mutex s_mutexBuffers;
+std::vector< std::unique_ptr<ThreadBuffer> > s_vBuffers;
+
+}
+
+/*	threadBuffer -- internal routine returns the calling thread's buffer,
+			creating it on first use.
+*/
+static ThreadBuffer& threadBuffer()
+{
+	static thread_local ThreadBuffer* s_pBuffer = 0;
+
+	if (s_pBuffer==0) {
+		std::lock_guard<std::mutex> lock( s_mutexBuffers );
+		s_vBuffers.emplace_back( new ThreadBuffer );
+		s_pBuffer = s_vBuffers.back().get();
+		s_pBuffer->m_nThread = (int)s_vBuffers.size();
+	}
+	return *s_pBuffer;
+}
+
+/*	appendJsonString -- internal routine appends s as a JSON string */
+static void appendJsonString( string& sOut, string_view s )
+{
+	sOut += '"';
+	for (size_t i=0; i<s.size(); i++) {
+		unsigned char ch = s[i];
+		if (ch=='"' || ch=='\\') {
+			sOut += '\\';
+			sOut += ch;
+		} else if (ch<0x20) {
+			char szEscape[8];
+			snprintf( szEscape, sizeof(szEscape), "\\u%04x", ch );
+			sOut += szEscape;
+		} else {
+			sOut += ch;
+		}
+	}
+	sOut += '"';
+}
+
+
+/*: routine Timeline::enable
+
+	Starts recording.  Times are from this call.
+*/
+void Timeline::enable()
+{
+	s_tpStart = std::chrono::steady_clock::now();
+	s_isEnabled = true;
+}
+
+/*	Timeline::now -- internal routine returns microseconds since enable() */
+long long Timeline::now()
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(
+	           std::chrono::steady_clock::now() - s_tpStart ).count();
+}
+
+/*: routine Timeline::jsonOut
+
+	Writes every recorded span as a Chrome trace event file.
+*/
+void Timeline::jsonOut( std::ostream& os )
+{
+	std::lock_guard<std::mutex> lock( s_mutexBuffers );
+	long nPid = (long)getpid();
+	const char* sSeparator = "\n";
+
+	os << "{\"traceEvents\":[";
+	for (size_t iBuf=0; iBuf<s_vBuffers.size(); iBuf++) {
+		const ThreadBuffer& buf = *s_vBuffers[iBuf];
+
+		for (size_t i=0; i<buf.m_vEvents.size(); i++) {
+			const SpanEvent& ev = buf.m_vEvents[i];
+
+			os << sSeparator << "{\"name\":\"" << ev.m_sName << "\",\"cat\":\"docgen\""
+			   << ",\"ph\":\"X\",\"ts\":" << ev.m_usStart
+			   << ",\"dur\":" << ev.m_usDuration
+			   << ",\"pid\":" << nPid << ",\"tid\":" << buf.m_nThread
+			   << ",\"args\":{" << ev.m_sArgs << "}}";
+			sSeparator = ",\n";
+		}
+	}
+	os << "\n],\"displayTimeUnit\":\"ms\"}\n";
+}
+
+
+/*: routine Timeline::Span::Span
+
+	Starts a span, if the Timeline is enabled.  sName must be a string
+	constant.
+*/
+Timeline::Span::Span( const char* sName )
+	:	m_sName( s_isEnabled ? sName : 0 ),
+	    m_usStart( s_isEnabled ? now() : 0 )
+{
+}
+
+/*: routine Timeline::Span::~Span		Ends the span and records it	*/
+Timeline::Span::~Span()
+{
+	if (m_sName==0)
+		return;
+
+	SpanEvent ev;
+	ev.m_sName = m_sName;
+	ev.m_usStart = m_usStart;
+	ev.m_usDuration = now() - m_usStart;
+	ev.m_sArgs = std::move( m_sArgs );
+	threadBuffer().m_vEvents.push_back( std::move(ev) );
+}
+
+/*: routine Timeline::Span::arg
+
+	Adds an argument, shown with the span in the viewer.  sKey must not
+	need escaping.
+
+	Prototype: void arg( const char* sKey, std::string_view sValue )
+	Prototype: void arg( const char* sKey, long long nValue )
+*/
+void Timeline::Span::arg( const char* sKey, string_view sValue )
+{
+	if (m_sName==0)
+		return;
+	if (!m_sArgs.empty())
+		m_sArgs += ',';
+	m_sArgs += '"';
+	m_sArgs += sKey;
+	m_sArgs += "\":";
+	appendJsonString( m_sArgs, sValue );
+}
+
+void Timeline::Span::arg( const char* sKey, long long nValue )
+{
+	if (m_sName==0)
+		return;
+	if (!m_sArgs.empty())
+		m_sArgs += ',';
+	m_sArgs += '"';
+	m_sArgs += sKey;
+	m_sArgs += "\":";
+	m_sArgs += std::to_string( nValue );
+}
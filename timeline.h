@@ -0,0 +1,50 @@
+/* timeline.h -- Timed spans of a run, for a trace viewer
+
+Copyright (C) 2017, Brian Bray
+
+*/
+
+/* Needs:
+#include <chrono>
+#include <ostream>
+#include <string>
+#include <string_view>
+*/
+
+//	Records how long each step of a run takes, per thread, and writes
+//	the result in Chrome trace event format.  Does nothing until enable().
+class Timeline {
+public:
+	//	Times the scope it is declared in, eg:
+	//		Timeline::Span span( "parse" );
+	//		span.arg( "file", fileName );
+	class Span {
+	public:
+		explicit Span( const char* sName );
+		~Span();
+
+		void arg( const char* sKey, std::string_view sValue );
+		void arg( const char* sKey, long long nValue );
+
+	private:
+		Span( const Span& );					// Not copyable
+		Span& operator=( const Span& );
+
+	private:
+		const char*		m_sName;		// 0 if not recording
+		long long		m_usStart;
+		std::string		m_sArgs;		// JSON members, without braces
+	};
+
+	static void enable();
+	static bool isEnabled() {
+		return s_isEnabled;
+	}
+	static void jsonOut( std::ostream& os );
+
+private:
+	static long long now();
+
+	static bool									s_isEnabled;
+	static std::chrono::steady_clock::time_point	s_tpStart;
+};
@@ -0,0 +1,545 @@
+/* uringsink.cc  -- Writing the output files in batches through io_uring
+
+Copyright (C) 2017, Brian Bray
+
+*/
+
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <map>
+#include <set>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+#if defined(__NR_io_uring_setup) && defined(IO_URING_OP_SUPPORTED)
+#define HAVE_IO_URING 1				// Headers from Linux 5.6 or later
+#endif
+
+#include "bw/exception.h"
+#include "docsink.h"
+#include "timeline.h"
+#include "uringsink.h"
+
+using bw::BFileException;
+using std::string;
+
+/*: class UringSink
+
+	DocSink that writes each file into a directory, like DirSink, but
+	without a blocking open, write and close for every page.  Pages are
+	built in memory and collected into batches of BatchFiles.  Each
+	batch goes through io_uring in three steps from this thread: every
+	open in flight at once, then every write, then every close.  A batch
+	of 64 pages costs a few system calls instead of 192.
+	<P>
+	io_uring is used directly through its system calls.  Where it is not
+	available (not Linux, a kernel before 5.6, or blocked by a seccomp
+	filter) each file is written with plain blocking calls instead.
+	<P>
+	Errors are reported when a batch is written, by endFile() or
+	flush(), so when a file cannot be written some of the pages after it
+	may already have been.
+*/
+
+enum {BatchFiles=64};				// Files in flight at once
+
+#ifdef HAVE_IO_URING
+
+// The mapped submission and completion queues of an io_uring
+struct UringSink::Ring {
+	int				m_fd;
+	void*			m_pSqMem;
+	size_t			m_cbSqMem;
+	void*			m_pCqMem;			// May be m_pSqMem
+	size_t			m_cbCqMem;
+	io_uring_sqe*	m_aSqes;
+	size_t			m_cbSqes;
+
+	unsigned*		m_pSqHead;
+	unsigned*		m_pSqTail;
+	unsigned		m_nSqMask;
+	unsigned*		m_aSqArray;
+	unsigned		m_cToSubmit;		// Queued since the last enter
+
+	unsigned*		m_pCqHead;
+	unsigned*		m_pCqTail;
+	unsigned		m_nCqMask;
+	io_uring_cqe*	m_aCqes;
+};
+
+/*	ringClose -- internal routine unmaps and closes a ring */
+static void ringClose( UringSink::Ring* pRing )
+{
+	if (pRing->m_aSqes)
+		munmap( pRing->m_aSqes, pRing->m_cbSqes );
+	if (pRing->m_pCqMem && pRing->m_pCqMem!=pRing->m_pSqMem)
+		munmap( pRing->m_pCqMem, pRing->m_cbCqMem );
+	if (pRing->m_pSqMem)
+		munmap( pRing->m_pSqMem, pRing->m_cbSqMem );
+	if (pRing->m_fd>=0)
+		close( pRing->m_fd );
+	delete pRing;
+}
+
+/*	ringSupports -- internal routine checks that the kernel has the
+			operations UringSink needs.
+*/
+static bool ringSupports( int fdRing )
+{
+	const int cOps = 256;
+	std::vector<char> vProbe( sizeof(io_uring_probe) + cOps*sizeof(io_uring_probe_op), 0 );
+	io_uring_probe* pProbe = (io_uring_probe*)vProbe.data();
+
+	if (syscall( __NR_io_uring_register, fdRing, IORING_REGISTER_PROBE, pProbe, cOps )<0)
+		return false;			// Before 5.6, which also lacks OPENAT
+
+	const int aOps[] = { IORING_OP_OPENAT, IORING_OP_WRITE, IORING_OP_CLOSE };
+	for (size_t i=0; i<sizeof(aOps)/sizeof(aOps[0]); i++) {
+		if (aOps[i]>pProbe->last_op ||
+		    !(pProbe->ops[aOps[i]].flags & IO_URING_OP_SUPPORTED))
+			return false;
+	}
+	return true;
+}
+
+/*	ringOpen -- internal routine sets up a ring with room for cEntries
+			operations.  Returns 0 if io_uring cannot be used.
+*/
+static UringSink::Ring* ringOpen( unsigned cEntries )
+{
+	io_uring_params params;
+	memset( &params, 0, sizeof(params) );
+
+	int fd = (int)syscall( __NR_io_uring_setup, cEntries, &params );
+	if (fd<0)
+		return 0;
+
+	UringSink::Ring* pRing = new UringSink::Ring;
+	memset( pRing, 0, sizeof(*pRing) );
+	pRing->m_fd = fd;
+	if (!ringSupports( fd )) {
+		ringClose( pRing );
+		return 0;
+	}
+
+	pRing->m_cbSqMem = params.sq_off.array + params.sq_entries*sizeof(unsigned);
+	pRing->m_cbCqMem = params.cq_off.cqes + params.cq_entries*sizeof(io_uring_cqe);
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		if (pRing->m_cbCqMem>pRing->m_cbSqMem)
+			pRing->m_cbSqMem = pRing->m_cbCqMem;
+		pRing->m_cbCqMem = pRing->m_cbSqMem;
+	}
+
+	void* p = mmap( 0, pRing->m_cbSqMem, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+	                fd, IORING_OFF_SQ_RING );
+	if (p==MAP_FAILED) {
+		ringClose( pRing );
+		return 0;
+	}
+	pRing->m_pSqMem = p;
+
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		pRing->m_pCqMem = pRing->m_pSqMem;
+	} else {
+		p = mmap( 0, pRing->m_cbCqMem, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+		          fd, IORING_OFF_CQ_RING );
+		if (p==MAP_FAILED) {
+			ringClose( pRing );
+			return 0;
+		}
+		pRing->m_pCqMem = p;
+	}
+
+	pRing->m_cbSqes = params.sq_entries*sizeof(io_uring_sqe);
+	p = mmap( 0, pRing->m_cbSqes, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+	          fd, IORING_OFF_SQES );
+	if (p==MAP_FAILED) {
+		ringClose( pRing );
+		return 0;
+	}
+	pRing->m_aSqes = (io_uring_sqe*)p;
+
+	char* pSq = (char*)pRing->m_pSqMem;
+	pRing->m_pSqHead = (unsigned*)(pSq + params.sq_off.head);
+	pRing->m_pSqTail = (unsigned*)(pSq + params.sq_off.tail);
+	pRing->m_nSqMask = *(unsigned*)(pSq + params.sq_off.ring_mask);
+	pRing->m_aSqArray = (unsigned*)(pSq + params.sq_off.array);
+
+	char* pCq = (char*)pRing->m_pCqMem;
+	pRing->m_pCqHead = (unsigned*)(pCq + params.cq_off.head);
+	pRing->m_pCqTail = (unsigned*)(pCq + params.cq_off.tail);
+	pRing->m_nCqMask = *(unsigned*)(pCq + params.cq_off.ring_mask);
+	pRing->m_aCqes = (io_uring_cqe*)(pCq + params.cq_off.cqes);
+	return pRing;
+}
+
+/*	ringSqe -- internal routine returns a cleared submission entry.  The
+			caller fills it in before the next ringWait().  There is
+			always room, as no more than BatchFiles are queued at once.
+*/
+static io_uring_sqe* ringSqe( UringSink::Ring& ring, uint64_t nUserData )
+{
+	unsigned nTail = *ring.m_pSqTail;
+	unsigned iSqe = nTail & ring.m_nSqMask;
+	io_uring_sqe* pSqe = &ring.m_aSqes[iSqe];
+
+	memset( pSqe, 0, sizeof(*pSqe) );
+	pSqe->user_data = nUserData;
+	ring.m_aSqArray[iSqe] = iSqe;
+	__atomic_store_n( ring.m_pSqTail, nTail+1, __ATOMIC_RELEASE );
+	ring.m_cToSubmit++;
+	return pSqe;
+}
+
+// A completed operation
+struct RingResult {
+	uint64_t		m_nUserData;
+	int				m_nResult;			// -errno on failure
+};
+
+/*	ringWait -- internal routine submits what has been queued and waits
+			for cWait completions.  Returns false, with errno set, if
+			io_uring itself fails; vResults then holds the completions
+			that did arrive, which the caller must still account for.
+*/
+static bool ringWait( UringSink::Ring& ring, unsigned cWait, std::vector<RingResult>& vResults )
+{
+	vResults.clear();
+	while (vResults.size()<cWait) {
+		unsigned nHead = *ring.m_pCqHead;
+		unsigned nTail = __atomic_load_n( ring.m_pCqTail, __ATOMIC_ACQUIRE );
+
+		for (; nHead!=nTail; nHead++) {
+			const io_uring_cqe& cqe = ring.m_aCqes[nHead & ring.m_nCqMask];
+			RingResult result = { cqe.user_data, cqe.res };
+			vResults.push_back( result );
+		}
+		__atomic_store_n( ring.m_pCqHead, nHead, __ATOMIC_RELEASE );
+		if (vResults.size()>=cWait)
+			break;
+
+		int cSubmitted = (int)syscall( __NR_io_uring_enter, ring.m_fd, ring.m_cToSubmit,
+		                               cWait-vResults.size(), IORING_ENTER_GETEVENTS, 0, 0 );
+		if (cSubmitted<0) {
+			if (errno==EINTR)
+				continue;
+			return false;
+		}
+		ring.m_cToSubmit -= cSubmitted;
+	}
+	return true;
+}
+
+#else
+
+struct UringSink::Ring {
+};
+
+#endif
+
+
+/*	isSameFile -- internal routine returns true if the file sPath holds
+			exactly sData.
+*/
+static bool isSameFile( const string& sPath, const string& sData )
+{
+	int fd = open( sPath.c_str(), O_RDONLY|O_CLOEXEC );
+	if (fd<0)
+		return false;
+
+	struct stat st;
+	bool isSame = fstat( fd, &st )==0 && S_ISREG(st.st_mode)
+	              && (size_t)st.st_size==sData.size();
+	char buf[16384];
+	size_t cbDone = 0;
+	while (isSame && cbDone<sData.size()) {
+		ssize_t cb = read( fd, buf, sizeof(buf) );
+		if (cb<0 && errno==EINTR)
+			continue;
+		isSame = cb>0 && (size_t)cb<=sData.size()-cbDone
+		         && memcmp( buf, sData.data()+cbDone, cb )==0;
+		cbDone += cb>0 ? cb : 0;
+	}
+	close( fd );
+	return isSame;
+}
+
+
+/*: routine UringSink::UringSink
+
+	Writes into the directory sDir.  If isUring is false, or io_uring
+	cannot be used, files are written one at a time.
+*/
+UringSink::UringSink( const string& sDir, bool isUring )
+	:	m_sDir( sDir ),
+	    m_pRing( 0 )
+{
+#ifdef HAVE_IO_URING
+	if (isUring)
+		m_pRing = ringOpen( BatchFiles );
+#endif
+}
+
+/*: routine UringSink::~UringSink
+
+	Destructor.  Files not yet written by flush() are dropped, as after
+	an error.
+*/
+UringSink::~UringSink()
+{
+#ifdef HAVE_IO_URING
+	if (m_pRing)
+		ringClose( m_pRing );
+#endif
+}
+
+/*: routine UringSink::setLinkFrom
+
+	Files whose content is the same as the file of the same name in sDir
+	are hard linked from there instead of written, so they keep their
+	inode and modification time.  sDir must be on the same file system.
+	See StagedDir.
+*/
+void UringSink::setLinkFrom( const string& sDir )
+{
+	m_sLinkFrom = sDir;
+}
+
+/*: routine UringSink::writeFile
+
+	Queues a complete file, and writes the batch once it is full.  When
+	io_uring is not used, writes the file now.  A file that is already
+	queued is replaced, as it would be when written twice.  An unchanged
+	file is linked instead, see setLinkFrom().
+
+	Throws: if a file cannot be written
+*/
+void UringSink::writeFile( const string& sFileName, string sData )
+{
+	Pending pending;
+	pending.m_sPath = m_sDir + "/" + sFileName;
+	if (!m_sLinkFrom.empty()) {
+		// Never write through a link into the other tree
+		if (m_setLinked.erase( sFileName ))
+			unlink( pending.m_sPath.c_str() );
+
+		string sFrom = m_sLinkFrom + "/" + sFileName;
+		if (isSameFile( sFrom, sData )) {
+			for (size_t i=0; i<m_vPending.size(); i++) {
+				if (m_vPending[i].m_sPath==pending.m_sPath) {
+					m_vPending.erase( m_vPending.begin()+i );
+					break;
+				}
+			}
+			if (linkat( AT_FDCWD, sFrom.c_str(), AT_FDCWD, pending.m_sPath.c_str(), 0 )==0) {
+				m_setLinked.insert( sFileName );
+				return;
+			}
+		}
+	}
+	pending.m_sData = std::move( sData );
+	pending.m_fd = -1;
+	pending.m_cbDone = 0;
+	pending.m_nError = 0;
+
+	if (m_pRing==0) {
+		blockingOut( pending );
+		return;
+	}
+	for (size_t i=0; i<m_vPending.size(); i++) {
+		if (m_vPending[i].m_sPath==pending.m_sPath) {
+			m_vPending[i].m_sData = std::move( pending.m_sData );
+			return;
+		}
+	}
+	m_vPending.push_back( std::move(pending) );
+	if (m_vPending.size()>=BatchFiles)
+		batchOut();
+}
+
+/*: routine UringSink::flush
+
+	Writes the files still queued.
+
+	Throws: if a file cannot be written
+*/
+void UringSink::flush()
+{
+	if (!m_vPending.empty())
+		batchOut();
+}
+
+/*	UringSink::blockingOut -- internal routine writes one file with
+			blocking calls.
+
+	Throws: if the file cannot be written
+*/
+void UringSink::blockingOut( const Pending& pending )
+{
+	Timeline::Span span( "write" );
+	span.arg( "file", pending.m_sPath );
+
+	int fd = open( pending.m_sPath.c_str(), O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0666 );
+	if (fd<0)
+		throw BFileException( BFileException::SystemError );
+
+	const char* p = pending.m_sData.data();
+	size_t cbLeft = pending.m_sData.size();
+	while (cbLeft>0) {
+		ssize_t cb = write( fd, p, cbLeft );
+		if (cb<0 && errno==EINTR)
+			continue;
+		if (cb<=0) {
+			close( fd );
+			throw BFileException( BFileException::SystemError );
+		}
+		p += cb;
+		cbLeft -= cb;
+	}
+	if (close( fd )!=0)
+		throw BFileException( BFileException::SystemError );
+}
+
+/*	UringSink::abandonBatch -- internal routine, after io_uring itself
+			has failed, closes the files of the batch that are still
+			open and drops the batch.  The ring is closed too, as it may
+			still hold operations of the batch, so later files are
+			written with blocking calls.
+
+	Throws: always, the error of the ring
+*/
+void UringSink::abandonBatch()
+{
+	int nError = errno;
+	for (size_t i=0; i<m_vPending.size(); i++) {
+		if (m_vPending[i].m_fd>=0)
+			close( m_vPending[i].m_fd );
+	}
+	m_vPending.clear();
+#ifdef HAVE_IO_URING
+	ringClose( m_pRing );
+	m_pRing = 0;
+#endif
+	errno = nError;
+	throw BFileException( BFileException::SystemError );
+}
+
+/*	UringSink::batchOut -- internal routine writes the queued files
+			through io_uring: all of the opens, then all of the writes
+			(again for any short ones), then all of the closes.
+
+	Throws: if any of the files cannot be written, with errno set to
+		the error of the first one that failed
+*/
+void UringSink::batchOut()
+{
+#ifdef HAVE_IO_URING
+	Timeline::Span span( "write" );
+	Ring& ring = *m_pRing;
+	std::vector<RingResult> vResults;
+	size_t cbTotal = 0;
+
+	span.arg( "files", (long long)m_vPending.size() );
+
+	// Open every file
+	for (size_t i=0; i<m_vPending.size(); i++) {
+		io_uring_sqe* pSqe = ringSqe( ring, i );
+		pSqe->opcode = IORING_OP_OPENAT;
+		pSqe->fd = AT_FDCWD;
+		pSqe->addr = (uintptr_t)m_vPending[i].m_sPath.c_str();
+		pSqe->len = 0666;
+		pSqe->open_flags = O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC;
+		cbTotal += m_vPending[i].m_sData.size();
+	}
+	span.arg( "bytes", (long long)cbTotal );
+	bool isRingOk = ringWait( ring, m_vPending.size(), vResults );
+	for (size_t i=0; i<vResults.size(); i++) {
+		Pending& pending = m_vPending[vResults[i].m_nUserData];
+		if (vResults[i].m_nResult>=0)
+			pending.m_fd = vResults[i].m_nResult;
+		else
+			pending.m_nError = -vResults[i].m_nResult;
+	}
+	if (!isRingOk)
+		abandonBatch();
+
+	// Write them, until there are no short writes left
+	for (;;) {
+		unsigned cWrites = 0;
+		for (size_t i=0; i<m_vPending.size(); i++) {
+			Pending& pending = m_vPending[i];
+			if (pending.m_fd<0 || pending.m_nError || pending.m_cbDone==pending.m_sData.size())
+				continue;
+
+			size_t cbLeft = pending.m_sData.size() - pending.m_cbDone;
+			io_uring_sqe* pSqe = ringSqe( ring, i );
+			pSqe->opcode = IORING_OP_WRITE;
+			pSqe->fd = pending.m_fd;
+			pSqe->addr = (uintptr_t)(pending.m_sData.data() + pending.m_cbDone);
+			pSqe->len = cbLeft<(1u<<30) ? (unsigned)cbLeft : (1u<<30);
+			pSqe->off = pending.m_cbDone;
+			cWrites++;
+		}
+		if (cWrites==0)
+			break;
+
+		isRingOk = ringWait( ring, cWrites, vResults );
+		for (size_t i=0; i<vResults.size(); i++) {
+			Pending& pending = m_vPending[vResults[i].m_nUserData];
+			int nResult = vResults[i].m_nResult;
+			if (nResult>0)
+				pending.m_cbDone += nResult;
+			else if (nResult==0)
+				pending.m_nError = EIO;
+			else if (nResult!=-EINTR && nResult!=-EAGAIN)
+				pending.m_nError = -nResult;
+		}
+		if (!isRingOk)
+			abandonBatch();
+	}
+
+	// Close them
+	unsigned cCloses = 0;
+	for (size_t i=0; i<m_vPending.size(); i++) {
+		if (m_vPending[i].m_fd<0)
+			continue;
+		io_uring_sqe* pSqe = ringSqe( ring, i );
+		pSqe->opcode = IORING_OP_CLOSE;
+		pSqe->fd = m_vPending[i].m_fd;
+		cCloses++;
+	}
+	isRingOk = ringWait( ring, cCloses, vResults );
+	for (size_t i=0; i<vResults.size(); i++) {
+		Pending& pending = m_vPending[vResults[i].m_nUserData];
+		pending.m_fd = -1;
+		if (vResults[i].m_nResult<0 && pending.m_nError==0)
+			pending.m_nError = -vResults[i].m_nResult;
+	}
+	if (!isRingOk)
+		abandonBatch();
+
+	// Report the error of the first file that failed
+	int nError = 0;
+	for (size_t i=0; i<m_vPending.size() && nError==0; i++)
+		nError = m_vPending[i].m_nError;
+	m_vPending.clear();
+	if (nError!=0) {
+		errno = nError;
+		throw BFileException( BFileException::SystemError );
+	}
+#endif
+}
@@ -0,0 +1,55 @@
+/* uringsink.h -- Writing the output files in batches through io_uring
+
+Copyright (C) 2017, Brian Bray
+
+*/
+
+/* Needs:
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "docsink.h"
+*/
+
+//	Writes each file into a directory, many files at a time through
+//	io_uring, or one at a time where io_uring is not available.
+class UringSink : public BufferedSink {
+public:
+	struct Ring;					// io_uring state, see uringsink.cc
+
+	UringSink( const std::string& sDir, bool isUring=true );
+	virtual ~UringSink();
+
+	virtual void flush();
+	void setLinkFrom( const std::string& sDir );
+	bool isUring() const {
+		return m_pRing!=0;
+	}
+
+protected:
+	virtual void writeFile( const std::string& sFileName, std::string sData );
+
+private:
+	struct Pending {
+		std::string		m_sPath;		// Directory and file name
+		std::string		m_sData;
+		int				m_fd;			// -1 until opened
+		size_t			m_cbDone;		// Written so far
+		int				m_nError;		// errno of the first failure, or 0
+	};
+
+	void batchOut();
+	void abandonBatch();
+	void blockingOut( const Pending& pending );
+
+	UringSink( const UringSink& );					// Not copyable
+	UringSink& operator=( const UringSink& );
+
+private:
+	std::string				m_sDir;
+	Ring*					m_pRing;		// 0 when writes are blocking
+	std::vector< Pending >	m_vPending;		// Files not written yet
+	std::string				m_sLinkFrom;	// Unchanged files are linked from here
+	std::set< std::string >	m_setLinked;	// Files that were linked
+};